@@ -39,12 +39,28 @@
 #endif
 #include "lwip/err.h"
 #include "lwip/dns.h"
+#include "esp_timer.h"
+#include <RxTimestamp.h>
 
 extern void tcpipInit();
 extern void add_esp_interface_netif(esp_interface_t interface, esp_netif_t *esp_netif); /* from WiFiGeneric */
 
 #if ESP_IDF_VERSION_MAJOR > 3
 
+/**
+* @brief Driver input path, stamps received frames for RxTimestamp before handing them to lwIP
+*
+* @param[in] eth_handle: handle of Ethernet driver
+* @param[in] buffer: received frame, ownership passes to esp_netif_receive
+* @param[in] length: frame length
+* @param[in] priv: esp-netif the driver is attached to
+*/
+static esp_err_t eth_input_stamped(esp_eth_handle_t eth_handle, uint8_t *buffer, uint32_t length, void *priv)
+{
+    rxTimestampFrame(buffer, length, esp_timer_get_time());
+    return esp_netif_receive((esp_netif_t *)priv, buffer, length, NULL);
+}
+
 /**
 * @brief Callback function invoked when lowlevel initialization is finished
 *
@@ -353,6 +369,9 @@ bool ETHClass::beginSPI( int miso, int mosi, int sck, int cs, int rst, int irq,
         return false;
     }
 
+    /* replaces the input path set by the netif glue, frames are stamped then passed on to lwIP */
+    esp_eth_update_input_path(eth_handle, eth_input_stamped, eth_netif);
+
     /* attach to WiFiGeneric to receive events */
     add_esp_interface_netif(ESP_IF_ETH, eth_netif);
 
@@ -470,6 +489,9 @@ bool ETHClass::begin(uint8_t phy_addr, int power, int mdc, int mdio, eth_phy_typ
         return false;
     }
 
+    /* replaces the input path set by the netif glue, frames are stamped then passed on to lwIP */
+    esp_eth_update_input_path(eth_handle, eth_input_stamped, eth_netif);
+
 
     /* attach to WiFiGeneric to receive events */
     add_esp_interface_netif(ESP_IF_ETH, eth_netif);
@@ -1,41 +1,491 @@
-#include <GPSManager.h>
-
-portMUX_TYPE mux = portMUX_INITIALIZER_UNLOCKED;
-
-GPSManager::GPSManager(Stream& serial, int ppsPin) {
-	_serial = &serial;
-	_ppsPin = ppsPin;
-	_lastUpdate = 0;
-	_gps = new TinyGPSPlus();
-	pinMode(_ppsPin, INPUT_PULLDOWN);
-	attachInterrupt(_ppsPin, ppsInterrupt, RISING);
-}
-
-GPSManager::~GPSManager() {
-	detachInterrupt(_ppsPin);
-}
-
-void GPSManager::loop() {
-	while (_serial->available()) {
-		if (_gps->encode(_serial->read()) && _gps->time.isUpdated() && _gps->date.isUpdated() && lastFix() < 100 && millis() - _lastUpdate > 900) {
-			TinyGPSTime time = _gps->time;
-			TinyGPSDate date = _gps->date;
-			setTime(time.hour(), time.minute(), time.second(), date.day(), date.month(), date.year());
-			_lastUpdate = millis();
-		}
-	}
-}
-
-boolean GPSManager::validFix() {
-	return _gps->time.isValid() && _gps->date.isValid();
-}
-
-uint32_t GPSManager::lastFix() {
-	return max(_gps->time.age(), _gps->date.age());
-}
-
-void IRAM_ATTR ppsInterrupt() {
-	portENTER_CRITICAL_ISR(&mux);
-	syncToPPS();
-	portEXIT_CRITICAL_ISR(&mux);
+#include <GPSManager.h>
+#include "hal/mcpwm_ll.h"
+
+#define PPS_CAPTURE_UNIT MCPWM_UNIT_0
+#define PPS_CAPTURE_EDGE MCPWM_SELECT_CAP0	// latches the PPS pin
+#define PPS_CAPTURE_NOW MCPWM_SELECT_CAP1	// only triggered in software, to read the capture timer
+#define PPS_CAPTURE_STATS_SHIFT 4			// latency average time constant, 2^4 edges
+#define GPS_EVENT_PPS ((uart_event_type_t)UART_EVENT_MAX)	// posted to the GPS task's queue on each PPS edge
+#define GPS_EPOCH 315964800		// Unix time of the GPS epoch, 6 January 1980
+#define GPS_LEAP_SECONDS 18		// GPS time ahead of UTC, for a receiver pulsing on GPS time
+#define SECS_PER_GPS_WEEK 604800
+
+static portMUX_TYPE captureMux = portMUX_INITIALIZER_UNLOCKED;
+static pps_capture_stats_t ppsCaptureStats = {0, 0, UINT32_MAX, 0, 0, 0};
+static uint32_t captureMean = 0;		 // latency mean in nanos << PPS_CAPTURE_STATS_SHIFT
+static uint64_t captureVariance = 0;	 // latency variance in nanos^2
+static QueueHandle_t ppsEvents = NULL;	 // queue the GPS task waits on, once it runs
+
+// Enabled once a second on the port the request comes in on, in the order they are sent. The
+// ACK only names CFG-MSG, so one is sent at a time and the next waits for its answer.
+static const uint8_t ubxMessages[GPS_UBX_MESSAGES][2] = {
+	{UBX_CLASS_TIM, UBX_ID_TIM_TP},
+	{UBX_CLASS_NAV, UBX_ID_NAV_TIMEUTC},
+	{UBX_CLASS_NAV, UBX_ID_NAV_PVT}};
+
+GPSManager::GPSManager(Stream& serial, int ppsPin, pps_mode_t ppsMode) {
+	_serial = &serial;
+	_uart = UART_NUM_MAX;
+	_events = NULL;
+	_ready = true;
+	_overflows = 0;
+	_dropped = 0;
+	_task = NULL;
+	_running = false;
+	_wakeups = 0;
+	_busy = 0;
+	_busySeq = 0;
+	_ppsPin = ppsPin;
+	_ppsMode = ppsMode;
+	_lastUpdate = 0;
+	_timeValid = false;
+	_dateValid = false;
+	_timeMillis = 0;
+	_dateMillis = 0;
+	_ubxEnabled = false;
+	_ubxMillis = 0;
+	_configNext = 0;
+	_configAttempts = 0;
+	_configMillis = 0;
+	_configured = 0;
+	beginPPS();
+}
+
+GPSManager::GPSManager(uart_port_t uart, int rxPin, int txPin, uint32_t baud, int ppsPin, pps_mode_t ppsMode) {
+	_serial = NULL;
+	_uart = uart;
+	_events = NULL;
+	_overflows = 0;
+	_dropped = 0;
+	_task = NULL;
+	_running = false;
+	_wakeups = 0;
+	_busy = 0;
+	_busySeq = 0;
+	_ppsPin = ppsPin;
+	_ppsMode = ppsMode;
+	_lastUpdate = 0;
+	_timeValid = false;
+	_dateValid = false;
+	_timeMillis = 0;
+	_dateMillis = 0;
+	_ubxEnabled = false;
+	_ubxMillis = 0;
+	_configNext = 0;
+	_configAttempts = 0;
+	_configMillis = 0;
+	_configured = 0;
+
+	uart_config_t config = {};
+	config.baud_rate = baud;
+	config.data_bits = UART_DATA_8_BITS;
+	config.parity = UART_PARITY_DISABLE;
+	config.stop_bits = UART_STOP_BITS_1;
+	config.flow_ctrl = UART_HW_FLOWCTRL_DISABLE;
+	config.source_clk = UART_SCLK_APB;
+	// pattern detection on a single '\n' with no idle time around it, as in the IDF NMEA example
+	_ready = uart_driver_install(_uart, GPS_UART_BUFFER, 0, GPS_UART_EVENTS, &_events, 0) == ESP_OK &&
+			 uart_param_config(_uart, &config) == ESP_OK &&
+			 uart_set_pin(_uart, txPin, rxPin, UART_PIN_NO_CHANGE, UART_PIN_NO_CHANGE) == ESP_OK &&
+			 uart_enable_pattern_det_baud_intr(_uart, '\n', 1, 9, 0, 0) == ESP_OK &&
+			 uart_pattern_queue_reset(_uart, GPS_UART_EVENTS) == ESP_OK;
+	beginPPS();
+}
+
+void GPSManager::beginPPS() {
+	pinMode(_ppsPin, INPUT_PULLDOWN);
+	if (_ppsMode == PPS_CAPTURE) {
+		mcpwm_gpio_init(PPS_CAPTURE_UNIT, MCPWM_CAP_0, _ppsPin);
+		mcpwm_capture_config_t config = {};
+		config.cap_edge = MCPWM_POS_EDGE;
+		config.cap_prescale = 1;
+		mcpwm_capture_enable_channel(PPS_CAPTURE_UNIT, PPS_CAPTURE_NOW, &config);
+		config.capture_cb = ppsCapture;
+		mcpwm_capture_enable_channel(PPS_CAPTURE_UNIT, PPS_CAPTURE_EDGE, &config);
+	} else {
+		attachInterrupt(_ppsPin, ppsInterrupt, RISING);
+	}
+}
+
+GPSManager::~GPSManager() {
+	if (_task) {
+		_running = false;
+		uart_event_t event = {};
+		event.type = GPS_EVENT_PPS;
+		xQueueSend(_events, &event, portMAX_DELAY);
+		while (__atomic_load_n(&_task, __ATOMIC_ACQUIRE) != NULL) {
+			delay(1);
+		}
+		ppsEvents = NULL;
+	}
+	if (_ppsMode == PPS_CAPTURE) {
+		mcpwm_capture_disable_channel(PPS_CAPTURE_UNIT, PPS_CAPTURE_EDGE);
+		mcpwm_capture_disable_channel(PPS_CAPTURE_UNIT, PPS_CAPTURE_NOW);
+	} else {
+		detachInterrupt(_ppsPin);
+	}
+	if (_serial == NULL && _events != NULL) {
+		uart_driver_delete(_uart);
+	} else if (_events != NULL) {
+		vQueueDelete(_events);
+	}
+}
+
+bool GPSManager::ready() {
+	return _ready;
+}
+
+void GPSManager::enableUBX() {
+	_ubxEnabled = true;
+	if (_serial == NULL && _ready) {
+		// frames are binary and as likely as not to hold a '\n', so the input is read as it
+		// arrives, on the driver's FIFO threshold and idle line events, instead of by line
+		uart_disable_pattern_det_intr(_uart);
+	}
+}
+
+bool GPSManager::begin(BaseType_t core, UBaseType_t priority) {
+	if (_task || !_ready) {
+		return false;
+	}
+	if (_serial) {
+		_events = xQueueCreate(4, sizeof(uart_event_t));	// only PPS edges, bytes are polled
+	}
+	_running = true;
+	if (xTaskCreatePinnedToCore(readTask, "gps", GPS_TASK_STACK, this, priority, &_task, core) != pdPASS) {
+		_running = false;
+		_task = NULL;
+		return false;
+	}
+	ppsEvents = _events;
+	return true;
+}
+
+void GPSManager::readTask(void* arg) {
+	GPSManager* manager = (GPSManager*)arg;
+	manager->run();
+	__atomic_store_n(&manager->_task, (TaskHandle_t)NULL, __ATOMIC_RELEASE);
+	vTaskDelete(NULL);
+}
+
+// Reads the same way as loop(), after blocking for the first event instead of polling
+void GPSManager::run() {
+	TickType_t timeout = _serial ? GPS_POLL_INTERVAL / portTICK_PERIOD_MS : portMAX_DELAY;
+	while (_running) {
+		uart_event_t event;
+		bool received = xQueueReceive(_events, &event, timeout) == pdTRUE;
+		int64_t start = esp_timer_get_time();
+		processPPS();
+		if (_serial) {
+			readStream();
+		} else if (received && readEvent(event)) {
+			readUART();
+		}
+		if (_ubxEnabled) {
+			configure();
+		}
+		uint32_t seq = _busySeq;
+		__atomic_store_n(&_busySeq, seq + 1, __ATOMIC_RELAXED);
+		__atomic_thread_fence(__ATOMIC_RELEASE);
+		_wakeups++;
+		_busy += esp_timer_get_time() - start;
+		__atomic_store_n(&_busySeq, seq + 2, __ATOMIC_RELEASE);
+	}
+}
+
+void GPSManager::loop() {
+	processPPS();  // before the serial so setTime() sees the latest edge
+	if (_serial) {
+		readStream();
+	} else if (_ready) {
+		readUART();
+	}
+	if (_ubxEnabled) {
+		configure();
+	}
+}
+
+void GPSManager::readStream() {
+	while (_serial->available()) {
+		encode(_serial->read());
+	}
+}
+
+// Only whole lines are read, bytes after the last '\n' stay in the ring buffer until the
+// rest of their sentence arrives. Every queued position is read on each event, so lines
+// are not held back when the event queue was full, and a line whose position was lost is
+// read along with the next one. On overflow the input is flushed, the positions no longer
+// match it, and parsing resumes at the next '$'.
+void GPSManager::readUART() {
+	uart_event_t event;
+	while (xQueueReceive(_events, &event, 0) == pdTRUE && readEvent(event)) {
+	}
+}
+
+// Returns false once the input was flushed, and with it the queued events
+bool GPSManager::readEvent(const uart_event_t& event) {
+	if (event.type == UART_PATTERN_DET && !_ubxEnabled) {
+		readLines();
+	} else if (event.type == UART_DATA && _ubxEnabled) {
+		readBytes();
+	} else if (event.type == UART_FIFO_OVF || event.type == UART_BUFFER_FULL) {
+		flushUART();
+		return false;
+	}
+	return true;
+}
+
+void GPSManager::readLines() {
+	int pos;
+	while ((pos = uart_pattern_pop_pos(_uart)) >= 0) {
+		char line[GPS_LINE_SIZE];
+		if ((size_t)pos < sizeof(line)) {
+			int n = uart_read_bytes(_uart, line, pos + 1, 0);
+			if (n <= 0) {
+				return;
+			}
+			// more than one line when the position of a line end was lost
+			for (const char* start = line; start < line + n;) {
+				const char* end = (const char*)memchr(start, '\n', line + n - start);
+				end = end ? end + 1 : line + n;
+				update(_nmea.parse(start, end - start));
+				start = end;
+			}
+			continue;
+		}
+		for (size_t remaining = pos + 1; remaining > 0;) {
+			int n = uart_read_bytes(_uart, line, min(remaining, sizeof(line)), 0);
+			if (n <= 0) {
+				return;
+			}
+			for (int i = 0; i < n; i++) {
+				encode(line[i]);
+			}
+			remaining -= n;
+		}
+	}
+}
+
+// Everything buffered, UBX frames are complete whether or not a line end follows them
+void GPSManager::readBytes() {
+	uint8_t buffer[GPS_LINE_SIZE];
+	int n;
+	while ((n = uart_read_bytes(_uart, buffer, sizeof(buffer), 0)) > 0) {
+		for (int i = 0; i < n; i++) {
+			encode(buffer[i]);
+		}
+	}
+}
+
+void GPSManager::flushUART() {
+	size_t buffered = 0;
+	uart_get_buffered_data_len(_uart, &buffered);
+	uart_flush_input(_uart);
+	xQueueReset(_events);
+	_overflows++;
+	_dropped += buffered;
+}
+
+void GPSManager::encode(uint8_t c) {
+	if (_ubxEnabled) {
+		ubx_message_t message = _ubx.encode(c);
+		if (message != UBX_NONE) {
+			update(message);
+			return;
+		}
+	}
+	update(_nmea.encode(c));
+}
+
+// Notes what a line carried, and sets the clock from one with both the time and the date
+void GPSManager::update(nmea_sentence_t sentence) {
+	if (sentence == NMEA_NONE) {
+		return;
+	}
+	uint32_t now = millis();
+	if (_nmea.timeUpdated()) {
+		_timeValid = true;
+		_timeMillis = now;
+	}
+	if (_nmea.dateUpdated()) {
+		_dateValid = true;
+		_dateMillis = now;
+	}
+	bool ubxTime = _ubxMillis != 0 && now - _ubxMillis < GPS_UBX_FRESH;	 // has validity flags, NMEA does not
+	if (_nmea.timeUpdated() && _nmea.dateUpdated() && now - _lastUpdate > 900 && !ubxTime) {
+		nmea_time_t time = _nmea.time();
+		nmea_date_t date = _nmea.date();
+		setTime(time.hour, time.minute, time.second, date.day, date.month, date.year);
+		_lastUpdate = now;
+	}
+}
+
+// Sets the clock from UBX time, passes on the quantization error of the next PPS edge and
+// moves the configuration on when the receiver answers
+void GPSManager::update(ubx_message_t message) {
+	uint32_t now = millis();
+	switch (message) {
+	case UBX_NAV_PVT:
+	case UBX_NAV_TIMEUTC: {
+		ubx_time_t time = _ubx.time();
+		if (!time.valid) {
+			break;
+		}
+		_timeValid = true;
+		_dateValid = true;
+		_timeMillis = now;
+		_dateMillis = now;
+		_ubxMillis = now;
+		// the epoch is the second itself, nanos from it, so setTime() anchors it to the edge that began it
+		if (now - _lastUpdate > 900) {
+			setTime(time.hour, time.minute, time.second, time.day, time.month, time.year);
+			_lastUpdate = now;
+		}
+		break;
+	}
+	case UBX_TIM_TP: {
+		// the second the pulse names is only trusted while the receiver's own time is
+		ubx_timepulse_t pulse = _ubx.timePulse();
+		if (pulse.qErrValid && _ubxMillis != 0 && now - _ubxMillis < GPS_UBX_FRESH) {
+			time_t second = GPS_EPOCH + (time_t)pulse.week * SECS_PER_GPS_WEEK + pulse.towMillis / 1000;
+			correctPPS(pulse.qErr, pulse.utc ? second : second - GPS_LEAP_SECONDS);
+		}
+		break;
+	}
+	case UBX_ACK_ACK:
+	case UBX_ACK_NAK:
+		if (_configAttempts > 0 && _ubx.acknowledged() == (UBX_CLASS_CFG << 8 | UBX_ID_CFG_MSG)) {
+			if (message == UBX_ACK_ACK) {
+				_configured++;
+			}
+			_configNext++;
+			_configAttempts = 0;
+			configure();
+		}
+		break;
+	default:
+		break;
+	}
+}
+
+// Sends the CFG-MSG for the next message, again when it goes unanswered for GPS_UBX_RETRY
+void GPSManager::configure() {
+	if (_configNext >= GPS_UBX_MESSAGES) {
+		return;
+	}
+	uint32_t now = millis();
+	if (_configAttempts > 0 && now - _configMillis < GPS_UBX_RETRY) {
+		return;
+	}
+	if (_configAttempts == GPS_UBX_ATTEMPTS) {
+		// not a u-blox receiver, or nothing is connected to TX
+		_configNext++;
+		_configAttempts = 0;
+		return;
+	}
+	const uint8_t payload[] = {ubxMessages[_configNext][0], ubxMessages[_configNext][1], 1};
+	uint8_t frame[sizeof(payload) + UBX_FRAME_OVERHEAD];
+	size_t length = UBXParser::frame(UBX_CLASS_CFG, UBX_ID_CFG_MSG, payload, sizeof(payload), frame, sizeof(frame));
+	if (_serial) {
+		_serial->write(frame, length);
+	} else {
+		uart_write_bytes(_uart, (const char*)frame, length);
+	}
+	_configAttempts++;
+	_configMillis = now;
+}
+
+boolean GPSManager::validFix() {
+	return _timeValid && _dateValid;
+}
+
+uint32_t GPSManager::lastFix() {
+	if (!validFix()) {
+		return UINT32_MAX;
+	}
+	uint32_t now = millis();
+	return max(now - _timeMillis, now - _dateMillis);
+}
+
+gps_stats_t GPSManager::stats() {
+	gps_stats_t stats;
+	nmea_stats_t nmea = _nmea.stats();
+	ubx_stats_t ubx = _ubx.stats();
+	stats.chars = nmea.chars + ubx.chars;
+	stats.passed = nmea.passed;
+	stats.failed = nmea.failed;
+	stats.withFix = nmea.withFix;
+	stats.ubxPassed = ubx.passed;
+	stats.ubxFailed = ubx.failed;
+	stats.configured = _configured;
+	stats.overflows = _overflows;
+	stats.dropped = _dropped;
+	uint32_t seq;
+	do {
+		seq = __atomic_load_n(&_busySeq, __ATOMIC_ACQUIRE);
+		stats.wakeups = _wakeups;
+		stats.busy = _busy;
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	} while ((seq & 1) || seq != __atomic_load_n(&_busySeq, __ATOMIC_RELAXED));
+	return stats;
+}
+
+pps_capture_stats_t GPSManager::captureStats() {
+	portENTER_CRITICAL(&captureMux);
+	pps_capture_stats_t stats = ppsCaptureStats;
+	uint64_t variance = captureVariance;
+	portEXIT_CRITICAL(&captureMux);
+	if (stats.edges == 0) {
+		stats.latencyMin = 0;
+	}
+	stats.latencyJitter = (uint32_t)sqrtf((float)variance);
+	return stats;
+}
+
+// Wakes the GPS task to process the edge, its queue also carries the UART driver's events
+static void IRAM_ATTR wakeForPPS(BaseType_t* woken) {
+	QueueHandle_t events = ppsEvents;
+	if (events) {
+		uart_event_t event = {};
+		event.type = GPS_EVENT_PPS;
+		xQueueSendFromISR(events, &event, woken);
+	}
+}
+
+void IRAM_ATTR ppsInterrupt() {
+	syncToPPS();  // queued for processPPS()
+	BaseType_t woken = pdFALSE;
+	wakeForPPS(&woken);
+	if (woken) {
+		portYIELD_FROM_ISR();
+	}
+}
+
+bool IRAM_ATTR ppsCapture(mcpwm_unit_t unit, mcpwm_capture_channel_id_t channel, const cap_event_data_t* edata, void* arg) {
+	// latch the capture timer between two reads of the system timer, the capture
+	// timer difference is how long before that the edge happened
+	int64_t before = esp_timer_get_time();
+	mcpwm_ll_trigger_soft_capture(&MCPWM0, PPS_CAPTURE_NOW);
+	int64_t after = esp_timer_get_time();
+	uint64_t isrNanos = (before + after) * 500;
+	uint32_t ticks = mcpwm_ll_capture_get_value(&MCPWM0, PPS_CAPTURE_NOW) - edata->cap_value;
+	uint32_t latency = ticks * 25 / 2;	// 80 MHz APB clock, 12.5 ns per tick
+	syncToPPS(isrNanos - latency);
+
+	portENTER_CRITICAL_ISR(&captureMux);
+	pps_capture_stats_t& stats = ppsCaptureStats;
+	if (stats.edges++ == 0) {
+		captureMean = latency << PPS_CAPTURE_STATS_SHIFT;
+	}
+	stats.latency = latency;
+	stats.latencyMin = min(stats.latencyMin, latency);
+	stats.latencyMax = max(stats.latencyMax, latency);
+	captureMean += latency - (captureMean >> PPS_CAPTURE_STATS_SHIFT);
+	stats.latencyMean = captureMean >> PPS_CAPTURE_STATS_SHIFT;
+	int64_t deviation = (int64_t)latency - stats.latencyMean;
+	captureVariance += (deviation * deviation - (int64_t)captureVariance) >> PPS_CAPTURE_STATS_SHIFT;
+	portEXIT_CRITICAL_ISR(&captureMux);
+	BaseType_t woken = pdFALSE;
+	wakeForPPS(&woken);
+	return woken == pdTRUE;
 }
\ No newline at end of file
@@ -1,21 +1,123 @@
-#pragma once
-#include <MicroTime.h>
-#include <TinyGPS++.h>
-
-class GPSManager {
-   public:
-	GPSManager(Stream& serial, int ppsPin);
-	~GPSManager();
-
-	void loop();
-	boolean validFix();
-	uint32_t lastFix();
-
-   private:
-	TinyGPSPlus* _gps;
-	Stream* _serial;
-	int _ppsPin;
-	uint32_t _lastUpdate;
-};
-
-void IRAM_ATTR ppsInterrupt();
\ No newline at end of file
+#pragma once
+#include <Arduino.h>
+#include <MicroTime.h>
+#include <NMEAParser.h>
+#include <UBXParser.h>
+#include "driver/mcpwm.h"
+#include "driver/uart.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/task.h"
+
+#define GPS_UART_BUFFER 2048	// RX ring buffer, about 180 ms of input at 115200 baud
+#define GPS_UART_EVENTS 64		// driver events and pattern positions, enough for a full buffer of short lines
+#define GPS_LINE_SIZE NMEA_LINE_SIZE	// lines read from the ring buffer whole, longer ones in pieces
+#define GPS_TASK_CORE 1			// with loop and HTTP, core 0 is left to networking and NTP
+#define GPS_TASK_PRIORITY 4		// above AsyncTCP (3) and loop (1), below the NTP task (10)
+#define GPS_TASK_STACK 4096
+#define GPS_POLL_INTERVAL 5		// ms between reads of a Stream, which cannot wake the task itself
+#define GPS_UBX_RETRY 1000		// ms to wait for the receiver to acknowledge a configuration message
+#define GPS_UBX_ATTEMPTS 5		// times each configuration message is sent before it is given up on
+#define GPS_UBX_FRESH 2000		// ms after the last UBX time during which NMEA does not set the clock
+#define GPS_UBX_MESSAGES 3		// enabled by enableUBX(), TIM-TP, NAV-TIMEUTC and NAV-PVT
+
+typedef enum {
+	PPS_INTERRUPT,	// GPIO interrupt, edge timestamped when the ISR runs
+	PPS_CAPTURE		// MCPWM capture unit, edge latched in hardware on the APB clock
+} pps_mode_t;
+
+// Capture to interrupt latency of PPS edges in PPS_CAPTURE mode, in nanoseconds.
+// This is the error PPS_INTERRUPT mode would have added to each edge.
+typedef struct {
+	uint32_t edges;
+	uint32_t latency;		 // last edge
+	uint32_t latencyMin;
+	uint32_t latencyMax;
+	uint32_t latencyMean;
+	uint32_t latencyJitter;	 // RMS deviation from the mean
+} pps_capture_stats_t;
+
+// Serial input counters from the NMEA and UBX parsers
+typedef struct {
+	uint32_t chars;		 // bytes read from the GPS
+	uint32_t passed;	 // sentences with a good checksum
+	uint32_t failed;	 // sentences with a bad or missing checksum
+	uint32_t withFix;	 // sentences that carried a fix
+	uint32_t ubxPassed;	 // UBX frames with a good checksum
+	uint32_t ubxFailed;	 // UBX frames with a bad checksum
+	uint8_t configured;	 // UBX messages the receiver acknowledged enabling, of GPS_UBX_MESSAGES
+	uint32_t overflows;	 // times the UART FIFO or ring buffer overflowed and input was flushed
+	uint32_t dropped;	 // bytes flushed after an overflow, not counting what the FIFO lost
+	uint32_t wakeups;	 // times the GPS task woke up
+	uint64_t busy;		 // microseconds the GPS task spent working
+} gps_stats_t;
+
+class GPSManager {
+   public:
+	GPSManager(Stream& serial, int ppsPin, pps_mode_t ppsMode = PPS_INTERRUPT);
+	// Reads the GPS from a hardware UART through the IDF driver, which moves the FIFO into
+	// a ring buffer from its interrupt and reports every '\n', so loop() reads whole lines
+	GPSManager(uart_port_t uart, int rxPin, int txPin, uint32_t baud, int ppsPin, pps_mode_t ppsMode = PPS_INTERRUPT);
+	~GPSManager();
+
+	bool ready();  // the serial input is configured
+	// Reads the GPS and processes PPS edges in a task of its own. With a UART the task sleeps
+	// until the driver has a complete line or the PPS interrupt fires, a Stream is polled every
+	// GPS_POLL_INTERVAL. Call either this once or loop() continuously.
+	bool begin(BaseType_t core = GPS_TASK_CORE, UBaseType_t priority = GPS_TASK_PRIORITY);
+	// Configures a u-blox receiver over the serial link to send TIM-TP, NAV-TIMEUTC and NAV-PVT
+	// every second, and decodes them along with NMEA. The clock is then set from UBX time and
+	// each PPS edge is corrected by the quantization error TIM-TP gives for it. Call before begin().
+	void enableUBX();
+	void loop();
+	boolean validFix();
+	uint32_t lastFix();
+	pps_capture_stats_t captureStats();
+	gps_stats_t stats();
+
+   private:
+	static void readTask(void* arg);
+	void run();
+	void beginPPS();
+	void readStream();
+	void readUART();
+	bool readEvent(const uart_event_t& event);
+	void readLines();
+	void readBytes();
+	void flushUART();
+	void encode(uint8_t c);
+	void update(nmea_sentence_t sentence);
+	void update(ubx_message_t message);
+	void configure();
+
+	NMEAParser _nmea;
+	UBXParser _ubx;
+	bool _ubxEnabled;
+	uint32_t _ubxMillis;	 // millis() when a valid UBX time last came in
+	uint8_t _configNext;	 // index of the message being enabled
+	uint8_t _configAttempts;
+	uint32_t _configMillis;	 // millis() when it was last sent
+	uint8_t _configured;
+	bool _timeValid;
+	bool _dateValid;
+	uint32_t _timeMillis;	 // millis() when the time or the date last came in
+	uint32_t _dateMillis;
+	Stream* _serial;	 // NULL when reading the UART driver
+	uart_port_t _uart;
+	QueueHandle_t _events;	 // the driver's, or the task's own when reading a Stream
+	bool _ready;
+	uint32_t _overflows;
+	uint32_t _dropped;
+	TaskHandle_t _task;
+	volatile bool _running;
+	// Published with a seqlock, the 64 bit busy time would tear on a 32 bit core
+	uint32_t _wakeups;
+	uint64_t _busy;
+	uint32_t _busySeq;
+	int _ppsPin;
+	pps_mode_t _ppsMode;
+	uint32_t _lastUpdate;
+};
+
+void IRAM_ATTR ppsInterrupt();
+bool IRAM_ATTR ppsCapture(mcpwm_unit_t unit, mcpwm_capture_channel_id_t channel, const cap_event_data_t* edata, void* arg);
\ No newline at end of file
@@ -0,0 +1,148 @@
+#include <MRUList.h>
+
+#include <algorithm>
+
+#define MRU_INTERVAL_SHIFT 3  // average interval time constant, 2^3 requests
+
+MRUList::MRUList() {
+	_nodes = new mru_node_t[MRU_ENTRIES]();
+	_buckets = new uint16_t[MRU_ENTRIES];
+	for (uint16_t i = 0; i < MRU_ENTRIES; i++) {
+		_buckets[i] = MRU_NONE;
+	}
+	_newest = MRU_NONE;
+	_oldest = MRU_NONE;
+	_used = 0;
+	_evicted = 0;
+	portMUX_INITIALIZE(&_mux);
+}
+
+MRUList::~MRUList() {
+	delete[] _nodes;
+	delete[] _buckets;
+}
+
+uint16_t MRUList::bucket(uint32_t ip) {
+	return ((uint32_t)(ip * 2654435761UL) >> 16) % MRU_ENTRIES;
+}
+
+// Takes a node out of the recency list, it stays in its hash bucket
+void MRUList::unlink(uint16_t index) {
+	mru_node_t* node = &_nodes[index];
+	if (node->newer != MRU_NONE) {
+		_nodes[node->newer].older = node->older;
+	} else {
+		_newest = node->older;
+	}
+	if (node->older != MRU_NONE) {
+		_nodes[node->older].newer = node->newer;
+	} else {
+		_oldest = node->newer;
+	}
+}
+
+void MRUList::update(uint32_t ip, uint16_t port, uint8_t header, uint64_t localMicros) {
+	uint16_t b = bucket(ip);
+	portENTER_CRITICAL(&_mux);
+	uint16_t index = _buckets[b];
+	while (index != MRU_NONE && _nodes[index].entry.ip != ip) {
+		index = _nodes[index].chain;
+	}
+	if (index == MRU_NONE) {
+		if (_used < MRU_ENTRIES) {
+			index = _used++;
+		} else {
+			// reuse the least recently seen client, it has to leave its bucket first
+			index = _oldest;
+			unlink(index);
+			uint16_t* link = &_buckets[bucket(_nodes[index].entry.ip)];
+			while (*link != index) {
+				link = &_nodes[*link].chain;
+			}
+			*link = _nodes[index].chain;
+			_evicted++;
+		}
+		mru_node_t* node = &_nodes[index];
+		node->entry.ip = ip;
+		node->entry.count = 0;
+		node->entry.interval = 0;
+		node->entry.first = localMicros;
+		node->chain = _buckets[b];
+		_buckets[b] = index;
+	} else {
+		unlink(index);
+	}
+
+	mru_entry_t* entry = &_nodes[index].entry;
+	if (entry->count > 0) {
+		uint64_t elapsed = localMicros - entry->last;
+		uint32_t interval = elapsed > 0xFFFFFFFFULL ? 0xFFFFFFFFUL : (uint32_t)elapsed;
+		if (entry->count == 1) {
+			entry->interval = interval;
+		} else {
+			entry->interval += ((int64_t)interval - entry->interval) >> MRU_INTERVAL_SHIFT;
+		}
+	}
+	entry->count++;
+	entry->last = localMicros;
+	entry->port = port;
+	entry->mode = header & 0x07;
+	entry->version = (header >> 3) & 0x07;
+
+	// in front as the newest
+	_nodes[index].older = _newest;
+	_nodes[index].newer = MRU_NONE;
+	if (_newest != MRU_NONE) {
+		_nodes[_newest].newer = index;
+	} else {
+		_oldest = index;
+	}
+	_newest = index;
+	portEXIT_CRITICAL(&_mux);
+}
+
+// The recency list can change order whenever the lock is released, so the arena is copied by
+// index instead, MRU_SNAPSHOT_CHUNK entries at a time, keeping the max most recent in a heap
+// outside the lock. Entries never move in the arena, so none is missed.
+size_t MRUList::snapshot(mru_entry_t* entries, size_t max) {
+	auto newer = [](const mru_entry_t& a, const mru_entry_t& b) { return a.last > b.last; };
+	mru_entry_t chunk[MRU_SNAPSHOT_CHUNK];
+	size_t count = 0;
+	for (uint32_t start = 0; max > 0; start += MRU_SNAPSHOT_CHUNK) {
+		uint32_t copied = 0;
+		portENTER_CRITICAL(&_mux);
+		for (uint32_t index = start; index < _used && copied < MRU_SNAPSHOT_CHUNK; index++) {
+			chunk[copied++] = _nodes[index].entry;
+		}
+		portEXIT_CRITICAL(&_mux);
+		for (uint32_t i = 0; i < copied; i++) {
+			// a client evicted and seen again between chunks can be in two slots, keep the newer
+			size_t same = 0;
+			while (same < count && entries[same].ip != chunk[i].ip) {
+				same++;
+			}
+			if (same < count) {
+				if (chunk[i].last > entries[same].last) {
+					entries[same] = chunk[i];
+					std::make_heap(entries, entries + count, newer);
+				}
+			} else if (count < max) {
+				entries[count++] = chunk[i];
+				std::push_heap(entries, entries + count, newer);
+			} else if (chunk[i].last > entries[0].last) {
+				std::pop_heap(entries, entries + count, newer);
+				entries[count - 1] = chunk[i];
+				std::push_heap(entries, entries + count, newer);
+			}
+		}
+		if (copied < MRU_SNAPSHOT_CHUNK) {
+			break;
+		}
+	}
+	std::sort_heap(entries, entries + count, newer);
+	return count;
+}
+
+uint32_t MRUList::evicted() {
+	return _evicted;
+}
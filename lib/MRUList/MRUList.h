@@ -0,0 +1,54 @@
+#pragma once
+#include <Arduino.h>
+
+#define MRU_ENTRIES 256	 // clients remembered, at most 65535
+#define MRU_NONE 0xFFFF
+#define MRU_SNAPSHOT_CHUNK 16	 // entries snapshot() copies per critical section, which masks interrupts
+
+// Recently seen NTP clients, like ntpd's MRU list. Entries live in a preallocated arena,
+// found through a hash of the address and kept in a doubly linked list from most to least
+// recently seen, so an update is O(1) and the least recent client is evicted when the
+// arena is full. Times are esp_timer_get_time() microseconds.
+
+typedef struct {
+	uint32_t ip;		// network byte order
+	uint16_t port;		// of the last request
+	uint8_t mode;		// of the last request
+	uint8_t version;	// of the last request
+	uint32_t count;		// requests seen
+	uint32_t interval;	// average microseconds between requests, saturating
+	uint64_t first;
+	uint64_t last;
+} mru_entry_t;
+
+class MRUList {
+	public:
+		MRUList();
+		~MRUList();
+
+		// Records a request, header is its first byte. Safe against concurrent snapshots.
+		void update(uint32_t ip, uint16_t port, uint8_t header, uint64_t localMicros);
+		// Copies up to max entries, most recently seen first, returns how many were copied. Taken a
+		// chunk at a time, so each entry is consistent but the list is not one instant.
+		size_t snapshot(mru_entry_t* entries, size_t max);
+		uint32_t evicted();
+
+	private:
+		typedef struct {
+			mru_entry_t entry;
+			uint16_t newer;
+			uint16_t older;
+			uint16_t chain;	 // next entry in the same hash bucket
+		} mru_node_t;
+
+		uint16_t bucket(uint32_t ip);
+		void unlink(uint16_t index);
+
+		mru_node_t* _nodes;
+		uint16_t* _buckets;
+		uint16_t _newest;
+		uint16_t _oldest;
+		uint16_t _used;
+		uint32_t _evicted;
+		portMUX_TYPE _mux;
+};
@@ -1,394 +1,754 @@
-/*
-  time.c - low level time and date functions
-  Copyright (c) Michael Margolis 2009-2014
-
-  This library is free software; you can redistribute it and/or
-  modify it under the terms of the GNU Lesser General Public
-  License as published by the Free Software Foundation; either
-  version 2.1 of the License, or (at your option) any later version.
-
-  This library is distributed in the hope that it will be useful,
-  but WITHOUT ANY WARRANTY; without even the implied warranty of
-  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
-  Lesser General Public License for more details.
-
-  You should have received a copy of the GNU Lesser General Public
-  License along with this library; if not, write to the Free Software
-  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
-  
-  1.0  6  Jan 2010 - initial release
-  1.1  12 Feb 2010 - fixed leap year calculation error
-  1.2  1  Nov 2010 - fixed setTime bug (thanks to Korman for this)
-  1.3  24 Mar 2012 - many edits by Paul Stoffregen: fixed timeStatus() to update
-                     status, updated examples for Arduino 1.0, fixed ARM
-                     compatibility issues, added TimeArduinoDue and TimeTeensy3
-                     examples, add error checking and messages to RTC examples,
-                     add examples to DS1307RTC library.
-  1.4  5  Sep 2014 - compatibility with Arduino 1.5.7
-*/
-
-#include <Arduino.h>
-#ifdef ESP32
-uint64_t ICACHE_RAM_ATTR micros64() { return esp_timer_get_time(); }
-#endif
-
-#define TIMELIB_ENABLE_MILLIS
-#define usePPS
-
-#include <MicroTime.h>
-
-// Convert days since epoch to week day. Sunday is day 1.
-#define DAYS_TO_WDAY(x) (((x) + 4) % 7) + 1
-
-static struct tm cacheElements;		 // a cache of time elements
-static time_t cacheTime;			 // the time the cache was updated
-static uint32_t syncInterval = 300;	 // time sync will be attempted after this many seconds
-
-void refreshCache(time_t t) {
-	if (t != cacheTime) {
-		breakTime(t, &cacheElements);
-		cacheTime = t;
-	}
-}
-
-int hour() {  // the hour now
-	return hour(now());
-}
-
-int hour(time_t t) {  // the hour for the given time
-	refreshCache(t);
-	return cacheElements.tm_hour;
-}
-
-int hourFormat12() {  // the hour now in 12 hour format
-	return hourFormat12(now());
-}
-
-int hourFormat12(time_t t) {  // the hour for the given time in 12 hour format
-	refreshCache(t);
-	if (cacheElements.tm_hour == 0)
-		return 12;	// 12 midnight
-	else if (cacheElements.tm_hour > 12)
-		return cacheElements.tm_hour - 12;
-	else
-		return cacheElements.tm_hour;
-}
-
-uint8_t isAM() {  // returns true if time now is AM
-	return !isPM(now());
-}
-
-uint8_t isAM(time_t t) {  // returns true if given time is AM
-	return !isPM(t);
-}
-
-uint8_t isPM() {  // returns true if PM
-	return isPM(now());
-}
-
-uint8_t isPM(time_t t) {  // returns true if PM
-	return (hour(t) >= 12);
-}
-
-int minute() {
-	return minute(now());
-}
-
-int minute(time_t t) {	// the minute for the given time
-	refreshCache(t);
-	return cacheElements.tm_min;
-}
-
-int second() {
-	return second(now());
-}
-
-int second(time_t t) {	// the second for the given time
-	refreshCache(t);
-	return cacheElements.tm_sec;
-}
-
-int millisecond() {
-	uint32_t ms;
-	now(ms);
-	ms = ms / 1000;
-	return (int)ms;
-}
-
-int microsecond() {
-	uint32_t us;
-	now(us);
-	return (int)us;
-}
-
-int day() {
-	return (day(now()));
-}
-
-int day(time_t t) {	 // the day for the given time (0-6)
-	refreshCache(t);
-	return cacheElements.tm_mday;
-}
-
-int weekday() {	 // Sunday is day 1
-	return weekday(now());
-}
-
-int weekday(time_t t) {
-	refreshCache(t);
-	return cacheElements.tm_wday;
-}
-
-int month() {
-	return month(now());
-}
-
-int month(time_t t) {  // the month for the given time
-	refreshCache(t);
-	return cacheElements.tm_mon;
-}
-
-int year() {  // as in Processing, the full four digit year: (2009, 2010 etc)
-	return year(now());
-}
-
-int year(time_t t) {  // the year for the given time
-	refreshCache(t);
-	return tmYearToCalendar(cacheElements.tm_year);
-}
-
-/*============================================================================*/
-/* functions to convert to and from system time */
-/* These are for interfacing with time serivces and are not normally needed in a sketch */
-
-// leap year calulator expects year argument as years offset from 1970
-#define LEAP_YEAR(Y) (((1970 + (Y)) > 0) && !((1970 + (Y)) % 4) && (((1970 + (Y)) % 100) || !((1970 + (Y)) % 400)))
-
-static const uint8_t monthDays[] = {31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};  // API starts months from 1, this array starts from 0
-
-void breakTime(time_t timeInput, struct tm *tm) {
-	// break the given time_t into time components
-	// this is a more compact version of the C library localtime function
-	// note that year is offset from 1970 !!!
-
-	uint8_t year;
-	uint8_t month, monthLength;
-	uint32_t time;
-	unsigned long days;
-
-	time = (uint32_t)timeInput;
-	tm->tm_sec = time % 60;
-	time /= 60;	 // now it is minutes
-	tm->tm_min = time % 60;
-	time /= 60;	 // now it is hours
-	tm->tm_hour = time % 24;
-	time /= 24;	 // now it is days
-
-	// if the number of days since epoch matches cacheTime, then can take date
-	// elements from cacheElements and avoid expensive calculation.
-	if (time == (cacheTime / SECS_PER_DAY)) {
-		if (tm != &cacheElements) {	 // check whether tm is actually cacheElements
-			tm->tm_wday = cacheElements.tm_wday;
-			tm->tm_mday = cacheElements.tm_mday;
-			tm->tm_mon = cacheElements.tm_mon;
-			tm->tm_year = cacheElements.tm_year;
-		}
-		return;
-	}
-
-	tm->tm_wday = DAYS_TO_WDAY(time);
-
-	year = 0;
-	days = 0;
-	while ((unsigned)(days += (LEAP_YEAR(year) ? 366 : 365)) <= time) {
-		year++;
-	}
-	tm->tm_year = year;	 // year is offset from 1970
-
-	days -= LEAP_YEAR(year) ? 366 : 365;
-	time -= days;  // now it is days in this year, starting at 0
-	tm->tm_yday = days;
-
-	days = 0;
-	month = 0;
-	monthLength = 0;
-	for (month = 0; month < 12; month++) {
-		if (month == 1) {  // february
-			if (LEAP_YEAR(year)) {
-				monthLength = 29;
-			} else {
-				monthLength = 28;
-			}
-		} else {
-			monthLength = monthDays[month];
-		}
-
-		if (time >= monthLength) {
-			time -= monthLength;
-		} else {
-			break;
-		}
-	}
-	tm->tm_mon = month + 1;	 // jan is month 1
-	tm->tm_mday = time + 1;	 // day of month
-}
-
-time_t makeTime(const struct tm *tm) {
-	// assemble time elements into time_t
-	// note year argument is offset from 1970 (see macros in time.h to convert to other formats)
-	// previous version used full four digit year (or digits since 2000),i.e. 2009 was 2009 or 9
-
-	int i;
-	uint32_t seconds;
-
-	// seconds from 1970 till 1 jan 00:00:00 of the given year
-	seconds = tm->tm_year * (SECS_PER_DAY * 365);
-	for (i = 0; i < tm->tm_year; i++) {
-		if (LEAP_YEAR(i)) {
-			seconds += SECS_PER_DAY;  // add extra days for leap years
-		}
-	}
-
-	// add days for this year, months start from 1
-	for (i = 1; i < tm->tm_mon; i++) {
-		if ((i == 2) && LEAP_YEAR(tm->tm_year)) {
-			seconds += SECS_PER_DAY * 29;
-		} else {
-			seconds += SECS_PER_DAY * monthDays[i - 1];	 //monthDay array starts from 0
-		}
-	}
-	seconds += (tm->tm_mday - 1) * SECS_PER_DAY;
-	seconds += tm->tm_hour * SECS_PER_HOUR;
-	seconds += tm->tm_min * SECS_PER_MIN;
-	seconds += tm->tm_sec;
-	return (time_t)seconds;
-}
-/*=====================================================*/
-/* Low level system time functions  */
-
-static uint64_t sysTime = 0;
-static uint64_t prevMicros = 0;
-#ifdef usePPS
-static uint64_t ppsMicros = 0;
-#endif
-static uint64_t nextSyncTime = 0;
-static timeStatus_t Status = timeNotSet;
-
-getExternalTime getTimePtr;	 // pointer to external sync function
-//setExternalTime setTimePtr; // not used in this version
-
-#ifdef TIME_DRIFT_INFO		 // define this to get drift data
-time_t sysUnsyncedTime = 0;	 // the time sysTime unadjusted by sync
-#endif
-
-#ifdef usePPS
-void IRAM_ATTR syncToPPS() {
-	ppsMicros = micros64();
-}
-#endif
-
-time_t now() {
-	uint32_t sysTimeMicros;
-	return now(sysTimeMicros);
-}
-
-time_t now(uint32_t& sysTimeMicros) {
-#ifdef usePPS
-	uint32_t microsCall = micros64() - (ppsMicros % 1000000); // align 1000000 micros with real life seconds
-#else
-	uint32_t microsCall = micros64();
-#endif
-	// calculate number of microseconds passed since last call to now()
-	uint32_t microsDiff = microsCall - prevMicros;
-	uint32_t n_secs = ((prevMicros % 1000000) + microsDiff) / 1000000U; // calculate times micros rolled past 1 second
-	sysTimeMicros = microsCall;
-	sysTime += n_secs;
-	prevMicros = microsCall;
-#ifdef TIME_DRIFT_INFO
-	sysUnsyncedTime += n_secs;	// this can be compared to the synced time to measure long term drift
-#endif
-	if (nextSyncTime <= sysTime) {
-		if (getTimePtr != 0) {
-			time_t t = getTimePtr();
-
-			if (t != 0) {
-				setTime(t);
-			} else {
-				nextSyncTime = sysTime + syncInterval;
-				Status = (Status == timeNotSet) ? timeNotSet : timeNeedsSync;
-			}
-		}
-	}
-	return (time_t)sysTime;
-}
-
-void setTime(time_t t) {
-#ifdef TIME_DRIFT_INFO
-	if (sysUnsyncedTime == 0)
-		sysUnsyncedTime = t;  // store the time of the first call to set a valid Time
-#endif
-
-	sysTime = (uint32_t)t;
-	nextSyncTime = (uint32_t)t + syncInterval;
-	Status = timeSet;
-#ifdef usePPS	// restart counting from now (thanks to Korman for this fix)
-	prevMicros = micros64() - (ppsMicros % 1000000);
-#else
-	prevMicros = micros64();
-#endif
-}
-
-void setTime(int hr, int min, int sec, int dy, int mnth, int yr) {
-	// year can be given as full four digit year or two digts (2010 or 10 for 2010);
-	// it is converted to years since 1970
-	if (yr > 99)
-		yr = CalendarYrToTm(yr);
-	else
-		yr = tmYearToY2k(yr);
-	cacheElements.tm_year = yr;
-	cacheElements.tm_mon = mnth;
-	cacheElements.tm_mday = dy;
-	cacheElements.tm_hour = hr;
-	cacheElements.tm_min = min;
-	cacheElements.tm_sec = sec;
-	unsigned long days = 0;
-	uint8_t month = 0, monthLength = 0;
-	for (month = 0; month < mnth; month++) {
-		if (month == 1) {  // february
-			if (LEAP_YEAR(yr)) {
-				monthLength = 29;
-			} else {
-				monthLength = 28;
-			}
-		} else {
-			monthLength = monthDays[month];
-		}
-		days += monthLength;
-	}
-	days += dy;
-	cacheElements.tm_yday = days;
-	cacheTime = makeTime(&cacheElements);
-	cacheElements.tm_wday = DAYS_TO_WDAY(cacheTime / SECS_PER_DAY);
-	setTime(cacheTime);
-}
-
-void adjustTime(long adjustment) {
-	sysTime += adjustment;
-}
-
-// indicates if time has been set and recently synchronized
-timeStatus_t timeStatus() {
-	now();	// required to actually update the status
-	return Status;
-}
-
-void setSyncProvider(getExternalTime getTimeFunction) {
-	getTimePtr = getTimeFunction;
-	nextSyncTime = sysTime;
-	now();	// this will sync the clock
-}
-
-void setSyncInterval(time_t interval) {	 // set the number of seconds between re-sync
-	syncInterval = (uint32_t)interval;
-	nextSyncTime = sysTime + syncInterval;
-}
+/*
+  time.c - low level time and date functions
+  Copyright (c) Michael Margolis 2009-2014
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+  
+  1.0  6  Jan 2010 - initial release
+  1.1  12 Feb 2010 - fixed leap year calculation error
+  1.2  1  Nov 2010 - fixed setTime bug (thanks to Korman for this)
+  1.3  24 Mar 2012 - many edits by Paul Stoffregen: fixed timeStatus() to update
+                     status, updated examples for Arduino 1.0, fixed ARM
+                     compatibility issues, added TimeArduinoDue and TimeTeensy3
+                     examples, add error checking and messages to RTC examples,
+                     add examples to DS1307RTC library.
+  1.4  5  Sep 2014 - compatibility with Arduino 1.5.7
+*/
+
+#include <Arduino.h>
+#if defined(ESP32) || defined(NATIVE)
+uint64_t ICACHE_RAM_ATTR micros64() { return esp_timer_get_time(); }
+#endif
+
+#define TIMELIB_ENABLE_MILLIS
+#define usePPS
+
+#include <MicroTime.h>
+
+// Convert days since epoch to week day. Sunday is day 1.
+#define DAYS_TO_WDAY(x) (((x) + 4) % 7) + 1
+
+static struct tm cacheElements;		 // a cache of time elements
+static time_t cacheTime;			 // the time the cache was updated
+static uint32_t syncInterval = 300;	 // time sync will be attempted after this many seconds
+
+void refreshCache(time_t t) {
+	if (t != cacheTime) {
+		breakTime(t, &cacheElements);
+		cacheTime = t;
+	}
+}
+
+int hour() {  // the hour now
+	return hour(now());
+}
+
+int hour(time_t t) {  // the hour for the given time
+	refreshCache(t);
+	return cacheElements.tm_hour;
+}
+
+int hourFormat12() {  // the hour now in 12 hour format
+	return hourFormat12(now());
+}
+
+int hourFormat12(time_t t) {  // the hour for the given time in 12 hour format
+	refreshCache(t);
+	if (cacheElements.tm_hour == 0)
+		return 12;	// 12 midnight
+	else if (cacheElements.tm_hour > 12)
+		return cacheElements.tm_hour - 12;
+	else
+		return cacheElements.tm_hour;
+}
+
+uint8_t isAM() {  // returns true if time now is AM
+	return !isPM(now());
+}
+
+uint8_t isAM(time_t t) {  // returns true if given time is AM
+	return !isPM(t);
+}
+
+uint8_t isPM() {  // returns true if PM
+	return isPM(now());
+}
+
+uint8_t isPM(time_t t) {  // returns true if PM
+	return (hour(t) >= 12);
+}
+
+int minute() {
+	return minute(now());
+}
+
+int minute(time_t t) {	// the minute for the given time
+	refreshCache(t);
+	return cacheElements.tm_min;
+}
+
+int second() {
+	return second(now());
+}
+
+int second(time_t t) {	// the second for the given time
+	refreshCache(t);
+	return cacheElements.tm_sec;
+}
+
+int millisecond() {
+	uint32_t ms;
+	now(ms);
+	ms = ms / 1000;
+	return (int)ms;
+}
+
+int microsecond() {
+	uint32_t us;
+	now(us);
+	return (int)us;
+}
+
+int day() {
+	return (day(now()));
+}
+
+int day(time_t t) {	 // the day for the given time (0-6)
+	refreshCache(t);
+	return cacheElements.tm_mday;
+}
+
+int weekday() {	 // Sunday is day 1
+	return weekday(now());
+}
+
+int weekday(time_t t) {
+	refreshCache(t);
+	return cacheElements.tm_wday;
+}
+
+int month() {
+	return month(now());
+}
+
+int month(time_t t) {  // the month for the given time
+	refreshCache(t);
+	return cacheElements.tm_mon;
+}
+
+int year() {  // as in Processing, the full four digit year: (2009, 2010 etc)
+	return year(now());
+}
+
+int year(time_t t) {  // the year for the given time
+	refreshCache(t);
+	return tmYearToCalendar(cacheElements.tm_year);
+}
+
+/*============================================================================*/
+/* functions to convert to and from system time */
+/* These are for interfacing with time serivces and are not normally needed in a sketch */
+
+// leap year calulator expects year argument as years offset from 1970
+#define LEAP_YEAR(Y) (((1970 + (Y)) > 0) && !((1970 + (Y)) % 4) && (((1970 + (Y)) % 100) || !((1970 + (Y)) % 400)))
+
+static const uint8_t monthDays[] = {31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};  // API starts months from 1, this array starts from 0
+
+void breakTime(time_t timeInput, struct tm *tm) {
+	// break the given time_t into time components
+	// this is a more compact version of the C library localtime function
+	// note that year is offset from 1970 !!!
+
+	uint8_t year;
+	uint8_t month, monthLength;
+	uint32_t time;
+	unsigned long days;
+
+	time = (uint32_t)timeInput;
+	tm->tm_sec = time % 60;
+	time /= 60;	 // now it is minutes
+	tm->tm_min = time % 60;
+	time /= 60;	 // now it is hours
+	tm->tm_hour = time % 24;
+	time /= 24;	 // now it is days
+
+	// if the number of days since epoch matches cacheTime, then can take date
+	// elements from cacheElements and avoid expensive calculation.
+	if (time == (cacheTime / SECS_PER_DAY)) {
+		if (tm != &cacheElements) {	 // check whether tm is actually cacheElements
+			tm->tm_wday = cacheElements.tm_wday;
+			tm->tm_mday = cacheElements.tm_mday;
+			tm->tm_mon = cacheElements.tm_mon;
+			tm->tm_year = cacheElements.tm_year;
+		}
+		return;
+	}
+
+	tm->tm_wday = DAYS_TO_WDAY(time);
+
+	year = 0;
+	days = 0;
+	while ((unsigned)(days += (LEAP_YEAR(year) ? 366 : 365)) <= time) {
+		year++;
+	}
+	tm->tm_year = year;	 // year is offset from 1970
+
+	days -= LEAP_YEAR(year) ? 366 : 365;
+	time -= days;  // now it is days in this year, starting at 0
+	tm->tm_yday = days;
+
+	days = 0;
+	month = 0;
+	monthLength = 0;
+	for (month = 0; month < 12; month++) {
+		if (month == 1) {  // february
+			if (LEAP_YEAR(year)) {
+				monthLength = 29;
+			} else {
+				monthLength = 28;
+			}
+		} else {
+			monthLength = monthDays[month];
+		}
+
+		if (time >= monthLength) {
+			time -= monthLength;
+		} else {
+			break;
+		}
+	}
+	tm->tm_mon = month + 1;	 // jan is month 1
+	tm->tm_mday = time + 1;	 // day of month
+}
+
+time_t makeTime(const struct tm *tm) {
+	// assemble time elements into time_t
+	// note year argument is offset from 1970 (see macros in time.h to convert to other formats)
+	// previous version used full four digit year (or digits since 2000),i.e. 2009 was 2009 or 9
+
+	int i;
+	uint32_t seconds;
+
+	// seconds from 1970 till 1 jan 00:00:00 of the given year
+	seconds = tm->tm_year * (SECS_PER_DAY * 365);
+	for (i = 0; i < tm->tm_year; i++) {
+		if (LEAP_YEAR(i)) {
+			seconds += SECS_PER_DAY;  // add extra days for leap years
+		}
+	}
+
+	// add days for this year, months start from 1
+	for (i = 1; i < tm->tm_mon; i++) {
+		if ((i == 2) && LEAP_YEAR(tm->tm_year)) {
+			seconds += SECS_PER_DAY * 29;
+		} else {
+			seconds += SECS_PER_DAY * monthDays[i - 1];	 //monthDay array starts from 0
+		}
+	}
+	seconds += (tm->tm_mday - 1) * SECS_PER_DAY;
+	seconds += tm->tm_hour * SECS_PER_HOUR;
+	seconds += tm->tm_min * SECS_PER_MIN;
+	seconds += tm->tm_sec;
+	return (time_t)seconds;
+}
+/*=====================================================*/
+/* Low level system time functions  */
+
+// The timebase maps the local micros64() clock to Unix time. It is published with a
+// seqlock: writers (processPPS and setTime) serialize on timebaseMux and bump
+// timebaseSeq to odd while updating, readers copy it lock free and retry if the
+// sequence changed underneath them. Readers never write shared state.
+typedef struct {
+	uint64_t localMicros;  // micros64() at the anchor
+	uint32_t seconds;	   // Unix time at the anchor
+	uint32_t nanos;		   // always less than 1000000000
+	int32_t rate;		   // correction applied to elapsed local time, in units of 2^-32
+} timebase_t;
+
+static timebase_t timebase = {0, 0, 0, 0};
+static volatile uint32_t timebaseSeq = 0;
+static portMUX_TYPE timebaseMux = portMUX_INITIALIZER_UNLOCKED;
+static uint32_t nextSyncTime = 0;
+static timeStatus_t Status = timeNotSet;
+
+#ifdef usePPS
+// PPS discipline, a frequency locked loop estimates the oscillator error from the
+// interval between edges and the phase offset measured at each edge is slewed out
+// over the following second, so the served time never steps once locked.
+#define PPS_MAX_DEVIATION 1000000	  // nanos, intervals further than this from 1 s are not used for frequency
+#define PPS_STEP_THRESHOLD 1000000	  // nanos, larger offsets are stepped instead of slewed
+#define PPS_MAX_RATE 2147484		  // 500 ppm in units of 2^-32
+#define PPS_FLL_SHIFT 4				  // frequency estimate time constant, 2^4 edges
+#define PPS_PLL_SHIFT 1				  // fraction of the phase offset removed per second, 1/2^1
+#define PPS_JITTER_SHIFT 4			  // jitter average time constant, 2^4 edges
+#define PPS_RING_SIZE 8				  // edges queued between the interrupt and processPPS(), power of two
+#define PPS_FILTER_SIZE 5			  // recent intervals the median filter is taken over
+#define PPS_OUTLIER_MIN 2000		  // nanos, intervals this close to the median are never outliers
+#define PPS_OUTLIER_MADS 5			  // intervals more median absolute deviations than this from the median are outliers
+#define PPS_OUTLIER_LIMIT 3			  // consecutive outliers after which the edge is taken to have really moved
+#define PPS_MAX_GAP 16				  // seconds without an accepted edge after which the filter restarts
+
+typedef struct {
+	uint64_t lastEdge;	  // local nanos (micros64() * 1000) of the last PPS edge
+	int32_t frequency;	  // local oscillator error in units of 2^-32, positive when fast
+	int32_t offset;		  // nanos the clock was ahead of the last edge
+	int64_t jitter;		  // exponential average of offset^2 in nanos^2
+	uint32_t intervals;	  // intervals used for the frequency estimate
+} servo_t;
+
+static servo_t servo = {0, 0, 0, 0, 0};
+
+// Edges are queued by the interrupt in a single producer, single consumer ring and
+// filtered by processPPS() in task context, so a glitch or a missed pulse is
+// rejected before it reaches the servo instead of shifting the phase.
+typedef struct {
+	int32_t window[PPS_FILTER_SIZE];  // recent accepted intervals minus one second, per second
+	uint32_t count;
+	uint32_t next;
+	uint32_t rejected;	   // consecutive outliers
+	int64_t variance;	   // exponential average of the squared deviation from the median
+} pps_filter_t;
+
+static uint64_t ppsRing[PPS_RING_SIZE];
+static uint32_t ppsHead = 0;		// written by the interrupt only
+static uint32_t ppsTail = 0;		// written by processPPS() only
+static uint32_t ppsOverflows = 0;	// written by the interrupt only
+static pps_filter_t filter = {};
+static pps_stats_t ppsStatistics = {};
+// The receiver reports the quantization error of each pulse after the one before, naming the
+// second the pulse starts. It is only taken off the edge the clock puts at that second, so
+// one left over after a missing pulse, or one that arrives after its edge was processed,
+// is never applied to another edge.
+static int32_t ppsCorrection = 0;		   // nanos the pulse will be late
+static uint32_t ppsCorrectionSecond = 0;   // Unix second the pulse starts, 0 once used
+#endif
+
+getExternalTime getTimePtr;	 // pointer to external sync function
+//setExternalTime setTimePtr; // not used in this version
+
+static inline void IRAM_ATTR writeTimebase(const timebase_t& tb) {  // caller holds timebaseMux
+	uint32_t seq = timebaseSeq;
+	__atomic_store_n(&timebaseSeq, seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	timebase = tb;
+	__atomic_store_n(&timebaseSeq, seq + 2, __ATOMIC_RELEASE);
+}
+
+static inline timebase_t readTimebase() {
+	timebase_t tb;
+	uint32_t seq;
+	do {
+		seq = __atomic_load_n(&timebaseSeq, __ATOMIC_ACQUIRE);
+		tb = timebase;
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	} while ((seq & 1) || seq != __atomic_load_n(&timebaseSeq, __ATOMIC_RELAXED));
+	return tb;
+}
+
+// The timebase and a local clock sample taken while it was current. A reader preempted
+// between the two could otherwise apply a timebase to a sample taken after its successor
+// was published, and give a later time than the successor then does.
+static inline timebase_t readTimebase(uint64_t& localMicros) {
+	timebase_t tb;
+	uint32_t seq;
+	do {
+		seq = __atomic_load_n(&timebaseSeq, __ATOMIC_ACQUIRE);
+		tb = timebase;
+		localMicros = micros64();
+		__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	} while ((seq & 1) || seq != __atomic_load_n(&timebaseSeq, __ATOMIC_RELAXED));
+	return tb;
+}
+
+// Unix time of local clock value localMicros according to tb
+static inline uint32_t IRAM_ATTR timebaseToUnix(const timebase_t& tb, uint64_t localMicros, uint32_t& nanos) {
+	if (localMicros < tb.localMicros) {
+		// before the anchor, which a rate change moves to when it is published, so edges,
+		// receive times and second boundaries can be older than it. Count back from it.
+		int64_t before = tb.localMicros - localMicros;
+		int64_t total = (int64_t)tb.nanos - before * 1000 - ((((before * tb.rate) >> 12) * 1000) >> 20);
+		uint32_t seconds = tb.seconds;
+		if (total < 0) {
+			uint32_t back = (uint32_t)((-total + 999999999) / 1000000000);
+			total += (int64_t)back * 1000000000;
+			seconds -= back;
+		}
+		nanos = (uint32_t)total;
+		return seconds;
+	}
+	uint64_t elapsed = localMicros - tb.localMicros;
+	if (elapsed < 3000000) {  // 32 bit division while the anchor is less than 3 seconds old
+		// rate correction in nanos, scaled in two steps to keep the product within 64 bits
+		int32_t correction = (((((int64_t)elapsed * tb.rate) >> 12) * 1000) >> 20);
+		uint32_t total = tb.nanos + (uint32_t)elapsed * 1000 + correction;
+		nanos = total % 1000000000UL;
+		return tb.seconds + total / 1000000000UL;
+	}
+	int64_t correction = ((((int64_t)(elapsed >> 10) * tb.rate) >> 12) * 1000) >> 10;
+	uint64_t total = tb.nanos + elapsed * 1000 + correction;
+	nanos = total % 1000000000ULL;
+	return tb.seconds + (uint32_t)(total / 1000000000ULL);
+}
+
+// Changes the rate from the moment the new timebase is published. It is anchored at that
+// moment, not at the PPS edge that measured it, so time does not move under readers that
+// have already been given it. Edges are processed a while after they happen, and a new
+// rate applied from the edge would step the time by the rate change times the delay.
+static inline void writeRate(int32_t rate) {	// caller holds timebaseMux
+	uint32_t seq = timebaseSeq;
+	__atomic_store_n(&timebaseSeq, seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	// after the update is marked, so a reader with a later local clock sample retries
+	timebase_t tb;
+	tb.localMicros = micros64();
+	tb.seconds = timebaseToUnix(timebase, tb.localMicros, tb.nanos);
+	tb.rate = rate;
+	timebase = tb;
+	__atomic_store_n(&timebaseSeq, seq + 2, __ATOMIC_RELEASE);
+}
+
+// Anchor tb so that local time edgeNanos reads exactly seconds
+static inline void IRAM_ATTR anchorAt(timebase_t& tb, uint64_t edgeNanos, uint32_t seconds) {
+	tb.localMicros = edgeNanos / 1000;
+	uint32_t sub = (uint32_t)(edgeNanos - tb.localMicros * 1000);
+	tb.seconds = sub ? seconds - 1 : seconds;
+	tb.nanos = sub ? 1000000000 - sub : 0;
+}
+
+#ifdef usePPS
+// residual is the interval since the last accepted edge minus whole seconds, per second
+static void disciplineToEdge(uint64_t edge, int32_t residual, bool frequencyValid) {	// caller holds timebaseMux
+	if (frequencyValid && residual > -PPS_MAX_DEVIATION && residual < PPS_MAX_DEVIATION) {
+		int32_t measured = ((int64_t)residual * 17592) >> 12;	// 2^32 / 10^9 per nano is 17592 / 2^12
+		if (servo.intervals < (1 << PPS_FLL_SHIFT)) {  // plain mean until the average has filled
+			servo.intervals++;
+			servo.frequency += (measured - servo.frequency) / (int32_t)servo.intervals;
+		} else {
+			servo.frequency += (measured - servo.frequency) >> PPS_FLL_SHIFT;
+		}
+	}
+
+	// time at the microsecond containing the edge, plus the sub microsecond part of the edge
+	timebase_t tb;
+	tb.localMicros = edge / 1000;
+	tb.seconds = timebaseToUnix(timebase, tb.localMicros, tb.nanos);
+	uint32_t nanos = tb.nanos + (uint32_t)(edge - tb.localMicros * 1000);
+	uint32_t seconds = tb.seconds;
+	if (nanos >= 1000000000) {
+		nanos -= 1000000000;
+		seconds++;
+	}
+	int32_t offset = nanos < 500000000 ? (int32_t)nanos : (int32_t)nanos - 1000000000;
+	servo.offset = offset;
+	servo.jitter += ((int64_t)offset * offset - servo.jitter) >> PPS_JITTER_SHIFT;
+
+	int64_t rate = -(int64_t)servo.frequency - (((int64_t)offset * 17592) >> (12 + PPS_PLL_SHIFT));
+	if (rate > PPS_MAX_RATE) {
+		rate = PPS_MAX_RATE;
+	} else if (rate < -PPS_MAX_RATE) {
+		rate = -PPS_MAX_RATE;
+	}
+	if (offset > PPS_STEP_THRESHOLD || offset < -PPS_STEP_THRESHOLD) {
+		anchorAt(tb, edge, nanos < 500000000 ? seconds : seconds + 1);
+		tb.rate = (int32_t)rate;
+		writeTimebase(tb);
+	} else {
+		// small offsets keep the clock continuous and are slewed out
+		writeRate((int32_t)rate);
+	}
+}
+
+static void acceptEdge(uint64_t edge, int32_t residual, bool frequencyValid) {  // caller holds timebaseMux
+	ppsStatistics.accepted++;
+	if (Status != timeNotSet) {
+		disciplineToEdge(edge, residual, frequencyValid);
+	}
+	servo.lastEdge = edge;
+}
+
+// Median of the first count values, sorts them in place
+static int32_t median(int32_t* values, uint32_t count) {
+	for (uint32_t i = 1; i < count; i++) {
+		int32_t value = values[i];
+		uint32_t j = i;
+		for (; j > 0 && values[j - 1] > value; j--) {
+			values[j] = values[j - 1];
+		}
+		values[j] = value;
+	}
+	return values[count / 2];
+}
+
+static void filterEdge(uint64_t edge) {	// caller holds timebaseMux
+	ppsStatistics.edges++;
+	// Spacing is from the last accepted edge, so a glitch that was rejected as an outlier
+	// cannot make the real edge after it look extra
+	uint64_t interval = edge - servo.lastEdge;
+	if (servo.lastEdge != 0 && interval < 500000000) {
+		ppsStatistics.extra++;
+		return;
+	}
+	uint32_t seconds = (uint32_t)((interval + 500000000) / 1000000000);
+	// pulses since the last accepted edge that never arrived, outliers did
+	uint32_t missed = servo.lastEdge != 0 && seconds > filter.rejected + 1 ? seconds - filter.rejected - 1 : 0;
+	if (servo.lastEdge == 0 || seconds > PPS_MAX_GAP) {
+		ppsStatistics.missed += missed;
+		filter.count = 0;
+		filter.rejected = 0;
+		acceptEdge(edge, 0, false);
+		return;
+	}
+	int32_t residual = (int32_t)(((int64_t)interval - (int64_t)seconds * 1000000000) / (int32_t)seconds);
+	ppsStatistics.interval = residual;
+
+	if (filter.count >= PPS_FILTER_SIZE / 2 + 1) {
+		int32_t sorted[PPS_FILTER_SIZE];
+		memcpy(sorted, filter.window, filter.count * sizeof(int32_t));
+		int32_t center = median(sorted, filter.count);
+		for (uint32_t i = 0; i < filter.count; i++) {
+			sorted[i] = abs(sorted[i] - center);
+		}
+		int64_t limit = max((int64_t)PPS_OUTLIER_MIN, (int64_t)median(sorted, filter.count) * PPS_OUTLIER_MADS);
+		int32_t deviation = residual - center;
+		ppsStatistics.intervalMedian = center;
+		if (deviation > limit || deviation < -limit) {
+			if (++filter.rejected < PPS_OUTLIER_LIMIT) {
+				ppsStatistics.outliers++;
+				return;
+			}
+			// the edge has moved for good, follow it without trusting this interval
+			ppsStatistics.missed += missed;
+			filter.count = 0;
+			filter.rejected = 0;
+			acceptEdge(edge, 0, false);
+			return;
+		}
+		filter.variance += ((int64_t)deviation * deviation - filter.variance) >> PPS_JITTER_SHIFT;
+	}
+	ppsStatistics.missed += missed;
+	filter.rejected = 0;
+	filter.window[filter.next] = residual;
+	filter.next = (filter.next + 1) % PPS_FILTER_SIZE;
+	filter.count = min(filter.count + 1, (uint32_t)PPS_FILTER_SIZE);
+	acceptEdge(edge, residual, true);
+}
+
+void IRAM_ATTR syncToPPS() {
+	syncToPPS(micros64() * 1000);
+}
+
+void IRAM_ATTR syncToPPS(uint64_t edgeNanos) {
+	uint32_t head = __atomic_load_n(&ppsHead, __ATOMIC_RELAXED);
+	if (head - __atomic_load_n(&ppsTail, __ATOMIC_ACQUIRE) >= PPS_RING_SIZE) {
+		__atomic_fetch_add(&ppsOverflows, 1, __ATOMIC_RELAXED);
+		return;
+	}
+	ppsRing[head & (PPS_RING_SIZE - 1)] = edgeNanos;
+	__atomic_store_n(&ppsHead, head + 1, __ATOMIC_RELEASE);
+}
+
+void correctPPS(int32_t picos, time_t second) {
+	portENTER_CRITICAL(&timebaseMux);
+	ppsCorrection = (picos + (picos < 0 ? -500 : 500)) / 1000;
+	ppsCorrectionSecond = (uint32_t)second;
+	portEXIT_CRITICAL(&timebaseMux);
+}
+
+// Second the clock puts an edge at, the nearest one as the clock may be a little ahead or behind
+static uint32_t edgeSecond(uint64_t edge) {	 // caller holds timebaseMux
+	uint32_t nanos;
+	uint32_t seconds = timebaseToUnix(timebase, edge / 1000, nanos);
+	return nanos + (uint32_t)(edge % 1000) < 500000000 ? seconds : seconds + 1;
+}
+
+void processPPS() {
+	uint32_t tail = __atomic_load_n(&ppsTail, __ATOMIC_RELAXED);
+	while (tail != __atomic_load_n(&ppsHead, __ATOMIC_ACQUIRE)) {
+		uint64_t edge = ppsRing[tail & (PPS_RING_SIZE - 1)];
+		__atomic_store_n(&ppsTail, ++tail, __ATOMIC_RELEASE);
+		portENTER_CRITICAL(&timebaseMux);
+		if (ppsCorrectionSecond != 0 && Status != timeNotSet && edgeSecond(edge) == ppsCorrectionSecond) {
+			edge -= ppsCorrection;
+			ppsCorrectionSecond = 0;
+			ppsStatistics.corrected++;
+			ppsStatistics.correction = ppsCorrection;
+		}
+		filterEdge(edge);
+		portEXIT_CRITICAL(&timebaseMux);
+	}
+}
+
+pps_stats_t ppsStats() {
+	portENTER_CRITICAL(&timebaseMux);
+	pps_stats_t stats = ppsStatistics;
+	int64_t variance = filter.variance;
+	portEXIT_CRITICAL(&timebaseMux);
+	stats.overflows = __atomic_load_n(&ppsOverflows, __ATOMIC_RELAXED);
+	stats.intervalJitter = (uint32_t)sqrtf((float)variance);
+	return stats;
+}
+
+int32_t clockOffset() {
+	return __atomic_load_n(&servo.offset, __ATOMIC_RELAXED);
+}
+
+float clockFrequency() {
+	return __atomic_load_n(&servo.frequency, __ATOMIC_RELAXED) / 4294.967296f;
+}
+
+uint32_t clockJitter() {
+	portENTER_CRITICAL(&timebaseMux);
+	int64_t jitter = servo.jitter;
+	portEXIT_CRITICAL(&timebaseMux);
+	return (uint32_t)sqrtf((float)jitter);
+}
+#endif
+
+// Current time with nanosecond resolution, polls the sync provider when one is set
+static uint32_t nowNanos(uint32_t& nanos) {
+	uint64_t local;
+	timebase_t tb = readTimebase(local);
+	uint32_t t = timebaseToUnix(tb, local, nanos);
+	if (getTimePtr != 0 && nextSyncTime <= t) {
+		time_t synced = getTimePtr();
+		if (synced != 0) {
+			setTime(synced);
+		} else {
+			portENTER_CRITICAL(&timebaseMux);
+			nextSyncTime = t + syncInterval;
+			Status = (Status == timeNotSet) ? timeNotSet : timeNeedsSync;
+			portEXIT_CRITICAL(&timebaseMux);
+		}
+	}
+	return t;
+}
+
+time_t now() {
+	uint32_t nanos;
+	return nowNanos(nanos);
+}
+
+time_t now(uint32_t& sysTimeMicros) {
+	uint32_t nanos;
+	time_t t = nowNanos(nanos);
+	sysTimeMicros = nanos / 1000;
+	return t;
+}
+
+#ifdef TIMELIB_ENABLE_MILLIS
+NtpTimestamp nowNtp() {
+	uint32_t nanos;
+	uint32_t t = nowNanos(nanos);
+	return NtpTimestamp::fromUnixNanos(t, nanos);
+}
+
+NtpTimestamp localToNtp(uint64_t localMicros) {
+	timebase_t tb = readTimebase();
+	uint32_t nanos;
+	uint32_t t = timebaseToUnix(tb, localMicros, nanos);
+	return NtpTimestamp::fromUnixNanos(t, nanos);
+}
+#endif
+
+void setTime(time_t t) {
+	uint64_t local = micros64() * 1000;
+	portENTER_CRITICAL(&timebaseMux);
+	uint64_t boundary = local;
+	bool step = Status == timeNotSet;
+#ifdef usePPS
+	if (servo.lastEdge != 0 && servo.lastEdge <= local) {
+		// t is the second that began at the latest PPS aligned boundary
+		boundary = local - (local - servo.lastEdge) % 1000000000;
+	} else {
+		step = true;
+	}
+#else
+	step = true;
+#endif
+	uint32_t nanos;
+	uint32_t seconds = timebaseToUnix(timebase, boundary / 1000, nanos);
+	if (nanos >= 500000000) {
+		seconds++;
+	}
+	// only step when the clock disagrees on the second, the PPS discipline owns the phase
+	if (step || seconds != (uint32_t)t) {
+		timebase_t tb;
+		anchorAt(tb, boundary, (uint32_t)t);
+		tb.rate = timebase.rate;
+		writeTimebase(tb);
+	}
+	nextSyncTime = (uint32_t)t + syncInterval;
+	Status = timeSet;
+	portEXIT_CRITICAL(&timebaseMux);
+}
+
+void setTime(int hr, int min, int sec, int dy, int mnth, int yr) {
+	// year can be given as full four digit year or two digts (2010 or 10 for 2010);
+	// it is converted to years since 1970
+	if (yr > 99)
+		yr = CalendarYrToTm(yr);
+	else
+		yr = tmYearToY2k(yr);
+	cacheElements.tm_year = yr;
+	cacheElements.tm_mon = mnth;
+	cacheElements.tm_mday = dy;
+	cacheElements.tm_hour = hr;
+	cacheElements.tm_min = min;
+	cacheElements.tm_sec = sec;
+	unsigned long days = 0;
+	uint8_t month = 0, monthLength = 0;
+	for (month = 0; month < mnth; month++) {
+		if (month == 1) {  // february
+			if (LEAP_YEAR(yr)) {
+				monthLength = 29;
+			} else {
+				monthLength = 28;
+			}
+		} else {
+			monthLength = monthDays[month];
+		}
+		days += monthLength;
+	}
+	days += dy;
+	cacheElements.tm_yday = days;
+	cacheTime = makeTime(&cacheElements);
+	cacheElements.tm_wday = DAYS_TO_WDAY(cacheTime / SECS_PER_DAY);
+	setTime(cacheTime);
+}
+
+void adjustTime(long adjustment) {
+	portENTER_CRITICAL(&timebaseMux);
+	timebase_t tb = timebase;
+	tb.seconds += adjustment;
+	writeTimebase(tb);
+	portEXIT_CRITICAL(&timebaseMux);
+}
+
+// indicates if time has been set and recently synchronized
+timeStatus_t timeStatus() {
+	now();	// required to actually update the status
+	return Status;
+}
+
+void setSyncProvider(getExternalTime getTimeFunction) {
+	getTimePtr = getTimeFunction;
+	nextSyncTime = 0;
+	now();	// this will sync the clock
+}
+
+void setSyncInterval(time_t interval) {	 // set the number of seconds between re-sync
+	syncInterval = (uint32_t)interval;
+	nextSyncTime = (uint32_t)now() + syncInterval;
+}
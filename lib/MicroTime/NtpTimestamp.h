@@ -0,0 +1,91 @@
+#pragma once
+#include <inttypes.h>
+
+#define NTP_UNIX_OFFSET 2208988800UL  // seconds from 1 Jan 1900 to 1 Jan 1970
+
+// 64 bit NTP timestamp, 32 bits of seconds since 1900 and 32 bits of binary fraction.
+// All conversions are integer only, the ESP32 has no double precision FPU.
+struct NtpTimestamp {
+	uint32_t seconds;
+	uint32_t fraction;
+
+	// Exact floor(micros * 2^32 / 10^6) for micros < 10^6, computed as (micros * ceil(2^72 / 10^6)) >> 40
+	// split into two 32x32 bit multiplies so no 64 bit division is needed
+	static inline uint32_t microsToFraction(uint32_t micros) {
+		return (uint32_t)(((uint64_t)micros * 0x0010C6F7UL + (((uint64_t)micros * 0xA0B5ED8EUL) >> 32)) >> 8);
+	}
+
+	// Nearest microsecond to fraction * 10^6 / 2^32, round trips microsToFraction exactly.
+	// May return 1000000 for fractions just below one second, callers carry into the seconds.
+	static inline uint32_t fractionToMicros(uint32_t fraction) {
+		return (uint32_t)(((uint64_t)fraction * 1000000UL + 0x80000000UL) >> 32);
+	}
+
+	// Exact floor(nanos * 2^32 / 10^9) for nanos < 10^9, computed as (nanos * ceil(2^83 / 10^9)) >> 51
+	static inline uint32_t nanosToFraction(uint32_t nanos) {
+		return (uint32_t)(((uint64_t)nanos * 0x00225C17UL + (((uint64_t)nanos * 0xD04DAD2AUL) >> 32)) >> 19);
+	}
+
+	// Nearest nanosecond to fraction * 10^9 / 2^32, may return 1000000000
+	static inline uint32_t fractionToNanos(uint32_t fraction) {
+		return (uint32_t)(((uint64_t)fraction * 1000000000UL + 0x80000000UL) >> 32);
+	}
+
+	static inline NtpTimestamp fromUnix(uint32_t unixSeconds, uint32_t micros) {
+		NtpTimestamp ts;
+		ts.seconds = unixSeconds + NTP_UNIX_OFFSET;
+		ts.fraction = microsToFraction(micros);
+		return ts;
+	}
+
+	static inline NtpTimestamp fromUnixNanos(uint32_t unixSeconds, uint32_t nanos) {
+		NtpTimestamp ts;
+		ts.seconds = unixSeconds + NTP_UNIX_OFFSET;
+		ts.fraction = nanosToFraction(nanos);
+		return ts;
+	}
+
+	// Timestamp as a single 32.32 fixed point value, for arithmetic
+	inline uint64_t toFixed() const {
+		return ((uint64_t)seconds << 32) | fraction;
+	}
+
+	static inline NtpTimestamp fromFixed(uint64_t value) {
+		NtpTimestamp ts;
+		ts.seconds = value >> 32;
+		ts.fraction = (uint32_t)value;
+		return ts;
+	}
+
+	inline uint32_t toUnix(uint32_t& micros) const {
+		micros = fractionToMicros(fraction);
+		if (micros >= 1000000) {
+			micros -= 1000000;
+			return seconds - NTP_UNIX_OFFSET + 1;
+		}
+		return seconds - NTP_UNIX_OFFSET;
+	}
+
+	inline bool isZero() const {
+		return seconds == 0 && fraction == 0;
+	}
+
+	// Network byte order, as found in packets
+	inline void write(uint8_t* buf) const {
+		buf[0] = (seconds >> 24) & 0xFF;
+		buf[1] = (seconds >> 16) & 0xFF;
+		buf[2] = (seconds >> 8) & 0xFF;
+		buf[3] = seconds & 0xFF;
+		buf[4] = (fraction >> 24) & 0xFF;
+		buf[5] = (fraction >> 16) & 0xFF;
+		buf[6] = (fraction >> 8) & 0xFF;
+		buf[7] = fraction & 0xFF;
+	}
+
+	static inline NtpTimestamp read(const uint8_t* buf) {
+		NtpTimestamp ts;
+		ts.seconds = ((uint32_t)buf[0] << 24) | ((uint32_t)buf[1] << 16) | ((uint32_t)buf[2] << 8) | buf[3];
+		ts.fraction = ((uint32_t)buf[4] << 24) | ((uint32_t)buf[5] << 16) | ((uint32_t)buf[6] << 8) | buf[7];
+		return ts;
+	}
+};
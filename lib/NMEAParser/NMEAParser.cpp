@@ -0,0 +1,307 @@
+#include <NMEAParser.h>
+#include <string.h>
+
+typedef struct {
+	const char* start;
+	size_t length;
+} nmea_field_t;
+
+// XOR of length bytes from start, four at a time once aligned, the Xtensa cores cannot load
+// unaligned words
+static uint8_t checksum(const char* start, size_t length) {
+	uint8_t sum = 0;
+	while (length > 0 && ((uintptr_t)start & 3) != 0) {
+		sum ^= *start++;
+		length--;
+	}
+	uint32_t words = 0;
+	for (; length >= 4; start += 4, length -= 4) {
+		uint32_t word;
+		memcpy(&word, __builtin_assume_aligned(start, 4), 4);
+		words ^= word;
+	}
+	words ^= words >> 16;
+	words ^= words >> 8;
+	sum ^= (uint8_t)words;
+	while (length-- > 0) {
+		sum ^= *start++;
+	}
+	return sum;
+}
+
+static int hexDigit(char c) {
+	if (c >= '0' && c <= '9') {
+		return c - '0';
+	}
+	c |= 0x20;	// lower case
+	return c >= 'a' && c <= 'f' ? c - 'a' + 10 : -1;
+}
+
+// Two decimal digits, -1 if they are not
+static int twoDigits(const char* p) {
+	unsigned tens = p[0] - '0';
+	unsigned ones = p[1] - '0';
+	return tens > 9 || ones > 9 ? -1 : tens * 10 + ones;
+}
+
+// A whole field of up to four decimal digits, -1 if it is empty or anything else
+static int number(const nmea_field_t& field) {
+	if (field.length == 0 || field.length > 4) {
+		return -1;
+	}
+	int value = 0;
+	for (size_t i = 0; i < field.length; i++) {
+		unsigned digit = field.start[i] - '0';
+		if (digit > 9) {
+			return -1;
+		}
+		value = value * 10 + digit;
+	}
+	return value;
+}
+
+// Splits up to max comma separated fields between start and end, returns how many there were
+static size_t split(const char* start, const char* end, nmea_field_t* fields, size_t max) {
+	size_t count = 0;
+	while (count < max) {
+		const char* comma = (const char*)memchr(start, ',', end - start);
+		const char* stop = comma ? comma : end;
+		fields[count].start = start;
+		fields[count].length = stop - start;
+		count++;
+		if (!comma) {
+			break;
+		}
+		start = comma + 1;
+	}
+	return count;
+}
+
+NMEAParser::NMEAParser() {
+	_length = 0;
+	_time = {};
+	_date = {};
+	_timeUpdated = false;
+	_dateUpdated = false;
+	_fix = false;
+	_quality = 0;
+	_satellites = 0;
+	_fixType = 0;
+	_stats = {};
+}
+
+nmea_sentence_t NMEAParser::encode(char c) {
+	_stats.chars++;
+	if (c == '$') {
+		if (_length > 0) {
+			_stats.failed++;  // the line before lost its end
+		}
+		_line[0] = c;
+		_length = 1;
+	} else if (_length == 0) {
+		// between lines, or the rest of one that did not fit
+	} else if (c == '\n') {
+		nmea_sentence_t sentence = parseLine(_line, _length);
+		_length = 0;
+		return sentence;
+	} else if (_length < NMEA_LINE_SIZE) {
+		_line[_length++] = c;
+	} else {
+		_length = 0;
+	}
+	return NMEA_NONE;
+}
+
+nmea_sentence_t NMEAParser::parse(const char* line, size_t length) {
+	_stats.chars += length;
+	if (length == 0) {
+		return NMEA_NONE;
+	}
+	const char* start = line + length;
+	while (start > line && *--start != '$') {
+	}
+	if (*start != '$') {
+		return NMEA_NONE;
+	}
+	if (memchr(line, '$', start - line)) {
+		_stats.failed++;  // a line that lost its end ran into this one
+	}
+	return parseLine(start, line + length - start);
+}
+
+// line starts with '$', trailing CR and LF are ignored
+nmea_sentence_t NMEAParser::parseLine(const char* line, size_t length) {
+	while (length > 0 && (line[length - 1] == '\n' || line[length - 1] == '\r')) {
+		length--;
+	}
+	// at least $ and a five character address before *hh
+	if (length < 9 || line[length - 3] != '*') {
+		_stats.failed++;
+		return NMEA_NONE;
+	}
+	int high = hexDigit(line[length - 2]);
+	int low = hexDigit(line[length - 1]);
+	if (high < 0 || low < 0 || checksum(line + 1, length - 4) != (high << 4 | low)) {
+		_stats.failed++;
+		return NMEA_NONE;
+	}
+	_stats.passed++;
+	_timeUpdated = false;
+	_dateUpdated = false;
+	if (line[6] != ',') {
+		return NMEA_OTHER;
+	}
+	const char* fields = line + 7;
+	const char* end = line + length - 3;
+	// the talker ID in line[1..2] is ignored, the formatter is compared in one go
+	uint32_t formatter = (uint8_t)line[3] << 16 | (uint8_t)line[4] << 8 | (uint8_t)line[5];
+	switch (formatter) {
+	case 'R' << 16 | 'M' << 8 | 'C':
+		parseRMC(fields, end);
+		return NMEA_RMC;
+	case 'G' << 16 | 'G' << 8 | 'A':
+		parseGGA(fields, end);
+		return NMEA_GGA;
+	case 'G' << 16 | 'S' << 8 | 'A':
+		parseGSA(fields, end);
+		return NMEA_GSA;
+	case 'Z' << 16 | 'D' << 8 | 'A':
+		parseZDA(fields, end);
+		return NMEA_ZDA;
+	default:
+		return NMEA_OTHER;
+	}
+}
+
+// hhmmss with an optional fraction of up to three digits used
+bool NMEAParser::parseTime(const char* field, size_t length) {
+	if (length < 6 || (length > 6 && field[6] != '.')) {
+		return false;
+	}
+	int hour = twoDigits(field);
+	int minute = twoDigits(field + 2);
+	int second = twoDigits(field + 4);
+	if (hour < 0 || minute < 0 || second < 0 || hour > 23 || minute > 59 || second > 60) {
+		return false;
+	}
+	static const uint16_t scale[] = {100, 10, 1};
+	uint16_t millisecond = 0;
+	for (size_t i = 7; i < length && i < 10; i++) {
+		unsigned digit = field[i] - '0';
+		if (digit > 9) {
+			return false;
+		}
+		millisecond += digit * scale[i - 7];
+	}
+	_time.hour = hour;
+	_time.minute = minute;
+	_time.second = second;
+	_time.millisecond = millisecond;
+	_timeUpdated = true;
+	return true;
+}
+
+// time, status, latitude, N/S, longitude, E/W, speed, course, date, ...
+void NMEAParser::parseRMC(const char* fields, const char* end) {
+	nmea_field_t field[9];
+	size_t count = split(fields, end, field, 9);
+	parseTime(field[0].start, field[0].length);
+	if (count > 1) {
+		_fix = field[1].length == 1 && field[1].start[0] == 'A';
+		if (_fix) {
+			_stats.withFix++;
+		}
+	}
+	if (count > 8 && field[8].length == 6) {
+		int day = twoDigits(field[8].start);
+		int month = twoDigits(field[8].start + 2);
+		int year = twoDigits(field[8].start + 4);
+		if (day >= 1 && day <= 31 && month >= 1 && month <= 12 && year >= 0) {
+			_date.day = day;
+			_date.month = month;
+			_date.year = 2000 + year;
+			_dateUpdated = true;
+		}
+	}
+}
+
+// time, latitude, N/S, longitude, E/W, quality, satellites, ...
+void NMEAParser::parseGGA(const char* fields, const char* end) {
+	nmea_field_t field[7];
+	size_t count = split(fields, end, field, 7);
+	parseTime(field[0].start, field[0].length);
+	if (count > 5) {
+		int quality = number(field[5]);
+		_quality = quality > 0 ? quality : 0;
+		if (_quality > 0) {
+			_stats.withFix++;
+		}
+	}
+	if (count > 6) {
+		int satellites = number(field[6]);
+		_satellites = satellites > 0 ? satellites : 0;
+	}
+}
+
+// mode, fix type, ...
+void NMEAParser::parseGSA(const char* fields, const char* end) {
+	nmea_field_t field[2];
+	if (split(fields, end, field, 2) > 1) {
+		int fixType = number(field[1]);
+		_fixType = fixType > 0 ? fixType : 0;
+	}
+}
+
+// time, day, month, year, zone hours, zone minutes
+void NMEAParser::parseZDA(const char* fields, const char* end) {
+	nmea_field_t field[4];
+	size_t count = split(fields, end, field, 4);
+	parseTime(field[0].start, field[0].length);
+	if (count > 3) {
+		int day = number(field[1]);
+		int month = number(field[2]);
+		int year = number(field[3]);
+		if (day >= 1 && day <= 31 && month >= 1 && month <= 12 && field[3].length == 4) {
+			_date.day = day;
+			_date.month = month;
+			_date.year = year;
+			_dateUpdated = true;
+		}
+	}
+}
+
+bool NMEAParser::timeUpdated() {
+	return _timeUpdated;
+}
+
+bool NMEAParser::dateUpdated() {
+	return _dateUpdated;
+}
+
+nmea_time_t NMEAParser::time() {
+	return _time;
+}
+
+nmea_date_t NMEAParser::date() {
+	return _date;
+}
+
+bool NMEAParser::fix() {
+	return _fix;
+}
+
+uint8_t NMEAParser::quality() {
+	return _quality;
+}
+
+uint8_t NMEAParser::satellites() {
+	return _satellites;
+}
+
+uint8_t NMEAParser::fixType() {
+	return _fixType;
+}
+
+nmea_stats_t NMEAParser::stats() {
+	return _stats;
+}
@@ -0,0 +1,81 @@
+#pragma once
+#include <inttypes.h>
+#include <stddef.h>
+
+#define NMEA_LINE_SIZE 128	// longest line kept, NMEA 0183 allows 82 but some receivers send more
+
+// Decodes only what the clock needs from NMEA 0183: time and date from RMC and ZDA, fix
+// quality from GGA and fix type from GSA. Whole lines are checked and decoded at once,
+// the checksum a word at a time and the numbers with integer arithmetic, and nothing is
+// allocated. Lines come either whole from parse(), or a byte at a time through encode().
+// Any talker ID is accepted, GP, GN, GL and the others. Not thread safe.
+
+typedef enum {
+	NMEA_NONE,	// no line completed, or it failed its checksum
+	NMEA_RMC,
+	NMEA_GGA,
+	NMEA_GSA,
+	NMEA_ZDA,
+	NMEA_OTHER	// a good line that is not decoded
+} nmea_sentence_t;
+
+typedef struct {
+	uint8_t hour;
+	uint8_t minute;
+	uint8_t second;			// up to 60 for a leap second
+	uint16_t millisecond;	// from up to three fraction digits
+} nmea_time_t;
+
+typedef struct {
+	uint8_t day;
+	uint8_t month;
+	uint16_t year;	// four digits, RMC's two digit year is taken as 20yy
+} nmea_date_t;
+
+typedef struct {
+	uint32_t chars;		// bytes seen
+	uint32_t passed;	// lines with a good checksum
+	uint32_t failed;	// lines with a bad or missing checksum, usually torn by lost bytes
+	uint32_t withFix;	// RMC with status A and GGA with a fix quality
+} nmea_stats_t;
+
+class NMEAParser {
+	public:
+		NMEAParser();
+
+		// Feeds one byte, returns what the line it completes was
+		nmea_sentence_t encode(char c);
+		// Parses one line, anything before its last '$' is skipped and a trailing CR LF is optional
+		nmea_sentence_t parse(const char* line, size_t length);
+
+		// Whether the last good line carried a time, or a date, and what it was
+		bool timeUpdated();
+		bool dateUpdated();
+		nmea_time_t time();
+		nmea_date_t date();
+		bool fix();				 // last RMC had status A
+		uint8_t quality();		 // GGA fix quality, 0 without a fix
+		uint8_t satellites();	 // GGA satellites used
+		uint8_t fixType();		 // GSA, 1 none, 2 2D, 3 3D
+		nmea_stats_t stats();
+
+	private:
+		nmea_sentence_t parseLine(const char* line, size_t length);
+		void parseRMC(const char* fields, const char* end);
+		void parseGGA(const char* fields, const char* end);
+		void parseGSA(const char* fields, const char* end);
+		void parseZDA(const char* fields, const char* end);
+		bool parseTime(const char* field, size_t length);
+
+		char _line[NMEA_LINE_SIZE];
+		size_t _length;	 // 0 outside a line, bytes up to the next '$' are skipped
+		nmea_time_t _time;
+		nmea_date_t _date;
+		bool _timeUpdated;
+		bool _dateUpdated;
+		bool _fix;
+		uint8_t _quality;
+		uint8_t _satellites;
+		uint8_t _fixType;
+		nmea_stats_t _stats;
+};
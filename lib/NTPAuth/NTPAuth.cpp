@@ -0,0 +1,158 @@
+#include <NTPAuth.h>
+#include "mbedtls/cmac.h"
+#include "mbedtls/md5.h"
+#include "mbedtls/sha1.h"
+
+static inline uint32_t readUint32(const uint8_t* buf) {
+	return ((uint32_t)buf[0] << 24) | ((uint32_t)buf[1] << 16) | ((uint32_t)buf[2] << 8) | buf[3];
+}
+
+static inline int hexDigit(char c) {
+	if (c >= '0' && c <= '9') {
+		return c - '0';
+	}
+	if (c >= 'a' && c <= 'f') {
+		return c - 'a' + 10;
+	}
+	if (c >= 'A' && c <= 'F') {
+		return c - 'A' + 10;
+	}
+	return -1;
+}
+
+static inline size_t macSize(ntp_key_type_t type) {
+	return type == NTP_KEY_SHA1 ? 20 : 16;
+}
+
+NTPAuth::NTPAuth() {
+	_keys = new ntp_key_t[NTP_AUTH_KEYS]();
+	_count = 0;
+}
+
+NTPAuth::~NTPAuth() {
+	for (size_t i = 0; i < _count; i++) {
+		if (_keys[i].type == NTP_KEY_AES128CMAC) {
+			mbedtls_cipher_free(&_keys[i].cmac);
+		}
+	}
+	delete[] _keys;
+}
+
+bool NTPAuth::addKey(uint32_t id, ntp_key_type_t type, const char* hexKey) {
+	uint8_t key[NTP_AUTH_KEY_SIZE];
+	size_t len = strlen(hexKey);
+	if (len % 2 != 0 || len / 2 > sizeof(key)) {
+		return false;
+	}
+	for (size_t i = 0; i < len / 2; i++) {
+		int high = hexDigit(hexKey[2 * i]);
+		int low = hexDigit(hexKey[2 * i + 1]);
+		if (high < 0 || low < 0) {
+			return false;
+		}
+		key[i] = (high << 4) | low;
+	}
+	return addKey(id, type, key, len / 2);
+}
+
+bool NTPAuth::addKey(uint32_t id, ntp_key_type_t type, const uint8_t* key, size_t len) {
+	if (_count == NTP_AUTH_KEYS || id == 0 || len == 0 || len > NTP_AUTH_KEY_SIZE ||
+		(type == NTP_KEY_AES128CMAC && len != 16)) {
+		return false;
+	}
+	ntp_key_t* entry = &_keys[_count];
+	entry->id = id;
+	entry->type = type;
+	memcpy(entry->key, key, len);
+	entry->len = len;
+	if (type == NTP_KEY_AES128CMAC) {
+		mbedtls_cipher_init(&entry->cmac);
+		if (mbedtls_cipher_setup(&entry->cmac, mbedtls_cipher_info_from_type(MBEDTLS_CIPHER_AES_128_ECB)) != 0 ||
+			mbedtls_cipher_cmac_starts(&entry->cmac, key, 128) != 0) {
+			mbedtls_cipher_free(&entry->cmac);
+			return false;
+		}
+	}
+	_count++;
+	return true;
+}
+
+bool NTPAuth::empty() {
+	return _count == 0;
+}
+
+// Digest of len bytes of data under key, returns its length
+size_t NTPAuth::mac(ntp_key_t* key, const uint8_t* data, size_t len, uint8_t* digest) {
+	switch (key->type) {
+	case NTP_KEY_MD5: {
+		mbedtls_md5_context md5;
+		mbedtls_md5_init(&md5);
+		mbedtls_md5_starts_ret(&md5);
+		mbedtls_md5_update_ret(&md5, key->key, key->len);
+		mbedtls_md5_update_ret(&md5, data, len);
+		mbedtls_md5_finish_ret(&md5, digest);
+		mbedtls_md5_free(&md5);
+		break;
+	}
+	case NTP_KEY_SHA1: {
+		mbedtls_sha1_context sha1;
+		mbedtls_sha1_init(&sha1);
+		mbedtls_sha1_starts_ret(&sha1);
+		mbedtls_sha1_update_ret(&sha1, key->key, key->len);
+		mbedtls_sha1_update_ret(&sha1, data, len);
+		mbedtls_sha1_finish_ret(&sha1, digest);
+		mbedtls_sha1_free(&sha1);
+		break;
+	}
+	case NTP_KEY_AES128CMAC:
+		// subkeys and AES key schedule were set up by addKey, only the data blocks are run here
+		mbedtls_cipher_cmac_reset(&key->cmac);
+		mbedtls_cipher_cmac_update(&key->cmac, data, len);
+		mbedtls_cipher_cmac_finish(&key->cmac, digest);
+		break;
+	}
+	return macSize(key->type);
+}
+
+int NTPAuth::find(uint32_t id) {
+	for (size_t i = 0; i < _count; i++) {
+		if (_keys[i].id == id) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+int NTPAuth::verify(const uint8_t* packet, size_t macOffset, size_t len) {
+	if (len < macOffset + 4 + 16) {
+		return -1;
+	}
+	uint32_t id = readUint32(packet + macOffset);
+	for (size_t i = 0; i < _count; i++) {
+		ntp_key_t* key = &_keys[i];
+		if (key->id != id) {
+			continue;
+		}
+		if (len != macOffset + 4 + macSize(key->type)) {
+			return -1;
+		}
+		uint8_t digest[NTP_AUTH_MAC_SIZE];
+		size_t size = mac(key, packet, macOffset, digest);
+		// constant time, a mismatch does not tell how many bytes were right
+		uint8_t diff = 0;
+		for (size_t j = 0; j < size; j++) {
+			diff |= digest[j] ^ packet[macOffset + 4 + j];
+		}
+		return diff == 0 ? (int)i : -1;
+	}
+	return -1;
+}
+
+size_t NTPAuth::sign(uint8_t* packet, int key) {
+	ntp_key_t* entry = &_keys[key];
+	packet[NTP_AUTH_HEADER] = entry->id >> 24;
+	packet[NTP_AUTH_HEADER + 1] = entry->id >> 16;
+	packet[NTP_AUTH_HEADER + 2] = entry->id >> 8;
+	packet[NTP_AUTH_HEADER + 3] = entry->id;
+	return NTP_AUTH_HEADER + 4 + mac(entry, packet, NTP_AUTH_HEADER, packet + NTP_AUTH_HEADER + 4);
+}
@@ -0,0 +1,50 @@
+#pragma once
+#include <Arduino.h>
+#include "mbedtls/cipher.h"
+
+#define NTP_AUTH_KEYS 8		   // keys in the table
+#define NTP_AUTH_KEY_SIZE 32   // longest key, in bytes
+#define NTP_AUTH_MAC_SIZE 20   // longest MAC, SHA1
+#define NTP_AUTH_HEADER 48	   // replies are signed over the NTP header alone
+
+// Symmetric key MACs after the NTP header and any extension fields (RFC 5905 section 7.3):
+// a 32 bit key ID and the digest of everything before it. MD5 and SHA1 are the legacy digest of key and header, AES-CMAC is RFC 8573.
+// Everything goes through mbedtls, which the ESP32 port runs on the AES and SHA
+// accelerators and the native build runs in software. Not thread safe, the CMAC contexts
+// keep state between packets, so one task should do all the verifying and signing.
+
+typedef enum {
+	NTP_KEY_MD5,
+	NTP_KEY_SHA1,
+	NTP_KEY_AES128CMAC
+} ntp_key_type_t;
+
+class NTPAuth {
+	public:
+		NTPAuth();
+		~NTPAuth();
+
+		// Adds a key given in hex, as in an ntp.keys file. False if the table is full or the key does not fit the type.
+		bool addKey(uint32_t id, ntp_key_type_t type, const char* hexKey);
+		bool addKey(uint32_t id, ntp_key_type_t type, const uint8_t* key, size_t len);
+		bool empty();
+		int find(uint32_t id);	// index of the key with id, -1 if there is none
+		// Checks the key ID and MAC at macOffset in packet, returns the key's index or -1
+		int verify(const uint8_t* packet, size_t macOffset, size_t len);
+		// Appends key ID and MAC after the header of packet, returns the new length of packet
+		size_t sign(uint8_t* packet, int key);
+
+	private:
+		typedef struct {
+			uint32_t id;
+			ntp_key_type_t type;
+			uint8_t key[NTP_AUTH_KEY_SIZE];
+			size_t len;
+			mbedtls_cipher_context_t cmac;	// keyed once, reset for every packet
+		} ntp_key_t;
+
+		size_t mac(ntp_key_t* key, const uint8_t* data, size_t len, uint8_t* digest);
+
+		ntp_key_t* _keys;
+		size_t _count;
+};
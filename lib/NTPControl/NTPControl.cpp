@@ -0,0 +1,395 @@
+#include <NTPControl.h>
+#include <stdarg.h>
+
+#ifdef NATIVE
+#define NTP_CONTROL_PROCESSOR "native"
+#define NTP_CONTROL_SYSTEM "Linux"
+#else
+#define NTP_CONTROL_PROCESSOR CONFIG_IDF_TARGET
+#define NTP_CONTROL_SYSTEM "FreeRTOS"
+#endif
+
+// Opcodes and error codes from RFC 9327
+#define CTL_OP_READSTAT 1
+#define CTL_OP_READVAR 2
+#define CERR_BADFMT 2
+#define CERR_BADOP 3
+#define CERR_BADASSOC 4
+
+#define CTL_SST_TS_UHF 4	   // system clock source, GPS
+#define CTL_PST_CONFIG 0x10	   // peer status bits
+#define CTL_PST_REACH 0x02
+#define CTL_PST_SEL_SYSPEER 6  // peer selection, the one the time comes from
+
+typedef enum {
+	SYS_VERSION,
+	SYS_PROCESSOR,
+	SYS_SYSTEM,
+	SYS_LEAP,
+	SYS_STRATUM,
+	SYS_PRECISION,
+	SYS_ROOTDELAY,
+	SYS_ROOTDISP,
+	SYS_REFID,
+	SYS_REFTIME,
+	SYS_CLOCK,
+	SYS_PEER,
+	SYS_OFFSET,
+	SYS_FREQUENCY,
+	SYS_SYS_JITTER,
+	SYS_CLK_JITTER,
+	SYS_UPTIME,
+	SYS_RECEIVED,
+	SYS_PROCESSED,
+	SYS_BADFORMAT,
+	SYS_BADAUTH,
+	SYS_DECLINED,
+	SYS_LIMITED,
+	SYS_VARIABLES
+} ntp_system_variable_t;
+
+// Same names as ntpd, ntpq's sysstats asks for the ss_ ones
+static const char* const SYSTEM_NAMES[SYS_VARIABLES] = {
+	"version", "processor", "system", "leap", "stratum", "precision", "rootdelay", "rootdisp",
+	"refid", "reftime", "clock", "peer", "offset", "frequency", "sys_jitter", "clk_jitter",
+	"ss_uptime", "ss_received", "ss_processed", "ss_badformat", "ss_badauth", "ss_declined", "ss_limited"};
+
+typedef enum {
+	PEER_SRCADR,
+	PEER_SRCPORT,
+	PEER_LEAP,
+	PEER_STRATUM,
+	PEER_PRECISION,
+	PEER_ROOTDELAY,
+	PEER_ROOTDISP,
+	PEER_REFID,
+	PEER_REFTIME,
+	PEER_REC,
+	PEER_REACH,
+	PEER_UNREACH,
+	PEER_HMODE,
+	PEER_PMODE,
+	PEER_HPOLL,
+	PEER_PPOLL,
+	PEER_OFFSET,
+	PEER_DELAY,
+	PEER_DISPERSION,
+	PEER_JITTER,
+	PEER_VARIABLES
+} ntp_peer_variable_t;
+
+static const char* const PEER_NAMES[PEER_VARIABLES] = {
+	"srcadr", "srcport", "leap", "stratum", "precision", "rootdelay", "rootdisp", "refid", "reftime", "rec",
+	"reach", "unreach", "hmode", "pmode", "hpoll", "ppoll", "offset", "delay", "dispersion", "jitter"};
+
+static inline uint16_t readUint16(const uint8_t* buf) {
+	return ((uint16_t)buf[0] << 8) | buf[1];
+}
+
+static inline void writeUint16(uint8_t* buf, uint16_t value) {
+	buf[0] = value >> 8;
+	buf[1] = value & 0xFF;
+}
+
+// NTP short format, 16.16 seconds, in nanoseconds
+static inline int64_t shortToNanos(uint32_t value) {
+	return (int64_t)(((uint64_t)value * 1000000000ULL) >> 16);
+}
+
+static inline bool isSeparator(char c) {
+	return c == ',' || c == ' ' || c == '\r' || c == '\n';
+}
+
+// Index of the name at text in names, -1 if there is none
+static int findName(const char* const* names, int count, const char* text, size_t len) {
+	for (int i = 0; i < count; i++) {
+		if (strlen(names[i]) == len && memcmp(names[i], text, len) == 0) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+NTPControl::NTPControl() {
+	_length = 0;
+	_offset = 0;
+	_column = 0;
+	_pending = false;
+}
+
+void NTPControl::respond(const uint8_t* request, size_t length, const ntp_control_vars_t& vars) {
+	_pending = false;
+	if (length < NTP_CONTROL_HEADER) {
+		return;	 // no header to answer
+	}
+	_leap = vars.leap;
+	_version = (request[0] >> 3) & 0x07;
+	_opcode = request[1] & 0x1F;
+	_sequence = readUint16(request + 2);
+	_association = readUint16(request + 6);
+	_status = (vars.leap << 14) | ((vars.synced ? CTL_SST_TS_UHF : 0) << 8);
+	_error = 0;
+	_length = 0;
+	_offset = 0;
+	_column = 0;
+	_pending = true;
+	uint16_t peerStatus = ((CTL_PST_CONFIG | (vars.reach ? CTL_PST_REACH : 0)) << 11) |
+						  ((vars.synced ? CTL_PST_SEL_SYSPEER : 0) << 8);
+
+	// the data field has to be within the request, names are read from it
+	size_t count = readUint16(request + 10);
+	if (count > length - NTP_CONTROL_HEADER) {
+		_error = CERR_BADFMT;
+		return;
+	}
+	if (_association != 0 && _association != NTP_CONTROL_ASSOCIATION) {
+		_error = CERR_BADASSOC;
+		return;
+	}
+	if (_opcode == CTL_OP_READSTAT) {
+		// The association list, the GPS is the only one. Asked about the GPS, just its status.
+		if (_association == 0) {
+			writeUint16(_data, NTP_CONTROL_ASSOCIATION);
+			writeUint16(_data + 2, peerStatus);
+			_length = 4;
+		} else {
+			_status = peerStatus;
+		}
+		return;
+	}
+	if (_opcode != CTL_OP_READVAR) {
+		_error = CERR_BADOP;
+		return;
+	}
+
+	// Every variable, or the ones named in the request. Names we do not have are skipped.
+	bool system = _association == 0;
+	if (!system) {
+		_status = peerStatus;
+	}
+	const char* names = (const char*)request + NTP_CONTROL_HEADER;
+	if (count == 0) {
+		int variables = system ? (int)SYS_VARIABLES : (int)PEER_VARIABLES;
+		for (int i = 0; i < variables; i++) {
+			system ? putSystem(i, vars) : putPeer(i, vars);
+		}
+	}
+	size_t start = 0;
+	while (start < count) {
+		while (start < count && isSeparator(names[start])) {
+			start++;
+		}
+		size_t end = start;
+		while (end < count && !isSeparator(names[end]) && names[end] != '=') {
+			end++;
+		}
+		int variable = system ? findName(SYSTEM_NAMES, SYS_VARIABLES, names + start, end - start)
+							  : findName(PEER_NAMES, PEER_VARIABLES, names + start, end - start);
+		if (variable >= 0) {
+			system ? putSystem(variable, vars) : putPeer(variable, vars);
+		}
+		// skip a value, readvar takes none
+		while (end < count && names[end] != ',') {
+			end++;
+		}
+		start = end + 1;
+	}
+	if (_length + 2 <= NTP_CONTROL_TEXT) {
+		memcpy(_data + _length, "\r\n", 2);
+		_length += 2;
+	}
+}
+
+bool NTPControl::pending() {
+	return _pending;
+}
+
+size_t NTPControl::next(uint8_t* packet) {
+	if (!_pending) {
+		return 0;
+	}
+	size_t count = _length - _offset;
+	if (count > NTP_CONTROL_DATA) {
+		count = NTP_CONTROL_DATA;
+	}
+	bool more = _offset + count < _length;
+	packet[0] = (_leap << 6) | (_version << 3) | 6;
+	packet[1] = 0x80 | (_error ? 0x40 : 0) | (more ? 0x20 : 0) | _opcode;
+	writeUint16(packet + 2, _sequence);
+	writeUint16(packet + 4, _error ? _error << 8 : _status);
+	writeUint16(packet + 6, _association);
+	writeUint16(packet + 8, _offset);
+	writeUint16(packet + 10, count);
+	memcpy(packet + NTP_CONTROL_HEADER, _data + _offset, count);
+	// data is padded to a multiple of 4 bytes, the count leaves the padding out
+	size_t length = NTP_CONTROL_HEADER + count;
+	while (length & 3) {
+		packet[length++] = 0;
+	}
+	_offset += count;
+	_pending = more;
+	return length;
+}
+
+void NTPControl::putSystem(int variable, const ntp_control_vars_t& vars) {
+	switch (variable) {
+		case SYS_VERSION:
+			put("version", "\"ESP32 NTP Server\"");
+			break;
+		case SYS_PROCESSOR:
+			put("processor", "\"%s\"", NTP_CONTROL_PROCESSOR);
+			break;
+		case SYS_SYSTEM:
+			put("system", "\"%s\"", NTP_CONTROL_SYSTEM);
+			break;
+		case SYS_LEAP:
+			put("leap", "%u", vars.leap);
+			break;
+		case SYS_STRATUM:
+			put("stratum", "%u", vars.stratum);
+			break;
+		case SYS_PRECISION:
+			put("precision", "%d", vars.precision);
+			break;
+		case SYS_ROOTDELAY:
+			putMillis("rootdelay", shortToNanos(vars.rootDelay));
+			break;
+		case SYS_ROOTDISP:
+			putMillis("rootdisp", shortToNanos(vars.rootDispersion));
+			break;
+		case SYS_REFID:
+			put("refid", "%s", vars.refid);
+			break;
+		case SYS_REFTIME:
+			put("reftime", "0x%08x.%08x", vars.reference.seconds, vars.reference.fraction);
+			break;
+		case SYS_CLOCK:
+			put("clock", "0x%08x.%08x", vars.clock.seconds, vars.clock.fraction);
+			break;
+		case SYS_PEER:
+			put("peer", "%u", vars.synced ? NTP_CONTROL_ASSOCIATION : 0);
+			break;
+		case SYS_OFFSET:
+			putMillis("offset", vars.offset);
+			break;
+		case SYS_FREQUENCY:
+			put("frequency", "%.3f", vars.frequency);
+			break;
+		case SYS_SYS_JITTER:
+			putMillis("sys_jitter", vars.jitter);
+			break;
+		case SYS_CLK_JITTER:
+			putMillis("clk_jitter", vars.jitter);
+			break;
+		case SYS_UPTIME:
+			put("ss_uptime", "%u", vars.uptime);
+			break;
+		case SYS_RECEIVED:
+			put("ss_received", "%u", vars.received);
+			break;
+		case SYS_PROCESSED:
+			put("ss_processed", "%u", vars.processed);
+			break;
+		case SYS_BADFORMAT:
+			put("ss_badformat", "%u", vars.badFormat);
+			break;
+		case SYS_BADAUTH:
+			put("ss_badauth", "%u", vars.badAuth);
+			break;
+		case SYS_DECLINED:
+			put("ss_declined", "%u", vars.declined);
+			break;
+		case SYS_LIMITED:
+			put("ss_limited", "%u", vars.limited);
+			break;
+	}
+}
+
+// The GPS as ntpd shows a reference clock, at the pseudo address of its NMEA driver
+void NTPControl::putPeer(int variable, const ntp_control_vars_t& vars) {
+	switch (variable) {
+		case PEER_SRCADR:
+			put("srcadr", "127.127.20.0");
+			break;
+		case PEER_SRCPORT:
+			put("srcport", "123");
+			break;
+		case PEER_LEAP:
+			put("leap", "%u", vars.leap);
+			break;
+		case PEER_STRATUM:
+			put("stratum", "0");
+			break;
+		case PEER_PRECISION:
+			put("precision", "%d", vars.precision);
+			break;
+		case PEER_ROOTDELAY:
+			putMillis("rootdelay", 0);
+			break;
+		case PEER_ROOTDISP:
+			putMillis("rootdisp", 0);
+			break;
+		case PEER_REFID:
+			put("refid", "%s", vars.refid);
+			break;
+		case PEER_REFTIME:
+			put("reftime", "0x%08x.%08x", vars.reference.seconds, vars.reference.fraction);
+			break;
+		case PEER_REC:
+			put("rec", "0x%08x.%08x", vars.reference.seconds, vars.reference.fraction);
+			break;
+		case PEER_REACH:
+			put("reach", "0x%02x", vars.reach);
+			break;
+		case PEER_UNREACH:
+			put("unreach", "%u", vars.reach ? 0 : 1);
+			break;
+		case PEER_HMODE:
+			put("hmode", "3");
+			break;
+		case PEER_PMODE:
+			put("pmode", "4");
+			break;
+		case PEER_HPOLL:
+			put("hpoll", "%u", NTP_CONTROL_POLL);
+			break;
+		case PEER_PPOLL:
+			put("ppoll", "%u", NTP_CONTROL_POLL);
+			break;
+		case PEER_OFFSET:
+			putMillis("offset", vars.offset);
+			break;
+		case PEER_DELAY:
+			putMillis("delay", 0);
+			break;
+		case PEER_DISPERSION:
+			putMillis("dispersion", shortToNanos(vars.rootDispersion));
+			break;
+		case PEER_JITTER:
+			putMillis("jitter", vars.jitter);
+			break;
+	}
+}
+
+// Appends name=value, wrapping lines at 72 characters like ntpd. Variables that no longer fit are left out.
+void NTPControl::put(const char* name, const char* format, ...) {
+	char value[40];
+	va_list args;
+	va_start(args, format);
+	vsnprintf(value, sizeof(value), format, args);
+	va_end(args);
+	size_t len = strlen(name) + 1 + strlen(value);
+	const char* separator = _length == 0 ? "" : (_column + 2 + len > 72 ? ",\r\n" : ", ");
+	size_t separatorLen = strlen(separator);
+	if (_length + separatorLen + len + 2 > NTP_CONTROL_TEXT) {
+		return;
+	}
+	_column = (separatorLen == 3 ? 0 : _column + separatorLen) + len;
+	_length += snprintf((char*)_data + _length, NTP_CONTROL_TEXT - _length, "%s%s=%s", separator, name, value);
+}
+
+// Milliseconds with 6 decimals, the unit ntpq expects for offsets and delays
+void NTPControl::putMillis(const char* name, int64_t nanos) {
+	uint64_t magnitude = nanos < 0 ? -nanos : nanos;
+	put(name, "%s%u.%06u", nanos < 0 ? "-" : "", (uint32_t)(magnitude / 1000000), (uint32_t)(magnitude % 1000000));
+}
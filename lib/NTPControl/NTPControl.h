@@ -0,0 +1,71 @@
+#pragma once
+#include <Arduino.h>
+#include <MicroTime.h>
+
+#define NTP_CONTROL_HEADER 12		// mode 6 header, up to the data
+#define NTP_CONTROL_DATA 468		// data bytes in one response fragment, as ntpd sends them
+#define NTP_CONTROL_PACKET (NTP_CONTROL_HEADER + NTP_CONTROL_DATA)
+#define NTP_CONTROL_TEXT 1024		// longest answer, split into fragments of NTP_CONTROL_DATA
+#define NTP_CONTROL_ASSOCIATION 1	// association ID of the GPS reference clock
+#define NTP_CONTROL_POLL 4			// log2 seconds between shifts of the reach register
+
+// Read only NTP control protocol (mode 6, RFC 9327), enough for ntpq's readvar, peers and sysstats.
+// Answers come from a snapshot the caller copies out, never from the clock or GPS directly,
+// so a monitoring poll costs the serving path no more than formatting the text.
+// Not thread safe, one task should answer all queries.
+
+// System and reference clock variables, refreshed once a second
+typedef struct {
+	uint8_t leap;				// 0, or 3 while unsynchronized
+	uint8_t stratum;
+	int8_t precision;
+	bool synced;				// time is being served from the GPS
+	char refid[5];
+	uint32_t rootDelay;			// NTP short format, as in the packet header
+	uint32_t rootDispersion;	// NTP short format
+	NtpTimestamp reference;		// time of the last fix
+	NtpTimestamp clock;			// time the snapshot was copied out for a query
+	uint8_t reach;				// valid fix at each of the last 8 polls, newest in bit 0
+	int32_t offset;				// nanoseconds the clock was ahead of the last PPS edge
+	float frequency;			// ppm, positive when fast
+	uint32_t jitter;			// nanoseconds
+	uint32_t uptime;			// seconds
+	uint32_t received;			// every datagram that reached the server
+	uint32_t processed;			// requests answered
+	uint32_t badFormat;			// too short, too long or malformed
+	uint32_t badAuth;
+	uint32_t declined;			// bad version or mode, replies from servers, or no room in the queue
+	uint32_t limited;
+} ntp_control_vars_t;
+
+class NTPControl {
+	public:
+		NTPControl();
+
+		// Reads a mode 6 request of length bytes and formats the whole answer, from vars. A data
+		// field longer than the request is answered with a format error. Without a whole header, nothing is.
+		void respond(const uint8_t* request, size_t length, const ntp_control_vars_t& vars);
+		bool pending();	 // a fragment of the answer is still to be sent
+		// Writes the next fragment of the answer into packet, which holds NTP_CONTROL_PACKET bytes.
+		// Returns its length, or 0 once every fragment has been written.
+		size_t next(uint8_t* packet);
+
+	private:
+		void putSystem(int variable, const ntp_control_vars_t& vars);
+		void putPeer(int variable, const ntp_control_vars_t& vars);
+		void put(const char* name, const char* format, ...);
+		void putMillis(const char* name, int64_t nanos);
+
+		uint8_t _data[NTP_CONTROL_TEXT];
+		size_t _length;
+		size_t _offset;
+		size_t _column;	 // characters on the current line, lines are wrapped like ntpd's
+		bool _pending;	 // a fragment is still to be sent, even an empty one
+		uint8_t _leap;
+		uint8_t _version;
+		uint8_t _opcode;
+		uint16_t _sequence;
+		uint16_t _status;
+		uint16_t _association;
+		uint8_t _error;
+};
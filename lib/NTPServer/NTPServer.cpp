@@ -1,163 +1,714 @@
-#include <NTPServer.h>
-
-static const int NTP_PACKET_SIZE = 48;
-
-NTPServer::NTPServer(Stream& serial, GPSManager& gpsManager) {
-	_serial = &serial;
-	_gpsManager = &gpsManager;
-	_udp = new AsyncUDP();
-	_udp->listen(NTP_PORT);
-	_udp->onPacket([=](AsyncUDPPacket packet) {
-		if (packet.length() == NTP_PACKET_SIZE) {
-			uint32_t micros_rx;
-			uint32_t time_rx = (uint32_t)now(micros_rx) + 2208988800; // Unix to NTP offset
-			uint32_t lastFix = _gpsManager->lastFix();
-			double dispersion = lastFix * 0.0000000001; // approx 1 microsecond per second error
-			uint16_t dispersion_n = (uint16_t)dispersion;
-			uint16_t dispersion_f = (dispersion - dispersion_n) / 0.0000152587890625;
-			uint32_t microsFrac_rx = (micros_rx % 1000000) / 0.00023283064365386962890625;
-			AsyncUDPMessage* msg = new AsyncUDPMessage(NTP_PACKET_SIZE);
-			if (_gpsManager->validFix() && lastFix <= 3600000) { // check if fix is valid and less than 1 hour old
-				//TODO Check for upcoming leap second
-				msg->write(0b00100100);   // LI, Version, Mode
-				msg->write(1);  // stratum
-				msg->write(6);  // polling minimum
-				msg->write(-9); // precision
-
-				msg->write(0);  // root delay
-				msg->write(0);
-				msg->write(1);
-				msg->write(0xAE);
-
-				msg->write((dispersion_n >> 8) & 0XFF);  // root dispersion
-				msg->write(dispersion_n & 0XFF);
-				msg->write((dispersion_f >> 8) & 0XFF);
-				msg->write(dispersion_f & 0XFF);
-
-				msg->write(71); //"G";
-				msg->write(80); //"P";
-				msg->write(83); //"S";
-				msg->write(0);  //"0";
-				
-				uint32_t time_fix = time_rx;
-				uint32_t micros_fix = (micros_rx % 1000000) - (lastFix * 1000);
-				if (micros_fix < 0) {
-					time_fix += floor(micros_fix / 1000000);
-					micros_fix %= 1000000;
-				}
-				uint32_t microsFrac_fix = (micros_fix % 1000000) / 0.00023283064365386962890625;
-
-				//Reference Timestamp
-				msg->write((time_fix >> 24) & 0XFF);
-				msg->write((time_fix >> 16) & 0XFF);
-				msg->write((time_fix >> 8) & 0XFF);
-				msg->write(time_fix & 0XFF);
-				msg->write((microsFrac_fix >> 24) & 0XFF);
-				msg->write((microsFrac_fix >> 16) & 0XFF);
-				msg->write((microsFrac_fix >> 8) & 0XFF);
-				msg->write(microsFrac_fix & 0XFF);
-
-				//Origin Timestamp
-				msg->write(packet.data()[40]);
-				msg->write(packet.data()[41]);
-				msg->write(packet.data()[42]);
-				msg->write(packet.data()[43]);
-				msg->write(packet.data()[44]);
-				msg->write(packet.data()[45]);
-				msg->write(packet.data()[46]);
-				msg->write(packet.data()[47]);
-
-				//Receive Timestamp
-				msg->write((time_rx >> 24) & 0XFF);
-				msg->write((time_rx >> 16) & 0XFF);
-				msg->write((time_rx >> 8) & 0XFF);
-				msg->write(time_rx & 0XFF);
-				msg->write((microsFrac_rx >> 24) & 0XFF);
-				msg->write((microsFrac_rx >> 16) & 0XFF);
-				msg->write((microsFrac_rx >> 8) & 0XFF);
-				msg->write(microsFrac_rx & 0XFF);
-
-				//Transmit Timestamp
-				uint32_t micros_tx;
-				uint32_t time_tx = (uint32_t)now(micros_tx) + 2208988800; // Unix to NTP offset
-				uint32_t microsFrac_tx = (micros_tx % 1000000) / 0.00023283064365386962890625;
-
-				msg->write((time_tx >> 24) & 0XFF);
-				msg->write((time_tx >> 16) & 0XFF);
-				msg->write((time_tx >> 8) & 0XFF);
-				msg->write(time_tx & 0XFF);
-				msg->write((microsFrac_tx >> 24) & 0XFF);
-				msg->write((microsFrac_tx >> 16) & 0XFF);
-				msg->write((microsFrac_tx >> 8) & 0XFF);
-				msg->write(microsFrac_tx & 0XFF);
-			} else {
-				msg->write(0b11100100);   // LI, Version, Mode
-				msg->write(16);   // stratum
-				msg->write(6);   // polling minimum
-				msg->write(-6); // precision
-
-				msg->write(0);  // root delay
-				msg->write(0);
-				msg->write(1);
-				msg->write(0xAE);
-
-				msg->write(0xFF); // root dispersion
-				msg->write(0xFF);
-				msg->write(0xFF);
-				msg->write(0xFF);
-
-				msg->write(71); //"G";
-				msg->write(80); //"P";
-				msg->write(83); //"S";
-				msg->write(0); //"0";
-
-				// Time unknown -- return 0
-				//Reference Timestamp
-				msg->write(0);
-				msg->write(0);
-				msg->write(0);
-				msg->write(0);
-				msg->write(0);
-				msg->write(0);
-				msg->write(0);
-				msg->write(0);
-
-				//Origin Timestamp
-				msg->write(0);
-				msg->write(0);
-				msg->write(0);
-				msg->write(0);
-				msg->write(0);
-				msg->write(0);
-				msg->write(0);
-				msg->write(0);
-
-				//Receive Timestamp
-				msg->write(0);
-				msg->write(0);
-				msg->write(0);
-				msg->write(0);
-				msg->write(0);
-				msg->write(0);
-				msg->write(0);
-				msg->write(0);
-
-				//Transmit Timestamp
-				msg->write(0);
-				msg->write(0);
-				msg->write(0);
-				msg->write(0);
-				msg->write(0);
-				msg->write(0);
-				msg->write(0);
-				msg->write(0);
-			}
-
-			packet.send(*msg);
-		}
-	});
-}
-
-NTPServer::~NTPServer() {
-	_udp->close();
-}
\ No newline at end of file
+#include <NTPServer.h>
+
+static const int NTP_PACKET_SIZE = 48;
+
+static const int NTP_DROP_NONE = -1;
+static const int NTP_CONTROL_REQUEST = -2;
+static const size_t NTP_CONTROL_MAX_REQUEST = NTP_CONTROL_PACKET + 4 + NTP_AUTH_MAC_SIZE;
+static const uint64_t NTP_FAST_REQUESTS = (1ULL << 0x23) | (1ULL << 0x1B);	// version and mode bits of v4 and v3 client requests
+
+// Counters are read from other tasks while the packet path bumps them. Relaxed atomics keep
+// each one whole with no lock, fence or shared cache line to wait for.
+static inline void count(uint32_t& counter) {
+	__atomic_fetch_add(&counter, 1, __ATOMIC_RELAXED);
+}
+
+static inline uint16_t readUint16(const uint8_t* buf) {
+	return ((uint16_t)buf[0] << 8) | buf[1];
+}
+
+static inline uint32_t readUint32(const uint8_t* buf) {
+	return ((uint32_t)buf[0] << 24) | ((uint32_t)buf[1] << 16) | ((uint32_t)buf[2] << 8) | buf[3];
+}
+
+// Sorts out datagrams that are not requests we answer, before any timestamp work, and finds
+// where the MAC starts (0 for none). A plain version 3 or 4 client request is one branch.
+// Mode 6 queries come back as NTP_CONTROL_REQUEST.
+static inline int classify(const uint8_t* packet, size_t len, size_t& macOffset) {
+	macOffset = 0;
+	if (len == NTP_PACKET_SIZE && ((NTP_FAST_REQUESTS >> (packet[0] & 0x3F)) & 1)) {
+		return NTP_DROP_NONE;
+	}
+	if (len >= NTP_CONTROL_HEADER && (packet[0] & 0x07) == 6) {
+		uint8_t version = (packet[0] >> 3) & 0x07;
+		if (version == 0 || version > 4) {
+			return NTP_DROP_VERSION;
+		}
+		if (packet[1] & 0x80) {
+			return NTP_DROP_SERVER;	 // a response
+		}
+		if (len > NTP_CONTROL_MAX_REQUEST) {
+			return NTP_DROP_LONG;
+		}
+		return (size_t)NTP_CONTROL_HEADER + readUint16(packet + 10) > len ? NTP_DROP_MALFORMED : NTP_CONTROL_REQUEST;
+	}
+	if (len < NTP_PACKET_SIZE) {
+		return NTP_DROP_SHORT;
+	}
+	if (len > NTP_MAX_REQUEST) {
+		return NTP_DROP_LONG;
+	}
+	uint8_t version = (packet[0] >> 3) & 0x07;
+	uint8_t mode = packet[0] & 0x07;
+	if (version == 0 || version > 4) {
+		return NTP_DROP_VERSION;
+	}
+	if (mode == 4 || mode == 5) {
+		return NTP_DROP_SERVER;
+	}
+	if (mode != 3 && mode != 1) {
+		return NTP_DROP_MODE;
+	}
+	// RFC 7822: anything longer than the largest MAC (24 bytes) after the header starts with an
+	// extension field, at least 16 bytes and a multiple of 4. Fields are skipped, not answered.
+	size_t offset = NTP_PACKET_SIZE;
+	while (len - offset > 4 + NTP_AUTH_MAC_SIZE) {
+		uint16_t fieldLength = readUint16(packet + offset + 2);
+		if (version < 4 || fieldLength < 16 || (fieldLength & 3) != 0 || fieldLength > len - offset) {
+			return NTP_DROP_MALFORMED;
+		}
+		offset += fieldLength;
+	}
+	if (len - offset == 4 + 16 || len - offset == 4 + 20) {
+		macOffset = offset;
+	} else if (len != offset) {
+		return NTP_DROP_MALFORMED;
+	}
+	return NTP_DROP_NONE;
+}
+
+static inline void writeUint32(uint8_t* buf, uint32_t value) {
+	buf[0] = (value >> 24) & 0xFF;
+	buf[1] = (value >> 16) & 0xFF;
+	buf[2] = (value >> 8) & 0xFF;
+	buf[3] = value & 0xFF;
+}
+
+#ifdef NTP_SERVER_RAW_LWIP
+#include "lwip/priv/tcpip_priv.h"
+
+// pcb setup and teardown have to run in the tcpip thread
+typedef struct {
+	struct tcpip_api_call_data call;
+	udp_recv_fn recv;
+	NTPServer* server;
+	struct udp_pcb* pcb;
+	uint16_t port;
+} ntp_pcb_call_t;
+
+static err_t openPcb(struct tcpip_api_call_data* data) {
+	ntp_pcb_call_t* call = (ntp_pcb_call_t*)data;
+	call->pcb = udp_new();
+	if (call->pcb == NULL) {
+		return ERR_MEM;
+	}
+	ip_set_option(call->pcb, SOF_BROADCAST);
+	err_t err = udp_bind(call->pcb, IP_ANY_TYPE, call->port);
+	if (err != ERR_OK) {
+		udp_remove(call->pcb);
+		call->pcb = NULL;
+		return err;
+	}
+	udp_recv(call->pcb, call->recv, call->server);
+	return ERR_OK;
+}
+
+static err_t closePcb(struct tcpip_api_call_data* data) {
+	udp_remove(((ntp_pcb_call_t*)data)->pcb);
+	return ERR_OK;
+}
+
+NTPServer::NTPServer(Stream& serial, GPSManager& gpsManager, uint16_t port) {
+	_serial = &serial;
+	_gpsManager = &gpsManager;
+	_clients = new ntp_client_t[NTP_INTERLEAVED_CLIENTS]();
+	_templateSeq = 0;
+	_stats = {};
+	_latency = {};
+	_latencySeq = 0;
+	rateLimit(0, NTP_RATE_BURST, NTP_RATE_KISS_OF_DEATH);
+	_broadcastIp = 0;
+	_broadcastSubnet = false;
+	_broadcastSecond = 0;
+	_controlEnabled = false;
+	_localIp = 0;
+	_localMask = 0;
+	_varsSeq = 0;
+	_reach = 0;
+	_reachPoll = 0;
+	updateTemplate();
+	rxTimestampListen(port);
+	ntp_pcb_call_t call = {};
+	call.recv = receive;
+	call.server = this;
+	call.port = port;
+	tcpip_api_call(openPcb, &call.call);
+	_pcb = call.pcb;
+}
+
+NTPServer::~NTPServer() {
+	rxTimestampListen(0);
+	if (_pcb) {
+		ntp_pcb_call_t call = {};
+		call.pcb = _pcb;
+		tcpip_api_call(closePcb, &call.call);
+	}
+	delete[] _clients;
+}
+
+void NTPServer::receive(void* arg, struct udp_pcb* pcb, struct pbuf* p, const ip_addr_t* addr, u16_t port) {
+	NTPServer* server = (NTPServer*)arg;
+	size_t macOffset;
+	// a chained pbuf is only possible far beyond anything we accept
+	int drop = p->len != p->tot_len ? NTP_DROP_LONG : classify((uint8_t*)p->payload, p->len, macOffset);
+	if (drop == NTP_CONTROL_REQUEST) {
+		uint32_t ip = IP_IS_V4(addr) ? ip_2_ip4(addr)->addr : 0;
+		if (server->control(ip, port, (uint8_t*)p->payload, p->len)) {
+			while (server->_control.pending()) {
+				struct pbuf* fragment = pbuf_alloc(PBUF_TRANSPORT, NTP_CONTROL_PACKET, PBUF_RAM);
+				if (fragment == NULL) {
+					break;
+				}
+				pbuf_realloc(fragment, server->_control.next((uint8_t*)fragment->payload));
+				udp_sendto(pcb, fragment, addr, port);
+				pbuf_free(fragment);
+			}
+		}
+	} else if (drop != NTP_DROP_NONE) {
+		count(server->_stats.invalid[drop]);
+		if (IP_IS_V4(addr)) {
+			rxTimestampDiscard(IPAddress(ip_2_ip4(addr)->addr), port, (uint8_t*)p->payload, p->len);
+		}
+	} else {
+		uint64_t received;
+		if (!IP_IS_V4(addr) || !rxTimestampLookup(IPAddress(ip_2_ip4(addr)->addr), port, (uint8_t*)p->payload, p->len, received)) {
+			received = esp_timer_get_time();
+		}
+		// Reply overwrites the request in the receive pbuf and goes straight back out from the
+		// tcpip thread, no queue hop, copy or allocation on our side
+		uint8_t* buf = (uint8_t*)p->payload;
+		uint32_t ip = IP_IS_V4(addr) ? ip_2_ip4(addr)->addr : 0;
+		server->_mruList.update(ip, port, buf[0], received);
+		if (server->limit(ip, received, buf, buf)) {
+			if (server->_kissOfDeath) {
+				pbuf_realloc(p, NTP_PACKET_SIZE);  // a KoD carries no extension fields or MAC
+				udp_sendto(pcb, p, addr, port);
+			}
+			pbuf_free(p);
+			return;
+		}
+		count(server->_stats.received);
+		int key = -1;
+		if (macOffset != 0) {
+			key = server->_auth.verify(buf, macOffset, p->len);
+			if (key < 0) {
+				count(server->_stats.authFailed);
+				pbuf_free(p);
+				return;
+			}
+			count(server->_stats.authenticated);
+		}
+		ntp_client_t* client = server->clientSlot(ip);
+		NtpTimestamp rx = localToNtp(received);
+		bool synced = server->buildReply(buf, buf, rx, client && client->ip == ip ? client : NULL);
+		// extension fields are not answered, so the reply is never longer than the request
+		pbuf_realloc(p, key >= 0 ? server->_auth.sign(buf, key) : NTP_PACKET_SIZE);
+		udp_sendto(pcb, p, addr, port);
+		server->recordLatency(received);
+		if (client && synced) {
+			client->ip = ip;
+			client->rx = rx;
+			client->tx = nowNtp();
+		}
+	}
+	pbuf_free(p);
+}
+
+err_t NTPServer::broadcastCall(struct tcpip_api_call_data* data) {
+	((ntp_pcb_call_t*)data)->server->sendBroadcast();
+	return ERR_OK;
+}
+
+void NTPServer::sendBroadcast() {
+	struct pbuf* p = pbuf_alloc(PBUF_TRANSPORT, NTP_AUTH_HEADER + 4 + NTP_AUTH_MAC_SIZE, PBUF_RAM);
+	if (p == NULL) {
+		return;
+	}
+	size_t length = buildBroadcast((uint8_t*)p->payload);
+	if (length > 0) {
+		pbuf_realloc(p, length);
+		ip_addr_t addr;
+		ip_addr_set_ip4_u32(&addr, broadcastAddress());
+		if (udp_sendto(_pcb, p, &addr, _broadcastPort) == ERR_OK) {
+			count(_stats.broadcasts);
+		}
+	}
+	pbuf_free(p);
+}
+#else
+NTPServer::NTPServer(Stream& serial, GPSManager& gpsManager, uint16_t port) {
+	_serial = &serial;
+	_gpsManager = &gpsManager;
+	_clients = new ntp_client_t[NTP_INTERLEAVED_CLIENTS]();
+	_templateSeq = 0;
+	_stats = {};
+	_latency = {};
+	_latencySeq = 0;
+	rateLimit(0, NTP_RATE_BURST, NTP_RATE_KISS_OF_DEATH);
+	_broadcastIp = 0;
+	_broadcastSubnet = false;
+	_broadcastSecond = 0;
+	_controlEnabled = false;
+	_localIp = 0;
+	_localMask = 0;
+	_varsSeq = 0;
+	_reach = 0;
+	_reachPoll = 0;
+	_queueHead = 0;
+	_queueTail = 0;
+	_broadcastDue = false;
+	updateTemplate();
+	_running = true;
+	_task = NULL;
+	xTaskCreatePinnedToCore(serveTask, "ntp", NTP_TASK_STACK, this, NTP_TASK_PRIORITY, &_task, NTP_TASK_CORE);
+	_udp = new AsyncUDP();
+	rxTimestampListen(port);
+	_udp->listen(port);
+	_udp->onPacket([=](AsyncUDPPacket& packet) {
+		size_t macOffset;
+		int drop = classify(packet.data(), packet.length(), macOffset);
+		if (drop == NTP_CONTROL_REQUEST) {
+			// Answered from here, queries never take up queue space or time in the serving task
+			if (control((uint32_t)packet.remoteIP(), packet.remotePort(), packet.data(), packet.length())) {
+				uint8_t fragment[NTP_CONTROL_PACKET];
+				while (_control.pending()) {
+					packet.write(fragment, _control.next(fragment));
+				}
+			}
+			return;
+		}
+		if (drop != NTP_DROP_NONE) {
+			count(_stats.invalid[drop]);
+			rxTimestampDiscard(packet.remoteIP(), packet.remotePort(), packet.data(), packet.length());
+			return;
+		}
+		// Receive time is when the driver saw the frame, not when the AsyncUDP task got to it
+		uint64_t received;
+		if (!rxTimestampLookup(packet.remoteIP(), packet.remotePort(), packet.data(), packet.length(), received)) {
+			received = esp_timer_get_time();
+		}
+		uint32_t ip = (uint32_t)packet.remoteIP();
+		_mruList.update(ip, packet.remotePort(), packet.data()[0], received);
+		// Clients over their limit are answered here and never take up queue space
+		uint8_t kiss[NTP_PACKET_SIZE];
+		if (limit(ip, received, packet.data(), kiss)) {
+			if (_kissOfDeath) {
+				packet.write(kiss, NTP_PACKET_SIZE);
+			}
+			return;
+		}
+		// Only copied into the ring here, the serving task builds and sends the reply so
+		// HTTP and GPS work on the other core cannot delay it
+		uint32_t head = _queueHead;
+		uint32_t depth = head - __atomic_load_n(&_queueTail, __ATOMIC_ACQUIRE);
+		if (depth == NTP_QUEUE_SIZE) {
+			count(_stats.dropped);
+			return;
+		}
+		ntp_request_t* request = &_queue[head & (NTP_QUEUE_SIZE - 1)];
+		memcpy(request->data, packet.data(), packet.length());
+		request->length = packet.length();
+		request->macOffset = macOffset;
+		request->ip = ip;
+		request->port = packet.remotePort();
+		request->received = received;
+		__atomic_store_n(&_queueHead, head + 1, __ATOMIC_RELEASE);
+		count(_stats.received);
+		if (depth + 1 > _stats.queueMax) {
+			_stats.queueMax = depth + 1;
+		}
+		xTaskNotifyGive(_task);
+	});
+}
+
+NTPServer::~NTPServer() {
+	rxTimestampListen(0);
+	_udp->close();
+	_running = false;
+	xTaskNotifyGive(_task);
+	while (__atomic_load_n(&_task, __ATOMIC_ACQUIRE) != NULL) {
+		delay(1);
+	}
+	delete _udp;
+	delete[] _clients;
+}
+
+void NTPServer::serveTask(void* arg) {
+	NTPServer* server = (NTPServer*)arg;
+	server->serve();
+	__atomic_store_n(&server->_task, (TaskHandle_t)NULL, __ATOMIC_RELEASE);
+	vTaskDelete(NULL);
+}
+
+void NTPServer::serve() {
+	uint8_t reply[NTP_AUTH_HEADER + 4 + NTP_AUTH_MAC_SIZE];
+	while (_running) {
+		ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+		if (_broadcastDue) {
+			_broadcastDue = false;
+			sendBroadcast();
+		}
+		uint32_t tail = _queueTail;
+		while (tail != __atomic_load_n(&_queueHead, __ATOMIC_ACQUIRE)) {
+			ntp_request_t* request = &_queue[tail & (NTP_QUEUE_SIZE - 1)];
+			int key = -1;
+			if (request->macOffset != 0) {
+				key = _auth.verify(request->data, request->macOffset, request->length);
+				if (key < 0) {
+					count(_stats.authFailed);
+					__atomic_store_n(&_queueTail, ++tail, __ATOMIC_RELEASE);
+					continue;
+				}
+				count(_stats.authenticated);
+			}
+			ntp_client_t* client = clientSlot(request->ip);
+			NtpTimestamp rx = localToNtp(request->received);
+			bool synced = buildReply(request->data, reply, rx, client && client->ip == request->ip ? client : NULL);
+			size_t length = key >= 0 ? _auth.sign(reply, key) : NTP_PACKET_SIZE;
+			_udp->writeTo(reply, length, IPAddress(request->ip), request->port);
+			recordLatency(request->received);
+			if (client && synced) {
+				client->ip = request->ip;
+				client->rx = rx;
+				client->tx = nowNtp();
+			}
+			__atomic_store_n(&_queueTail, ++tail, __ATOMIC_RELEASE);
+		}
+	}
+}
+
+void NTPServer::sendBroadcast() {
+	uint8_t packet[NTP_AUTH_HEADER + 4 + NTP_AUTH_MAC_SIZE];
+	size_t length = buildBroadcast(packet);
+	if (length > 0 && _udp->writeTo(packet, length, IPAddress(broadcastAddress()), _broadcastPort) == length) {
+		count(_stats.broadcasts);
+	}
+}
+#endif
+
+// Slot remembering ip for interleaved mode, shared by clients whose addresses hash alike.
+// Only the task sending replies touches the table, so it needs no lock.
+ntp_client_t* NTPServer::clientSlot(uint32_t ip) {
+	if (ip == 0) {
+		return NULL;
+	}
+	return &_clients[((uint32_t)(ip * 2654435761UL) >> 16) & (NTP_INTERLEAVED_CLIENTS - 1)];
+}
+
+ntp_server_stats_t NTPServer::stats() {
+	ntp_server_stats_t stats = _stats;
+#ifndef NTP_SERVER_RAW_LWIP
+	stats.queueDepth = __atomic_load_n(&_queueHead, __ATOMIC_RELAXED) - __atomic_load_n(&_queueTail, __ATOMIC_RELAXED);
+#endif
+	return stats;
+}
+
+ntp_latency_t NTPServer::latency() {
+	ntp_latency_t latency;
+	uint32_t seq;
+	do {
+		seq = __atomic_load_n(&_latencySeq, __ATOMIC_ACQUIRE);
+		memcpy(&latency, &_latency, sizeof(latency));
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	} while ((seq & 1) || seq != __atomic_load_n(&_latencySeq, __ATOMIC_RELAXED));
+	return latency;
+}
+
+// From the frame arriving to the reply handed to the driver, called only by the task sending replies
+void NTPServer::recordLatency(uint64_t received) {
+	uint32_t micros = esp_timer_get_time() - received;
+	int bucket = 0;
+	while (bucket < NTP_LATENCY_BUCKETS - 1 && micros > NTP_LATENCY_BOUNDS[bucket]) {
+		bucket++;
+	}
+	// the buckets go in with the sum, so a scrape sees a count that matches it
+	uint32_t seq = _latencySeq;
+	__atomic_store_n(&_latencySeq, seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	_latency.buckets[bucket]++;
+	_latency.sum += micros;
+	__atomic_store_n(&_latencySeq, seq + 2, __ATOMIC_RELEASE);
+}
+
+MRUList& NTPServer::mruList() {
+	return _mruList;
+}
+
+bool NTPServer::addKey(uint32_t id, ntp_key_type_t type, const char* hexKey) {
+	return _auth.addKey(id, type, hexKey);
+}
+
+void NTPServer::rateLimit(uint32_t intervalMillis, uint32_t burst, bool kissOfDeath) {
+	_kissOfDeath = kissOfDeath;
+	_rateLimiter.configure(intervalMillis * 1000, burst);
+}
+
+// Returns true if ip is over its limit, with a Kiss-o'-Death RATE for it in reply.
+// request and reply may be the same buffer.
+bool NTPServer::limit(uint32_t ip, uint64_t received, const uint8_t* request, uint8_t* reply) {
+	if (_rateLimiter.allow(ip, (uint32_t)received)) {
+		return false;
+	}
+	count(_stats.limited);
+	if (_kissOfDeath) {
+		uint8_t mode = request[0] & 0x07;
+		uint8_t poll = request[2];
+		uint8_t transmit[8];
+		memcpy(transmit, request + 40, 8);
+		memset(reply, 0, NTP_PACKET_SIZE);
+		reply[0] = 0b11100000 | (mode == 1 ? 2 : 4);  // LI unsynchronized, version 4
+		reply[1] = 0;								  // stratum 0, kiss code in the reference id
+		reply[2] = poll;
+		memcpy(reply + 12, "RATE", 4);
+		// No time is given away, every timestamp echoes the request's transmit timestamp
+		memcpy(reply + 24, transmit, 8);
+		memcpy(reply + 32, transmit, 8);
+		memcpy(reply + 40, transmit, 8);
+	}
+	return true;
+}
+
+// Returns true if the mode 6 query from ip is to be answered with the fragments of _control
+bool NTPServer::control(uint32_t ip, uint16_t port, const uint8_t* request, size_t length) {
+	// An answer is up to NTP_CONTROL_TEXT bytes for a 12 byte query, so answering any source
+	// would make the server an amplifier for spoofed ones. Others are dropped like other modes.
+	uint32_t local = __atomic_load_n(&_localIp, __ATOMIC_RELAXED);
+	uint32_t mask = __atomic_load_n(&_localMask, __ATOMIC_RELAXED);
+	if (!_controlEnabled || local == 0 || ((ip ^ local) & mask) != 0) {
+		count(_stats.invalid[NTP_DROP_MODE]);
+		return false;
+	}
+	uint64_t received = esp_timer_get_time();
+	_mruList.update(ip, port, request[0], received);
+	// no KoD, ntpq would not understand one
+	if (!_rateLimiter.allow(ip, (uint32_t)received)) {
+		count(_stats.limited);
+		return false;
+	}
+	ntp_control_vars_t vars;
+	readVars(vars);
+	_control.respond(request, length, vars);
+	count(_stats.control);
+	return true;
+}
+
+bool NTPServer::broadcast(IPAddress address, uint8_t poll, uint32_t keyId, uint16_t port) {
+	int key = keyId != 0 ? _auth.find(keyId) : -1;
+	if (keyId != 0 && key < 0) {
+		return false;
+	}
+	_broadcastPoll = poll < 17 ? poll : 17;	 // NTP's longest poll interval, 36 hours
+	_broadcastPort = port;
+	_broadcastKey = key;
+	_broadcastIp = (uint32_t)address;
+	_broadcastSubnet = (uint32_t)address == (uint32_t)NTP_BROADCAST_SUBNET;
+	return true;
+}
+
+// Where the broadcast goes, the subnet's from the address and mask loop() last read
+uint32_t NTPServer::broadcastAddress() {
+	if (!_broadcastSubnet) {
+		return _broadcastIp;
+	}
+	return __atomic_load_n(&_localIp, __ATOMIC_RELAXED) | ~__atomic_load_n(&_localMask, __ATOMIC_RELAXED);
+}
+
+void NTPServer::controlQueries(bool enable) {
+	_controlEnabled = enable;
+}
+
+void NTPServer::loop() {
+	uint32_t second = now();
+	bool fix = _gpsManager->validFix();
+	if (second != _templateSecond || fix != _templateFix || (fix && !_templateSynced)) {
+		if (_controlEnabled || _broadcastSubnet) {
+			__atomic_store_n(&_localIp, (uint32_t)ETH.localIP(), __ATOMIC_RELAXED);
+			__atomic_store_n(&_localMask, (uint32_t)ETH.subnetMask(), __ATOMIC_RELAXED);
+		}
+		updateTemplate();
+	}
+	// Checked right after the template, which loop() refreshes within a pass of the PPS edge
+	if (_broadcastIp != 0 && (!_broadcastSubnet || _localIp != 0) && _templateSynced && second != _broadcastSecond &&
+		(second & ((1UL << _broadcastPoll) - 1)) == 0) {
+		_broadcastSecond = second;
+#ifdef NTP_SERVER_RAW_LWIP
+		ntp_pcb_call_t call = {};
+		call.server = this;
+		tcpip_api_call(broadcastCall, &call.call);
+#else
+		_broadcastDue = true;
+		xTaskNotifyGive(_task);
+#endif
+	}
+}
+
+// Everything in a reply before the origin timestamp, recomputed once a second instead of per packet
+void NTPServer::updateTemplate() {
+	uint8_t header[NTP_TEMPLATE_SIZE];
+	uint32_t lastFix = _gpsManager->lastFix();
+	_templateFix = _gpsManager->validFix();
+	// check if fix is valid and less than 1 hour old, and the clock has been set from it
+	bool synced = _templateFix && lastFix <= 3600000 && timeStatus() != timeNotSet;
+	NtpTimestamp now = nowNtp();
+	_templateSecond = now.seconds - NTP_UNIX_OFFSET;
+	if (synced) {
+		// approx 1 microsecond per second error, always below 1 second for fixes less than 1 hour old
+		uint32_t dispersion = NtpTimestamp::microsToFraction(lastFix / 10000) >> 16;
+
+		//TODO Check for upcoming leap second
+		header[0] = 0b00100100;	// LI, Version, Mode
+		header[1] = 1;			// stratum
+		header[2] = 6;			// polling minimum
+		header[3] = -9;			// precision
+
+		writeUint32(header + 4, 0x000001AE);	// root delay
+		writeUint32(header + 8, dispersion);	// root dispersion
+
+		// Reference Timestamp, time of the last fix
+		uint64_t age = ((uint64_t)(lastFix / 1000) << 32) | NtpTimestamp::microsToFraction((lastFix % 1000) * 1000);
+		NtpTimestamp::fromFixed(now.toFixed() - age).write(header + 16);
+	} else {
+		// Time unknown -- return 0 for all timestamps
+		header[0] = 0b11100100;	// LI, Version, Mode
+		header[1] = 16;			// stratum
+		header[2] = 6;			// polling minimum
+		header[3] = -6;			// precision
+
+		writeUint32(header + 4, 0x000001AE);	// root delay
+		writeUint32(header + 8, 0xFFFFFFFF);	// root dispersion
+		memset(header + 16, 0, 8);
+	}
+	header[12] = 71; //"G";
+	header[13] = 80; //"P";
+	header[14] = 83; //"S";
+	header[15] = 0;  //"0";
+
+	uint32_t seq = _templateSeq;
+	__atomic_store_n(&_templateSeq, seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	memcpy(_template, header, NTP_TEMPLATE_SIZE);
+	_templateSynced = synced;
+	__atomic_store_n(&_templateSeq, seq + 2, __ATOMIC_RELEASE);
+	updateVars(header, synced);
+}
+
+// Everything mode 6 queries answer with, taken along with the template
+void NTPServer::updateVars(const uint8_t* header, bool synced) {
+	uint32_t poll = _templateSecond >> NTP_CONTROL_POLL;
+	if (poll != _reachPoll) {
+		_reachPoll = poll;
+		_reach = (_reach << 1) | (_templateFix ? 1 : 0);
+	}
+	ntp_control_vars_t vars;
+	vars.leap = header[0] >> 6;
+	vars.stratum = header[1];
+	vars.precision = (int8_t)header[3];
+	vars.synced = synced;
+	memcpy(vars.refid, header + 12, 4);
+	vars.refid[4] = 0;
+	vars.rootDelay = readUint32(header + 4);
+	vars.rootDispersion = readUint32(header + 8);
+	vars.reference = NtpTimestamp::read(header + 16);
+	vars.reach = _reach;
+	vars.offset = clockOffset();
+	vars.frequency = clockFrequency();
+	vars.jitter = clockJitter();
+	vars.uptime = millis() / 1000;
+
+	ntp_server_stats_t stats = _stats;
+	uint32_t invalid = 0;
+	for (int i = 0; i < NTP_DROP_REASONS; i++) {
+		invalid += stats.invalid[i];
+	}
+	vars.received = stats.received + stats.dropped + stats.limited + stats.control + invalid;
+	vars.processed = stats.received - stats.authFailed;
+	vars.badFormat = stats.invalid[NTP_DROP_SHORT] + stats.invalid[NTP_DROP_LONG] + stats.invalid[NTP_DROP_MALFORMED];
+	vars.badAuth = stats.authFailed;
+	vars.declined = stats.invalid[NTP_DROP_VERSION] + stats.invalid[NTP_DROP_SERVER] + stats.invalid[NTP_DROP_MODE] + stats.dropped;
+	vars.limited = stats.limited;
+
+	uint32_t seq = _varsSeq;
+	__atomic_store_n(&_varsSeq, seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	memcpy(&_vars, &vars, sizeof(vars));
+	__atomic_store_n(&_varsSeq, seq + 2, __ATOMIC_RELEASE);
+}
+
+void NTPServer::readVars(ntp_control_vars_t& vars) {
+	uint32_t seq;
+	do {
+		seq = __atomic_load_n(&_varsSeq, __ATOMIC_ACQUIRE);
+		memcpy(&vars, &_vars, sizeof(vars));
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	} while ((seq & 1) || seq != __atomic_load_n(&_varsSeq, __ATOMIC_RELAXED));
+	vars.clock = nowNtp();	// with the snapshot, not while the answer is formatted
+}
+
+// Copies the template into the start of reply, returns whether it carries time
+bool NTPServer::readTemplate(uint8_t* reply) {
+	bool synced;
+	uint32_t seq;
+	do {
+		seq = __atomic_load_n(&_templateSeq, __ATOMIC_ACQUIRE);
+		memcpy(reply, _template, NTP_TEMPLATE_SIZE);
+		synced = _templateSynced;
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	} while ((seq & 1) || seq != __atomic_load_n(&_templateSeq, __ATOMIC_RELAXED));
+	return synced;
+}
+
+// Mode 5 packet with no origin or receive timestamp, returns its length or 0 if time is not known
+size_t NTPServer::buildBroadcast(uint8_t* packet) {
+	if (!readTemplate(packet)) {
+		return 0;
+	}
+	packet[0] = (packet[0] & 0xF8) | 5;
+	packet[2] = _broadcastPoll;
+	memset(packet + 24, 0, 16);
+	nowNtp().write(packet + 40);
+	return _broadcastKey >= 0 ? _auth.sign(packet, _broadcastKey) : NTP_PACKET_SIZE;
+}
+
+// Returns true if the reply carries time. request and reply may be the same buffer.
+// previous is what the last reply to this client carried, NULL if it is not known.
+bool NTPServer::buildReply(const uint8_t* request, uint8_t* reply, NtpTimestamp rx, const ntp_client_t* previous) {
+	uint8_t mode = request[0] & 0x07;
+	NtpTimestamp requestOrigin = NtpTimestamp::read(request + 24);
+	// Interleaved mode, as chrony uses it in client/server and symmetric exchanges: the request
+	// echoes the receive timestamp of our previous reply as its origin. The reply then carries
+	// the transmit time of that previous reply, taken after it went out, and the receive
+	// timestamp of the request as its origin. A request with equal receive and transmit
+	// timestamps asks for basic mode.
+	bool interleaved = previous && !requestOrigin.isZero() && !previous->tx.isZero() &&
+					   requestOrigin.toFixed() == previous->rx.toFixed() && memcmp(request + 32, request + 40, 8) != 0;
+	uint8_t origin[8];
+	memcpy(origin, request + (interleaved ? 32 : 40), 8);
+
+	if (!readTemplate(reply)) {
+		memset(reply + NTP_TEMPLATE_SIZE, 0, NTP_PACKET_SIZE - NTP_TEMPLATE_SIZE);
+		return false;
+	}
+	if (mode == 1) {
+		reply[0] = (reply[0] & 0xF8) | 2;	// symmetric passive to active peers
+	}
+
+	//Origin Timestamp
+	memcpy(reply + 24, origin, 8);
+
+	//Receive Timestamp
+	rx.write(reply + 32);
+
+	//Transmit Timestamp
+	(interleaved ? previous->tx : nowNtp()).write(reply + 40);
+	return true;
+}
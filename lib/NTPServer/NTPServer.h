@@ -1,17 +1,172 @@
-#pragma once
-#include <ETHClass.h>
-#include <AsyncUDP.h>
-#include <GPSManager.h>
-
-#define NTP_PORT 123
-
-class NTPServer {
-	public:
-		NTPServer(Stream& serial, GPSManager& gpsManager);
-		~NTPServer();
-
-   private:
-		Stream* _serial;
-		GPSManager* _gpsManager;
-		AsyncUDP* _udp;
+#pragma once
+#include <ETHClass.h>
+#include <GPSManager.h>
+#include <MRUList.h>
+#include <NTPAuth.h>
+#include <NTPControl.h>
+#include <RateLimiter.h>
+#include <RxTimestamp.h>
+#ifdef NTP_SERVER_RAW_LWIP
+#include "lwip/udp.h"
+struct tcpip_api_call_data;
+#else
+#include <AsyncUDP.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#endif
+
+#define NTP_PORT 123
+#define NTP_INTERLEAVED_CLIENTS 256	 // clients remembered for interleaved mode, power of two
+#define NTP_TEMPLATE_SIZE 24			 // reply bytes that only change once a second, up to the origin timestamp
+#define NTP_MAX_REQUEST 128				 // header, extension fields and MAC, longer requests are dropped
+#define NTP_RATE_INTERVAL 1000		 // ms between requests a client may average, once rateLimit() turns limiting on
+#define NTP_RATE_BURST 16				 // requests a client may send back to back
+#define NTP_RATE_KISS_OF_DEATH true		 // answer clients over the limit with KoD RATE instead of dropping them
+#define NTP_BROADCAST_POLL 6				 // broadcast every 2^6 seconds
+#define NTP_BROADCAST_GROUP IPAddress(224, 0, 1, 1)	 // ntp.mcast.net
+#define NTP_BROADCAST_SUBNET IPAddress(255, 255, 255, 255)	 // the Ethernet subnet's broadcast address, looked up for every broadcast
+#define NTP_LATENCY_BUCKETS 13			 // reply latency histogram, 1-2-5 steps from 2 us to 10 ms and one above
+#define NTP_QUEUE_SIZE 16				 // requests waiting for the serving task, power of two
+#define NTP_TASK_CORE 0					 // Arduino loop, GPS and HTTP run on core 1
+#define NTP_TASK_PRIORITY 10			 // above AsyncUDP/AsyncTCP (3) and loop (1), below EMAC (15) and tcpip (18)
+#define NTP_TASK_STACK 4096
+
+// Build with -DNTP_SERVER_RAW_LWIP to serve from a raw lwIP udp_pcb in the tcpip thread,
+// replying in the receive pbuf, instead of from the AsyncUDP task.
+// Otherwise AsyncUDP only stamps and queues requests, and a task pinned to NTP_TASK_CORE replies.
+
+// What the last reply to a client carried and when it really left, for interleaved mode
+typedef struct {
+	uint32_t ip;	  // network byte order, 0 when unused
+	NtpTimestamp rx;  // receive timestamp of the last reply
+	NtpTimestamp tx;  // taken after the last reply was handed to the driver
+} ntp_client_t;
+
+// Why a datagram was dropped before any timestamp work
+typedef enum {
+	NTP_DROP_SHORT,		 // shorter than the header
+	NTP_DROP_LONG,		 // longer than NTP_MAX_REQUEST
+	NTP_DROP_MALFORMED,	 // extension fields and MAC do not add up to the length
+	NTP_DROP_VERSION,	 // version 0 or above 4
+	NTP_DROP_SERVER,	 // server reply or broadcast, answering could start a loop with another server
+	NTP_DROP_MODE,		 // any other mode that is not a request we answer
+	NTP_DROP_REASONS
+} ntp_drop_t;
+
+// Request handed from the AsyncUDP task to the serving task
+typedef struct {
+	uint8_t data[NTP_MAX_REQUEST];
+	uint8_t length;
+	uint8_t macOffset;	// 0 when the request carries no MAC
+	uint32_t ip;		// network byte order
+	uint16_t port;
+	uint64_t received;	// esp_timer time the frame arrived
+} ntp_request_t;
+
+typedef struct {
+	uint32_t received;	  // requests queued for the serving task, or served inline by the raw backend
+	uint32_t dropped;	  // requests dropped because the queue was full
+	uint32_t limited;	  // requests over their client's rate limit, refused before they were queued
+	uint32_t authenticated;	 // requests with a valid MAC, answered with one
+	uint32_t authFailed;	 // requests dropped for an unknown key or a wrong MAC
+	uint32_t broadcasts;	 // mode 5 packets sent
+	uint32_t control;		 // mode 6 queries answered
+	uint32_t queueDepth;  // requests waiting right now
+	uint32_t queueMax;	  // deepest the queue has been
+	uint32_t invalid[NTP_DROP_REASONS];	 // datagrams dropped by the classifier, by reason
+} ntp_server_stats_t;
+
+static const uint32_t NTP_LATENCY_BOUNDS[NTP_LATENCY_BUCKETS - 1] = {2, 5, 10, 20, 50, 100, 200, 500, 1000, 2000, 5000, 10000};
+
+// Reply latency, from the frame arriving to the reply handed to the driver
+typedef struct {
+	uint32_t buckets[NTP_LATENCY_BUCKETS];	// replies up to each of NTP_LATENCY_BOUNDS microseconds, not cumulative, the last bucket is above them all
+	uint64_t sum;							// microseconds
+} ntp_latency_t;
+
+class NTPServer {
+	public:
+		NTPServer(Stream& serial, GPSManager& gpsManager, uint16_t port = NTP_PORT);
+		~NTPServer();
+
+		void loop();  // refreshes the reply template when the second or the fix changes
+		ntp_server_stats_t stats();
+		ntp_latency_t latency();
+		MRUList& mruList();	 // every client that sent a request, rate limited or not
+		// Per client limit, off until set, intervalMillis 0 turns it off again. Clients over it get a
+		// KoD RATE or nothing. Clients behind one NAT address share a limit.
+		void rateLimit(uint32_t intervalMillis, uint32_t burst, bool kissOfDeath);
+		// Symmetric key for authenticated requests, hex as in an ntp.keys file. Add keys before requests arrive.
+		bool addKey(uint32_t id, ntp_key_type_t type, const char* hexKey);
+		// Mode 5 broadcasts to a broadcast address or multicast group, every 2^poll seconds just after the
+		// PPS edge, while the time is synced. keyId signs them with an added key, 0 for none. 0.0.0.0 stops them.
+		// NTP_BROADCAST_SUBNET follows the interface, nothing is sent while it has no address.
+		bool broadcast(IPAddress address, uint8_t poll = NTP_BROADCAST_POLL, uint32_t keyId = 0, uint16_t port = NTP_PORT);
+		// Mode 6 queries for ntpq, off until enabled. Only sources on the Ethernet subnet are answered.
+		void controlQueries(bool enable);
+
+   private:
+		bool buildReply(const uint8_t* request, uint8_t* reply, NtpTimestamp rx, const ntp_client_t* previous);
+		bool limit(uint32_t ip, uint64_t received, const uint8_t* request, uint8_t* reply);
+		ntp_client_t* clientSlot(uint32_t ip);
+		void updateTemplate();
+		bool readTemplate(uint8_t* reply);
+		size_t buildBroadcast(uint8_t* packet);
+		uint32_t broadcastAddress();
+		void sendBroadcast();  // from where replies are sent, for the key's CMAC context
+		void recordLatency(uint64_t received);
+		bool control(uint32_t ip, uint16_t port, const uint8_t* request, size_t length);
+		void updateVars(const uint8_t* header, bool synced);
+		void readVars(ntp_control_vars_t& vars);
+
+		Stream* _serial;
+		GPSManager* _gpsManager;
+		ntp_client_t* _clients;
+		// Published with a seqlock, loop() is the only writer and packet handlers copy it lock free
+		uint8_t _template[NTP_TEMPLATE_SIZE];
+		bool _templateSynced;
+		uint32_t _templateSeq;
+		uint32_t _templateSecond;
+		bool _templateFix;
+		ntp_server_stats_t _stats;	// bumped with relaxed atomics
+		// Published with a seqlock, the 64 bit sum would tear on a 32 bit core
+		ntp_latency_t _latency;
+		uint32_t _latencySeq;
+		RateLimiter _rateLimiter;  // only touched by the packet handler
+		MRUList _mruList;
+		NTPAuth _auth;	// only touched by the task sending replies
+		bool _kissOfDeath;
+		uint32_t _broadcastIp;	// network byte order, 0 when not broadcasting
+		bool _broadcastSubnet;	// _broadcastIp is NTP_BROADCAST_SUBNET, sent to the one loop() last looked up
+		uint16_t _broadcastPort;
+		uint8_t _broadcastPoll;
+		int _broadcastKey;
+		uint32_t _broadcastSecond;
+		NTPControl _control;  // only touched by the packet handler
+		bool _controlEnabled;
+		uint32_t _localIp;	  // network byte order, refreshed by loop() as DHCP can move the interface, 0 when not needed
+		uint32_t _localMask;
+		// Published with a seqlock like the template, mode 6 queries never wait for loop()
+		ntp_control_vars_t _vars;
+		uint32_t _varsSeq;
+		uint8_t _reach;
+		uint32_t _reachPoll;
+#ifdef NTP_SERVER_RAW_LWIP
+		static void receive(void* arg, struct udp_pcb* pcb, struct pbuf* p, const ip_addr_t* addr, u16_t port);
+		static err_t broadcastCall(struct tcpip_api_call_data* call);
+
+		struct udp_pcb* _pcb;
+#else
+		static void serveTask(void* arg);
+		void serve();
+
+		AsyncUDP* _udp;
+		// Single producer (AsyncUDP task), single consumer (serving task) ring
+		ntp_request_t _queue[NTP_QUEUE_SIZE];
+		uint32_t _queueHead;
+		uint32_t _queueTail;
+		TaskHandle_t _task;
+		volatile bool _running;
+		volatile bool _broadcastDue;
+#endif
 };
\ No newline at end of file
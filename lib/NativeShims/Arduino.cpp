@@ -0,0 +1,92 @@
+#include <Arduino.h>
+#include "driver/mcpwm.h"
+#include <time.h>
+#include <unistd.h>
+
+#define NATIVE_PIN_COUNT 64
+
+HardwareSerial Serial;
+
+static void (*interruptHandlers[NATIVE_PIN_COUNT])(void);
+
+static int64_t monotonicMicros() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static const int64_t bootMicros = monotonicMicros();
+
+int64_t esp_timer_get_time() {
+	return monotonicMicros() - bootMicros;
+}
+
+unsigned long millis() {
+	return (unsigned long)(esp_timer_get_time() / 1000);
+}
+
+unsigned long micros() {
+	return (unsigned long)esp_timer_get_time();
+}
+
+void delay(uint32_t ms) {
+	usleep(ms * 1000);
+}
+
+void pinMode(uint8_t pin, uint8_t mode) {
+}
+
+void digitalWrite(uint8_t pin, uint8_t val) {
+}
+
+int digitalRead(uint8_t pin) {
+	return LOW;
+}
+
+void attachInterrupt(uint8_t pin, void (*handler)(void), int mode) {
+	if (pin < NATIVE_PIN_COUNT) {
+		__atomic_store_n(&interruptHandlers[pin], handler, __ATOMIC_RELEASE);
+	}
+}
+
+void detachInterrupt(uint8_t pin) {
+	if (pin < NATIVE_PIN_COUNT) {
+		__atomic_store_n(&interruptHandlers[pin], (void (*)(void))NULL, __ATOMIC_RELEASE);
+	}
+}
+
+void nativeRaiseInterrupt(uint8_t pin) {
+	if (nativeMcpwmEdge(pin)) {
+		return;	 // pin is routed to an MCPWM capture channel
+	}
+	if (pin < NATIVE_PIN_COUNT) {
+		void (*handler)(void) = __atomic_load_n(&interruptHandlers[pin], __ATOMIC_ACQUIRE);
+		if (handler) {
+			handler();
+		}
+	}
+}
+
+void HardwareSerial::begin(unsigned long baud) {
+	setvbuf(stdout, NULL, _IOLBF, 0);
+}
+
+int HardwareSerial::available() {
+	return 0;
+}
+
+int HardwareSerial::read() {
+	return -1;
+}
+
+int HardwareSerial::peek() {
+	return -1;
+}
+
+size_t HardwareSerial::write(uint8_t c) {
+	return fwrite(&c, 1, 1, stdout);
+}
+
+size_t HardwareSerial::write(const uint8_t* buffer, size_t size) {
+	return fwrite(buffer, 1, size, stdout);
+}
@@ -0,0 +1,97 @@
+#pragma once
+// Minimal Arduino core for running the time serving libraries as a Linux process.
+// Only what NTPServer, GPSManager and MicroTime use is provided.
+#include <inttypes.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <algorithm>
+#include "Stream.h"
+
+using std::max;
+using std::min;
+
+typedef bool boolean;
+typedef uint8_t byte;
+
+#define IRAM_ATTR
+#define ICACHE_RAM_ATTR
+
+#define PI 3.1415926535897932384626433832795
+#define HALF_PI 1.5707963267948966192313216916398
+#define TWO_PI 6.283185307179586476925286766559
+#define DEG_TO_RAD 0.017453292519943295769236907684886
+#define RAD_TO_DEG 57.295779513082320876798154814105
+#define radians(deg) ((deg)*DEG_TO_RAD)
+#define degrees(rad) ((rad)*RAD_TO_DEG)
+#define sq(x) ((x) * (x))
+
+#define LOW 0x0
+#define HIGH 0x1
+#define INPUT 0x01
+#define OUTPUT 0x03
+#define INPUT_PULLUP 0x05
+#define INPUT_PULLDOWN 0x09
+#define RISING 0x01
+#define FALLING 0x02
+#define CHANGE 0x03
+
+#define digitalPinToInterrupt(p) (p)
+
+// Monotonic microseconds since process start, stands in for the ESP32 high resolution timer
+int64_t esp_timer_get_time();
+unsigned long millis();
+unsigned long micros();
+void delay(uint32_t ms);
+
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t val);
+int digitalRead(uint8_t pin);
+void attachInterrupt(uint8_t pin, void (*handler)(void), int mode);
+void detachInterrupt(uint8_t pin);
+// Runs the handler attached to pin on the calling thread, as if the pin had triggered it
+void nativeRaiseInterrupt(uint8_t pin);
+
+// Heap use through new and pbuf_alloc, so host tests can check a path neither leaks nor allocates
+typedef struct {
+	uint64_t allocations;  // since start
+	int64_t blocks;		   // allocated and not freed yet
+} native_heap_stats_t;
+
+native_heap_stats_t nativeHeapStats();
+
+// Spinlock standing in for the FreeRTOS critical section mux, there are no interrupts to mask on Linux
+typedef struct {
+	volatile uint32_t owner;
+} portMUX_TYPE;
+
+#define portMUX_INITIALIZER_UNLOCKED {0}
+#define portMUX_INITIALIZE(mux) ((mux)->owner = 0)
+
+static inline void vPortEnterCritical(portMUX_TYPE* mux) {
+	while (__atomic_exchange_n(&mux->owner, 1, __ATOMIC_ACQUIRE)) {
+	}
+}
+
+static inline void vPortExitCritical(portMUX_TYPE* mux) {
+	__atomic_store_n(&mux->owner, 0, __ATOMIC_RELEASE);
+}
+
+#define portENTER_CRITICAL(mux) vPortEnterCritical(mux)
+#define portEXIT_CRITICAL(mux) vPortExitCritical(mux)
+#define portENTER_CRITICAL_ISR(mux) vPortEnterCritical(mux)
+#define portEXIT_CRITICAL_ISR(mux) vPortExitCritical(mux)
+
+class HardwareSerial : public Stream {
+   public:
+	void begin(unsigned long baud);
+	int available() override;
+	int read() override;
+	int peek() override;
+	size_t write(uint8_t c) override;
+	size_t write(const uint8_t* buffer, size_t size) override;
+};
+
+extern HardwareSerial Serial;
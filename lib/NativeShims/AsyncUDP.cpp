@@ -0,0 +1,172 @@
+#include <AsyncUDP.h>
+#include <RxTimestamp.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+AsyncUDPPacket::AsyncUDPPacket(AsyncUDP* udp, uint8_t* data, size_t len, IPAddress remoteIp, uint16_t remotePort, uint16_t localPort) {
+	_udp = udp;
+	_data = data;
+	_len = len;
+	_remoteIp = remoteIp;
+	_remotePort = remotePort;
+	_localPort = localPort;
+}
+
+uint8_t* AsyncUDPPacket::data() {
+	return _data;
+}
+
+size_t AsyncUDPPacket::length() {
+	return _len;
+}
+
+IPAddress AsyncUDPPacket::remoteIP() {
+	return _remoteIp;
+}
+
+uint16_t AsyncUDPPacket::remotePort() {
+	return _remotePort;
+}
+
+uint16_t AsyncUDPPacket::localPort() {
+	return _localPort;
+}
+
+size_t AsyncUDPPacket::write(const uint8_t* data, size_t len) {
+	return _udp->writeTo(data, len, _remoteIp, _remotePort);
+}
+
+AsyncUDP::AsyncUDP() {
+	_fd = -1;
+	_port = 0;
+	_running = false;
+	_queue = new QueuedPacket[ASYNC_UDP_QUEUE_SIZE];
+	_queueHead = 0;
+	_queueTail = 0;
+}
+
+AsyncUDP::~AsyncUDP() {
+	close();
+	delete[] _queue;
+}
+
+bool AsyncUDP::listen(const IPAddress addr, uint16_t port) {
+	close();
+	_fd = socket(AF_INET, SOCK_DGRAM, 0);
+	if (_fd < 0) {
+		return false;
+	}
+	int enable = 1;
+	setsockopt(_fd, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable));
+	setsockopt(_fd, SOL_SOCKET, SO_BROADCAST, &enable, sizeof(enable));
+	struct sockaddr_in sa = {};
+	sa.sin_family = AF_INET;
+	sa.sin_addr.s_addr = (uint32_t)addr;
+	sa.sin_port = htons(port);
+	if (bind(_fd, (struct sockaddr*)&sa, sizeof(sa)) < 0) {
+		::close(_fd);
+		_fd = -1;
+		return false;
+	}
+	_port = port;
+	_running = true;
+	_queueHead = _queueTail = 0;
+	_thread = std::thread(&AsyncUDP::receiveLoop, this);
+	_dispatchThread = std::thread(&AsyncUDP::dispatchLoop, this);
+	return true;
+}
+
+bool AsyncUDP::listen(uint16_t port) {
+	return listen(IPAddress(), port);
+}
+
+void AsyncUDP::close() {
+	if (_fd < 0) {
+		return;
+	}
+	{
+		std::lock_guard<std::mutex> lock(_queueMutex);
+		_running = false;
+	}
+	_queueReady.notify_all();
+	shutdown(_fd, SHUT_RDWR);
+	if (_thread.joinable()) {
+		_thread.join();
+	}
+	if (_dispatchThread.joinable()) {
+		_dispatchThread.join();
+	}
+	::close(_fd);
+	_fd = -1;
+}
+
+void AsyncUDP::onPacket(AuPacketHandlerFunction cb) {
+	_handler = cb;
+}
+
+size_t AsyncUDP::writeTo(const uint8_t* data, size_t len, const IPAddress addr, uint16_t port) {
+	struct sockaddr_in sa = {};
+	sa.sin_family = AF_INET;
+	sa.sin_addr.s_addr = (uint32_t)addr;
+	sa.sin_port = htons(port);
+	ssize_t sent = sendto(_fd, data, len, 0, (struct sockaddr*)&sa, sizeof(sa));
+	return sent < 0 ? 0 : sent;
+}
+
+size_t AsyncUDP::broadcastTo(const uint8_t* data, size_t len, uint16_t port) {
+	return writeTo(data, len, IPAddress(255, 255, 255, 255), port);
+}
+
+AsyncUDP::operator bool() {
+	return _fd >= 0;
+}
+
+void AsyncUDP::receiveLoop() {
+	uint8_t buf[ASYNC_UDP_MAX_PACKET];
+	while (_running) {
+		struct sockaddr_in from;
+		socklen_t fromLen = sizeof(from);
+		ssize_t len = recvfrom(_fd, buf, sizeof(buf), 0, (struct sockaddr*)&from, &fromLen);
+		if (!_running) {
+			break;
+		}
+		if (len < 0) {
+			continue;
+		}
+		rxTimestampPacket(from.sin_addr.s_addr, ntohs(from.sin_port), _port, buf, len, esp_timer_get_time());
+		{
+			std::lock_guard<std::mutex> lock(_queueMutex);
+			if (_queueHead - _queueTail == ASYNC_UDP_QUEUE_SIZE) {
+				continue;  // dropped like a full AsyncUDP queue
+			}
+			QueuedPacket& queued = _queue[_queueHead % ASYNC_UDP_QUEUE_SIZE];
+			memcpy(queued.data, buf, len);
+			queued.len = len;
+			queued.remoteIp = IPAddress((uint32_t)from.sin_addr.s_addr);
+			queued.remotePort = ntohs(from.sin_port);
+			_queueHead++;
+		}
+		_queueReady.notify_one();
+	}
+}
+
+void AsyncUDP::dispatchLoop() {
+	std::unique_lock<std::mutex> lock(_queueMutex);
+	while (true) {
+		_queueReady.wait(lock, [this] { return !_running || _queueHead != _queueTail; });
+		if (!_running) {
+			break;
+		}
+		// the slot is not reused until the tail moves past it
+		QueuedPacket& queued = _queue[_queueTail % ASYNC_UDP_QUEUE_SIZE];
+		lock.unlock();
+		if (_handler) {
+			AsyncUDPPacket packet(this, queued.data, queued.len, queued.remoteIp, queued.remotePort, _port);
+			_handler(packet);
+		}
+		lock.lock();
+		_queueTail++;
+	}
+}
@@ -0,0 +1,77 @@
+#pragma once
+#include <Arduino.h>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include "IPAddress.h"
+
+class AsyncUDP;
+
+// Received datagram, only valid for the duration of the onPacket callback
+class AsyncUDPPacket {
+   public:
+	AsyncUDPPacket(AsyncUDP* udp, uint8_t* data, size_t len, IPAddress remoteIp, uint16_t remotePort, uint16_t localPort);
+
+	uint8_t* data();
+	size_t length();
+	IPAddress remoteIP();
+	uint16_t remotePort();
+	uint16_t localPort();
+	size_t write(const uint8_t* data, size_t len);
+
+   private:
+	AsyncUDP* _udp;
+	uint8_t* _data;
+	size_t _len;
+	IPAddress _remoteIp;
+	uint16_t _remotePort;
+	uint16_t _localPort;
+};
+
+typedef std::function<void(AsyncUDPPacket& packet)> AuPacketHandlerFunction;
+
+#define ASYNC_UDP_QUEUE_SIZE 32
+#define ASYNC_UDP_MAX_PACKET 1500
+
+// AsyncUDP on a POSIX socket. The receive thread stands in for lwIP: it stamps each
+// datagram for RxTimestamp as the Ethernet driver would and queues it, and a dispatch
+// thread delivers the queue to onPacket the same way AsyncUDP's own task does.
+class AsyncUDP {
+   public:
+	AsyncUDP();
+	~AsyncUDP();
+
+	bool listen(const IPAddress addr, uint16_t port);
+	bool listen(uint16_t port);
+	void close();
+	void onPacket(AuPacketHandlerFunction cb);
+
+	size_t writeTo(const uint8_t* data, size_t len, const IPAddress addr, uint16_t port);
+	size_t broadcastTo(const uint8_t* data, size_t len, uint16_t port);
+
+	operator bool();
+
+   private:
+	struct QueuedPacket {
+		uint8_t data[ASYNC_UDP_MAX_PACKET];
+		size_t len;
+		IPAddress remoteIp;
+		uint16_t remotePort;
+	};
+
+	void receiveLoop();
+	void dispatchLoop();
+
+	int _fd;
+	uint16_t _port;
+	volatile bool _running;
+	std::thread _thread;
+	std::thread _dispatchThread;
+	AuPacketHandlerFunction _handler;
+	QueuedPacket* _queue;
+	uint32_t _queueHead;
+	uint32_t _queueTail;
+	std::mutex _queueMutex;
+	std::condition_variable _queueReady;
+};
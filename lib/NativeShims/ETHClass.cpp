@@ -0,0 +1,19 @@
+#include "ETHClass.h"
+
+ETHClass ETH;
+
+IPAddress ETHClass::localIP() {
+	return IPAddress(127, 0, 0, 1);
+}
+
+IPAddress ETHClass::subnetMask() {
+	return IPAddress(255, 0, 0, 0);
+}
+
+IPAddress ETHClass::broadcastIP() {
+	return IPAddress((uint32_t)localIP() | ~(uint32_t)subnetMask());
+}
+
+bool ETHClass::linkUp() {
+	return true;
+}
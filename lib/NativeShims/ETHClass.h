@@ -0,0 +1,13 @@
+#pragma once
+#include "IPAddress.h"
+
+// Stand in for the Ethernet interface, the host network stack owns the real interface
+class ETHClass {
+   public:
+	IPAddress localIP();
+	IPAddress subnetMask();
+	IPAddress broadcastIP();
+	bool linkUp();
+};
+
+extern ETHClass ETH;
@@ -0,0 +1,38 @@
+#pragma once
+#include <inttypes.h>
+
+// Same layout as the Arduino IPAddress, the uint32_t form holds the address in network byte order
+class IPAddress {
+   public:
+	IPAddress() {
+		_address.dword = 0;
+	}
+	IPAddress(uint8_t a, uint8_t b, uint8_t c, uint8_t d) {
+		_address.bytes[0] = a;
+		_address.bytes[1] = b;
+		_address.bytes[2] = c;
+		_address.bytes[3] = d;
+	}
+	IPAddress(uint32_t address) {
+		_address.dword = address;
+	}
+
+	operator uint32_t() const {
+		return _address.dword;
+	}
+	bool operator==(const IPAddress& addr) const {
+		return _address.dword == addr._address.dword;
+	}
+	uint8_t operator[](int index) const {
+		return _address.bytes[index];
+	}
+	uint8_t& operator[](int index) {
+		return _address.bytes[index];
+	}
+
+   private:
+	union {
+		uint8_t bytes[4];
+		uint32_t dword;
+	} _address;
+};
@@ -0,0 +1,57 @@
+#pragma once
+#include <mutex>
+#include "Stream.h"
+
+// Thread safe byte pipe, bytes written on one thread can be read back on another.
+// Used to feed simulated serial devices into code expecting a Stream.
+class LoopbackStream : public Stream {
+   public:
+	LoopbackStream(size_t size = 4096) {
+		_buf = new uint8_t[size];
+		_size = size;
+		_head = 0;
+		_tail = 0;
+	}
+	~LoopbackStream() {
+		delete[] _buf;
+	}
+
+	int available() override {
+		std::lock_guard<std::mutex> lock(_mutex);
+		return (_head + _size - _tail) % _size;
+	}
+
+	int read() override {
+		std::lock_guard<std::mutex> lock(_mutex);
+		if (_head == _tail) {
+			return -1;
+		}
+		uint8_t c = _buf[_tail];
+		_tail = (_tail + 1) % _size;
+		return c;
+	}
+
+	int peek() override {
+		std::lock_guard<std::mutex> lock(_mutex);
+		return _head == _tail ? -1 : _buf[_tail];
+	}
+
+	// Bytes that do not fit are dropped, like a UART FIFO overflowing
+	size_t write(uint8_t c) override {
+		std::lock_guard<std::mutex> lock(_mutex);
+		size_t next = (_head + 1) % _size;
+		if (next == _tail) {
+			return 0;
+		}
+		_buf[_head] = c;
+		_head = next;
+		return 1;
+	}
+
+   private:
+	std::mutex _mutex;
+	uint8_t* _buf;
+	size_t _size;
+	size_t _head;
+	size_t _tail;
+};
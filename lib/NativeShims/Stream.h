@@ -0,0 +1,48 @@
+#pragma once
+#include <inttypes.h>
+#include <stddef.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+
+class Print {
+   public:
+	virtual ~Print() {}
+
+	virtual size_t write(uint8_t c) = 0;
+	virtual size_t write(const uint8_t* buffer, size_t size) {
+		size_t n = 0;
+		while (size--) {
+			n += write(*buffer++);
+		}
+		return n;
+	}
+
+	size_t print(const char* str) {
+		return write((const uint8_t*)str, strlen(str));
+	}
+	size_t println(const char* str) {
+		return print(str) + println();
+	}
+	size_t println() {
+		return print("\r\n");
+	}
+	size_t printf(const char* format, ...) __attribute__((format(printf, 2, 3))) {
+		char buf[256];
+		va_list args;
+		va_start(args, format);
+		int len = vsnprintf(buf, sizeof(buf), format, args);
+		va_end(args);
+		if (len < 0) {
+			return 0;
+		}
+		return write((const uint8_t*)buf, (size_t)len < sizeof(buf) ? len : sizeof(buf) - 1);
+	}
+};
+
+class Stream : public Print {
+   public:
+	virtual int available() = 0;
+	virtual int read() = 0;
+	virtual int peek() = 0;
+};
@@ -0,0 +1,3 @@
+#pragma once
+// Pre 1.0 Arduino header name, included by libraries when ARDUINO is not defined
+#include "Arduino.h"
@@ -0,0 +1,58 @@
+#pragma once
+// MCPWM capture subset of the ESP-IDF 4.4 legacy driver, backed by a simulated
+// 80 MHz capture timer. A capture channel bound to a pin latches the timer when
+// nativeRaiseInterrupt() is called for that pin, then runs its callback after a
+// simulated interrupt dispatch latency.
+#include <inttypes.h>
+#include <stddef.h>
+
+typedef int esp_err_t;
+#define ESP_OK 0
+#define ESP_ERR_INVALID_ARG 0x102
+
+typedef enum {
+	MCPWM_UNIT_0,
+	MCPWM_UNIT_1,
+	MCPWM_UNIT_MAX
+} mcpwm_unit_t;
+
+typedef enum {
+	MCPWM_SELECT_CAP0,
+	MCPWM_SELECT_CAP1,
+	MCPWM_SELECT_CAP2
+} mcpwm_capture_channel_id_t;
+
+typedef enum {
+	MCPWM_CAP_0 = 12,
+	MCPWM_CAP_1,
+	MCPWM_CAP_2
+} mcpwm_io_signals_t;
+
+typedef enum {
+	MCPWM_NEG_EDGE = 1,
+	MCPWM_POS_EDGE = 2,
+	MCPWM_BOTH_EDGE = 3
+} mcpwm_capture_on_edge_t;
+
+typedef struct {
+	mcpwm_capture_on_edge_t cap_edge;
+	uint32_t cap_value;
+} cap_event_data_t;
+
+typedef bool (*cap_isr_cb_t)(mcpwm_unit_t mcpwm, mcpwm_capture_channel_id_t cap_channel, const cap_event_data_t* edata, void* user_data);
+
+typedef struct {
+	mcpwm_capture_on_edge_t cap_edge;
+	uint32_t cap_prescale;
+	cap_isr_cb_t capture_cb;
+	void* user_data;
+} mcpwm_capture_config_t;
+
+esp_err_t mcpwm_gpio_init(mcpwm_unit_t mcpwm_num, mcpwm_io_signals_t io_signal, int gpio_num);
+esp_err_t mcpwm_capture_enable_channel(mcpwm_unit_t mcpwm_num, mcpwm_capture_channel_id_t cap_channel, const mcpwm_capture_config_t* cap_conf);
+esp_err_t mcpwm_capture_disable_channel(mcpwm_unit_t mcpwm_num, mcpwm_capture_channel_id_t cap_channel);
+uint32_t mcpwm_capture_signal_get_value(mcpwm_unit_t mcpwm_num, mcpwm_capture_channel_id_t cap_channel);
+
+// Latches every enabled capture channel bound to pin and runs its callback, returns
+// true if any channel was bound so the caller can skip the GPIO interrupt path
+bool nativeMcpwmEdge(uint8_t pin);
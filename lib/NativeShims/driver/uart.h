@@ -0,0 +1,120 @@
+#pragma once
+// UART subset of the ESP-IDF 4.4 driver. Bytes a simulated device sends with
+// NativeUartPeer land in the port's RX ring buffer, with the same events, pattern
+// positions and overflow handling as the driver's interrupt handler, and what the
+// port writes is kept for the device to read.
+#include <inttypes.h>
+#include <stddef.h>
+#include "Stream.h"
+#include "freertos/queue.h"
+
+typedef int esp_err_t;
+#define ESP_OK 0
+#define ESP_FAIL -1
+#define ESP_ERR_INVALID_ARG 0x102
+#define ESP_ERR_INVALID_STATE 0x103
+
+#define UART_PIN_NO_CHANGE (-1)
+
+typedef enum {
+	UART_NUM_0,
+	UART_NUM_1,
+	UART_NUM_2,
+	UART_NUM_MAX
+} uart_port_t;
+
+typedef enum {
+	UART_DATA_5_BITS,
+	UART_DATA_6_BITS,
+	UART_DATA_7_BITS,
+	UART_DATA_8_BITS
+} uart_word_length_t;
+
+typedef enum {
+	UART_PARITY_DISABLE = 0,
+	UART_PARITY_EVEN = 2,
+	UART_PARITY_ODD = 3
+} uart_parity_t;
+
+typedef enum {
+	UART_STOP_BITS_1 = 1,
+	UART_STOP_BITS_1_5 = 2,
+	UART_STOP_BITS_2 = 3
+} uart_stop_bits_t;
+
+typedef enum {
+	UART_HW_FLOWCTRL_DISABLE
+} uart_hw_flowcontrol_t;
+
+typedef enum {
+	UART_SCLK_APB
+} uart_sclk_t;
+
+typedef struct {
+	int baud_rate;
+	uart_word_length_t data_bits;
+	uart_parity_t parity;
+	uart_stop_bits_t stop_bits;
+	uart_hw_flowcontrol_t flow_ctrl;
+	uint8_t rx_flow_ctrl_thresh;
+	uart_sclk_t source_clk;
+} uart_config_t;
+
+typedef enum {
+	UART_DATA,
+	UART_BREAK,
+	UART_BUFFER_FULL,
+	UART_FIFO_OVF,
+	UART_FRAME_ERR,
+	UART_PARITY_ERR,
+	UART_DATA_BREAK,
+	UART_PATTERN_DET,
+	UART_EVENT_MAX
+} uart_event_type_t;
+
+typedef struct {
+	uart_event_type_t type;
+	size_t size;
+	bool timeout_flag;
+} uart_event_t;
+
+esp_err_t uart_driver_install(uart_port_t uart_num, int rx_buffer_size, int tx_buffer_size, int queue_size, QueueHandle_t* uart_queue, int intr_alloc_flags);
+esp_err_t uart_driver_delete(uart_port_t uart_num);
+esp_err_t uart_param_config(uart_port_t uart_num, const uart_config_t* uart_config);
+esp_err_t uart_set_pin(uart_port_t uart_num, int tx_io_num, int rx_io_num, int rts_io_num, int cts_io_num);
+esp_err_t uart_enable_pattern_det_baud_intr(uart_port_t uart_num, char pattern_chr, uint8_t chr_num, int chr_tout, int post_idle, int pre_idle);
+esp_err_t uart_disable_pattern_det_intr(uart_port_t uart_num);
+esp_err_t uart_pattern_queue_reset(uart_port_t uart_num, int queue_length);
+// Offset of the oldest pattern from the next byte to be read, -1 if none is queued
+int uart_pattern_pop_pos(uart_port_t uart_num);
+int uart_read_bytes(uart_port_t uart_num, void* buf, uint32_t length, TickType_t ticks_to_wait);
+esp_err_t uart_get_buffered_data_len(uart_port_t uart_num, size_t* size);
+esp_err_t uart_flush_input(uart_port_t uart_num);
+int uart_write_bytes(uart_port_t uart_num, const void* src, size_t size);
+
+// Delivers bytes to the RX side of uart_num as if they had been received, returns how many fit
+size_t nativeUartReceive(uart_port_t uart_num, const uint8_t* data, size_t length);
+// Takes up to length bytes uart_num has written, returns how many there were
+size_t nativeUartTransmitted(uart_port_t uart_num, uint8_t* data, size_t length);
+
+// The device on the other end of the wire, what it writes arrives at the port's RX
+class NativeUartPeer : public Print {
+   public:
+	NativeUartPeer(uart_port_t uart) {
+		_uart = uart;
+	}
+
+	size_t write(uint8_t c) override {
+		return nativeUartReceive(_uart, &c, 1);
+	}
+	size_t write(const uint8_t* buffer, size_t size) override {
+		return nativeUartReceive(_uart, buffer, size);
+	}
+	// What the port wrote to the device
+	size_t readBytes(uint8_t* buffer, size_t size) {
+		return nativeUartTransmitted(_uart, buffer, size);
+	}
+
+   private:
+	uart_port_t _uart;
+};
@@ -0,0 +1,160 @@
+#include <pthread.h>
+#include <sched.h>
+#include <string.h>
+#include <unistd.h>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include "freertos/queue.h"
+#include "freertos/task.h"
+
+struct NativeTask {
+	TaskFunction_t function;
+	void* parameters;
+	std::mutex mutex;
+	std::condition_variable notified;
+	uint32_t notifications;
+};
+
+static thread_local NativeTask* currentTask = NULL;
+
+static void runTask(NativeTask* task) {
+	currentTask = task;
+	task->function(task->parameters);
+	// the handle may still be notified by a producer that has not seen the task stop
+}
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t function, const char* name, uint32_t stackDepth, void* parameters,
+								   UBaseType_t priority, TaskHandle_t* createdTask, BaseType_t coreId) {
+	NativeTask* task = new NativeTask();
+	task->function = function;
+	task->parameters = parameters;
+	task->notifications = 0;
+	if (createdTask) {
+		*createdTask = task;
+	}
+	std::thread thread(runTask, task);
+	if (coreId != tskNO_AFFINITY && coreId >= 0 && coreId < sysconf(_SC_NPROCESSORS_ONLN)) {
+		cpu_set_t cpus;
+		CPU_ZERO(&cpus);
+		CPU_SET(coreId, &cpus);
+		pthread_setaffinity_np(thread.native_handle(), sizeof(cpus), &cpus);
+	}
+	pthread_setname_np(thread.native_handle(), name);
+	thread.detach();
+	return pdPASS;
+}
+
+void vTaskDelete(TaskHandle_t task) {
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task) {
+	{
+		std::lock_guard<std::mutex> lock(task->mutex);
+		task->notifications++;
+	}
+	task->notified.notify_one();
+	return pdPASS;
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clearCountOnExit, TickType_t ticksToWait) {
+	NativeTask* task = currentTask;
+	std::unique_lock<std::mutex> lock(task->mutex);
+	auto ready = [task] { return task->notifications != 0; };
+	if (ticksToWait == portMAX_DELAY) {
+		task->notified.wait(lock, ready);
+	} else {
+		task->notified.wait_for(lock, std::chrono::milliseconds(ticksToWait * portTICK_PERIOD_MS), ready);
+	}
+	uint32_t count = task->notifications;
+	if (count != 0) {
+		task->notifications = clearCountOnExit ? 0 : count - 1;
+	}
+	return count;
+}
+
+struct NativeQueue {
+	std::mutex mutex;
+	std::condition_variable changed;
+	uint8_t* items;
+	UBaseType_t length;
+	UBaseType_t itemSize;
+	UBaseType_t head;
+	UBaseType_t count;
+};
+
+// Waits on queue's condition variable until ready, or for ticksToWait
+template <typename Ready>
+static bool waitFor(NativeQueue* queue, std::unique_lock<std::mutex>& lock, TickType_t ticksToWait, Ready ready) {
+	if (ticksToWait == portMAX_DELAY) {
+		queue->changed.wait(lock, ready);
+		return true;
+	}
+	return queue->changed.wait_for(lock, std::chrono::milliseconds(ticksToWait * portTICK_PERIOD_MS), ready);
+}
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t itemSize) {
+	NativeQueue* queue = new NativeQueue();
+	queue->items = new uint8_t[length * itemSize];
+	queue->length = length;
+	queue->itemSize = itemSize;
+	queue->head = 0;
+	queue->count = 0;
+	return queue;
+}
+
+void vQueueDelete(QueueHandle_t queue) {
+	delete[] queue->items;
+	delete queue;
+}
+
+BaseType_t xQueueSend(QueueHandle_t queue, const void* item, TickType_t ticksToWait) {
+	{
+		std::unique_lock<std::mutex> lock(queue->mutex);
+		if (!waitFor(queue, lock, ticksToWait, [queue] { return queue->count < queue->length; })) {
+			return pdFAIL;
+		}
+		UBaseType_t tail = (queue->head + queue->count) % queue->length;
+		memcpy(queue->items + tail * queue->itemSize, item, queue->itemSize);
+		queue->count++;
+	}
+	queue->changed.notify_all();
+	return pdPASS;
+}
+
+BaseType_t xQueueSendFromISR(QueueHandle_t queue, const void* item, BaseType_t* higherPriorityTaskWoken) {
+	if (higherPriorityTaskWoken) {
+		*higherPriorityTaskWoken = pdFALSE;
+	}
+	return xQueueSend(queue, item, 0);
+}
+
+BaseType_t xQueueReceive(QueueHandle_t queue, void* buffer, TickType_t ticksToWait) {
+	{
+		std::unique_lock<std::mutex> lock(queue->mutex);
+		if (!waitFor(queue, lock, ticksToWait, [queue] { return queue->count != 0; })) {
+			return pdFAIL;
+		}
+		memcpy(buffer, queue->items + queue->head * queue->itemSize, queue->itemSize);
+		queue->head = (queue->head + 1) % queue->length;
+		queue->count--;
+	}
+	queue->changed.notify_all();
+	return pdPASS;
+}
+
+BaseType_t xQueueReset(QueueHandle_t queue) {
+	{
+		std::lock_guard<std::mutex> lock(queue->mutex);
+		queue->head = 0;
+		queue->count = 0;
+	}
+	queue->changed.notify_all();
+	return pdPASS;
+}
+
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t queue) {
+	std::lock_guard<std::mutex> lock(queue->mutex);
+	return queue->count;
+}
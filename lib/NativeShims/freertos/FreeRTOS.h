@@ -0,0 +1,17 @@
+#pragma once
+// FreeRTOS types for the native build, tasks are threads
+#include <inttypes.h>
+
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+typedef uint32_t TickType_t;
+
+#define pdFALSE 0
+#define pdTRUE 1
+#define pdPASS 1
+#define pdFAIL 0
+#define portMAX_DELAY 0xFFFFFFFFUL
+#define portTICK_PERIOD_MS 1
+#define configMAX_PRIORITIES 25
+#define tskNO_AFFINITY 0x7FFFFFFF
+#define portYIELD_FROM_ISR(...)  // handlers run on threads, the woken task is already runnable
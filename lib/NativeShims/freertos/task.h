@@ -0,0 +1,14 @@
+#pragma once
+// Task creation and direct to task notifications on threads. Priorities are not
+// applied, the host scheduler does not honour them without real time privileges.
+#include "freertos/FreeRTOS.h"
+
+typedef void (*TaskFunction_t)(void*);
+typedef struct NativeTask* TaskHandle_t;
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t function, const char* name, uint32_t stackDepth, void* parameters,
+								   UBaseType_t priority, TaskHandle_t* createdTask, BaseType_t coreId);
+// Only deleting the calling task is supported, the thread ends when the task function returns
+void vTaskDelete(TaskHandle_t task);
+BaseType_t xTaskNotifyGive(TaskHandle_t task);
+uint32_t ulTaskNotifyTake(BaseType_t clearCountOnExit, TickType_t ticksToWait);
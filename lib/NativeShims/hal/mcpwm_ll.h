@@ -0,0 +1,13 @@
+#pragma once
+// Register level access to the simulated MCPWM capture timer
+#include "driver/mcpwm.h"
+
+typedef struct {
+	mcpwm_unit_t unit;
+} mcpwm_dev_t;
+
+extern mcpwm_dev_t MCPWM0;
+extern mcpwm_dev_t MCPWM1;
+
+void mcpwm_ll_trigger_soft_capture(mcpwm_dev_t* mcpwm, int channel);
+uint32_t mcpwm_ll_capture_get_value(mcpwm_dev_t* mcpwm, int channel);
@@ -0,0 +1,44 @@
+#include <Arduino.h>
+#include <new>
+
+// Replace the global new and delete, the array forms and sized delete land here too.
+// Direct malloc calls are not counted, nothing on the packet path makes one.
+static uint64_t allocations = 0;
+static int64_t blocks = 0;
+
+void* operator new(size_t size) {
+	void* p = malloc(size ? size : 1);
+	if (p == NULL) {
+		throw std::bad_alloc();
+	}
+	__atomic_fetch_add(&allocations, 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&blocks, 1, __ATOMIC_RELAXED);
+	return p;
+}
+
+void* operator new(size_t size, const std::nothrow_t&) noexcept {
+	void* p = malloc(size ? size : 1);
+	if (p != NULL) {
+		__atomic_fetch_add(&allocations, 1, __ATOMIC_RELAXED);
+		__atomic_fetch_add(&blocks, 1, __ATOMIC_RELAXED);
+	}
+	return p;
+}
+
+void operator delete(void* p) noexcept {
+	if (p != NULL) {
+		__atomic_fetch_sub(&blocks, 1, __ATOMIC_RELAXED);
+		free(p);
+	}
+}
+
+void operator delete(void* p, size_t size) noexcept {
+	operator delete(p);
+}
+
+native_heap_stats_t nativeHeapStats() {
+	native_heap_stats_t stats;
+	stats.allocations = __atomic_load_n(&allocations, __ATOMIC_RELAXED);
+	stats.blocks = __atomic_load_n(&blocks, __ATOMIC_RELAXED);
+	return stats;
+}
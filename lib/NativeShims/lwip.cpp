@@ -0,0 +1,149 @@
+#include <Arduino.h>
+#include <RxTimestamp.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <mutex>
+#include <new>
+#include <thread>
+#include "lwip/priv/tcpip_priv.h"
+#include "lwip/udp.h"
+
+#define LWIP_NATIVE_MAX_PACKET 1500
+
+struct udp_pcb {
+	int fd;
+	u16_t port;
+	volatile bool running;
+	udp_recv_fn recv;
+	void* recvArg;
+};
+
+const ip_addr_t ip_addr_any_type = {{{0, 0, 0, 0}}, IPADDR_TYPE_ANY};
+
+static std::mutex coreLock;	 // the tcpip thread context, one raw callback or api call at a time
+
+struct pbuf* pbuf_alloc_native(u16_t length) {
+	// counted by nativeHeapStats() like the lwIP pool it stands in for
+	struct pbuf* p = (struct pbuf*)operator new(sizeof(struct pbuf) + length, std::nothrow);
+	if (p) {
+		p->next = NULL;
+		p->payload = p + 1;
+		p->tot_len = length;
+		p->len = length;
+		p->ref = 1;
+	}
+	return p;
+}
+
+struct pbuf* pbuf_alloc(pbuf_layer layer, u16_t length, pbuf_type type) {
+	return pbuf_alloc_native(length);
+}
+
+u8_t pbuf_free(struct pbuf* p) {
+	if (p && --p->ref == 0) {
+		operator delete(p);
+		return 1;
+	}
+	return 0;
+}
+
+void pbuf_realloc(struct pbuf* p, u16_t new_len) {
+	if (new_len < p->tot_len) {
+		p->tot_len = new_len;
+		p->len = new_len;
+	}
+}
+
+err_t tcpip_api_call(tcpip_api_call_fn fn, struct tcpip_api_call_data* call) {
+	std::lock_guard<std::mutex> lock(coreLock);
+	return fn(call);
+}
+
+static void receiveLoop(struct udp_pcb* pcb) {
+	while (pcb->running) {
+		struct pbuf* p = pbuf_alloc_native(LWIP_NATIVE_MAX_PACKET);
+		struct sockaddr_in from;
+		socklen_t fromLen = sizeof(from);
+		ssize_t len = recvfrom(pcb->fd, p->payload, LWIP_NATIVE_MAX_PACKET, 0, (struct sockaddr*)&from, &fromLen);
+		if (len < 0 || !pcb->running) {
+			pbuf_free(p);
+			continue;
+		}
+		p->tot_len = p->len = (u16_t)len;
+		rxTimestampPacket(from.sin_addr.s_addr, ntohs(from.sin_port), pcb->port, (uint8_t*)p->payload, len, esp_timer_get_time());
+
+		ip_addr_t addr = {};
+		addr.type = IPADDR_TYPE_V4;
+		addr.u_addr.ip4.addr = from.sin_addr.s_addr;
+		std::lock_guard<std::mutex> lock(coreLock);
+		if (pcb->running && pcb->recv) {
+			pcb->recv(pcb->recvArg, pcb, p, &addr, ntohs(from.sin_port));	 // callback owns p
+		} else {
+			pbuf_free(p);
+		}
+	}
+	// udp_remove() only stops the loop, the pcb is released here once nothing can use it
+	close(pcb->fd);
+	delete pcb;
+}
+
+struct udp_pcb* udp_new(void) {
+	struct udp_pcb* pcb = new udp_pcb();
+	pcb->fd = socket(AF_INET, SOCK_DGRAM, 0);
+	if (pcb->fd < 0) {
+		delete pcb;
+		return NULL;
+	}
+	int enable = 1;
+	setsockopt(pcb->fd, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable));
+	return pcb;
+}
+
+void udp_remove(struct udp_pcb* pcb) {
+	if (pcb->running) {
+		pcb->running = false;
+		shutdown(pcb->fd, SHUT_RDWR);
+	} else {
+		close(pcb->fd);
+		delete pcb;
+	}
+}
+
+err_t udp_bind(struct udp_pcb* pcb, const ip_addr_t* ipaddr, u16_t port) {
+	struct sockaddr_in sa = {};
+	sa.sin_family = AF_INET;
+	sa.sin_addr.s_addr = IP_IS_V4(ipaddr) ? ip_2_ip4(ipaddr)->addr : INADDR_ANY;
+	sa.sin_port = htons(port);
+	if (pcb->running || bind(pcb->fd, (struct sockaddr*)&sa, sizeof(sa)) < 0) {
+		return ERR_USE;
+	}
+	pcb->port = port;
+	pcb->running = true;
+	std::thread(receiveLoop, pcb).detach();
+	return ERR_OK;
+}
+
+void udp_set_option_native(struct udp_pcb* pcb, u8_t opt) {
+	if (opt & SOF_BROADCAST) {
+		int enable = 1;
+		setsockopt(pcb->fd, SOL_SOCKET, SO_BROADCAST, &enable, sizeof(enable));
+	}
+}
+
+void udp_recv(struct udp_pcb* pcb, udp_recv_fn recv, void* recv_arg) {
+	pcb->recv = recv;
+	pcb->recvArg = recv_arg;
+}
+
+err_t udp_sendto(struct udp_pcb* pcb, struct pbuf* p, const ip_addr_t* dst_ip, u16_t dst_port) {
+	if (!IP_IS_V4(dst_ip)) {
+		return ERR_VAL;
+	}
+	struct sockaddr_in sa = {};
+	sa.sin_family = AF_INET;
+	sa.sin_addr.s_addr = ip_2_ip4(dst_ip)->addr;
+	sa.sin_port = htons(dst_port);
+	return sendto(pcb->fd, p->payload, p->len, 0, (struct sockaddr*)&sa, sizeof(sa)) < 0 ? ERR_RTE : ERR_OK;
+}
@@ -0,0 +1,30 @@
+#pragma once
+#include "lwip/err.h"
+
+// Dual stack address layout of the ESP-IDF lwIP build, the shim only carries IPv4
+typedef struct ip4_addr {
+	u32_t addr;	 // network byte order
+} ip4_addr_t;
+
+#define IPADDR_TYPE_V4 0U
+#define IPADDR_TYPE_V6 6U
+#define IPADDR_TYPE_ANY 46U
+
+typedef struct ip_addr {
+	union {
+		u32_t ip6[4];
+		ip4_addr_t ip4;
+	} u_addr;
+	u8_t type;
+} ip_addr_t;
+
+extern const ip_addr_t ip_addr_any_type;
+
+#define IP_ANY_TYPE (&ip_addr_any_type)
+#define IP_IS_V4(ipaddr) ((ipaddr)->type == IPADDR_TYPE_V4)
+#define ip_2_ip4(ipaddr) (&((ipaddr)->u_addr.ip4))
+#define ip_addr_set_ip4_u32(ipaddr, val) \
+	do {                                 \
+		(ipaddr)->u_addr.ip4.addr = val; \
+		(ipaddr)->type = IPADDR_TYPE_V4; \
+	} while (0)
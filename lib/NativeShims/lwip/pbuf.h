@@ -0,0 +1,31 @@
+#pragma once
+#include "lwip/err.h"
+
+// Single segment packet buffer, payload follows the struct like a PBUF_RAM pbuf
+struct pbuf {
+	struct pbuf* next;
+	void* payload;
+	u16_t tot_len;
+	u16_t len;
+	u8_t ref;
+};
+
+typedef enum {
+	PBUF_TRANSPORT,
+	PBUF_IP,
+	PBUF_LINK,
+	PBUF_RAW
+} pbuf_layer;
+
+typedef enum {
+	PBUF_RAM,
+	PBUF_ROM,
+	PBUF_REF,
+	PBUF_POOL
+} pbuf_type;
+
+struct pbuf* pbuf_alloc_native(u16_t length);
+// Always a single PBUF_RAM segment, there are no headers to reserve room for
+struct pbuf* pbuf_alloc(pbuf_layer layer, u16_t length, pbuf_type type);
+u8_t pbuf_free(struct pbuf* p);
+void pbuf_realloc(struct pbuf* p, u16_t new_len);  // shrinks only, as lwIP does
@@ -0,0 +1,11 @@
+#pragma once
+#include "lwip/err.h"
+
+struct tcpip_api_call_data {
+	err_t err;
+};
+
+typedef err_t (*tcpip_api_call_fn)(struct tcpip_api_call_data* call);
+
+// Runs fn with the tcpip core lock held, serialized with every raw pcb callback
+err_t tcpip_api_call(tcpip_api_call_fn fn, struct tcpip_api_call_data* call);
@@ -0,0 +1,21 @@
+#pragma once
+// Raw UDP API subset on a POSIX socket. A receive thread per pcb stands in for the
+// tcpip thread: it stamps each datagram for RxTimestamp as the Ethernet driver would
+// and runs the recv callback directly while holding the tcpip core lock.
+#include "lwip/err.h"
+#include "lwip/ip_addr.h"
+#include "lwip/pbuf.h"
+
+struct udp_pcb;
+
+#define SOF_BROADCAST 0x20U	 // permit sending to broadcast addresses
+#define ip_set_option(pcb, opt) udp_set_option_native(pcb, opt)
+
+typedef void (*udp_recv_fn)(void* arg, struct udp_pcb* pcb, struct pbuf* p, const ip_addr_t* addr, u16_t port);
+
+struct udp_pcb* udp_new(void);
+void udp_remove(struct udp_pcb* pcb);
+err_t udp_bind(struct udp_pcb* pcb, const ip_addr_t* ipaddr, u16_t port);
+void udp_recv(struct udp_pcb* pcb, udp_recv_fn recv, void* recv_arg);
+err_t udp_sendto(struct udp_pcb* pcb, struct pbuf* p, const ip_addr_t* dst_ip, u16_t dst_port);
+void udp_set_option_native(struct udp_pcb* pcb, u8_t opt);
@@ -0,0 +1,114 @@
+#include <Arduino.h>
+#include "driver/mcpwm.h"
+#include "hal/mcpwm_ll.h"
+
+#define MCPWM_CAPTURE_CHANNELS 3
+#define MCPWM_TICKS_PER_MICRO 80		  // APB clock
+#define MCPWM_LATENCY_MIN_NANOS 2000	  // simulated interrupt dispatch latency range
+#define MCPWM_LATENCY_MAX_NANOS 30000
+
+typedef struct {
+	bool enabled;
+	bool routed;
+	int pin;
+	uint32_t value;
+	mcpwm_capture_config_t config;
+} capture_channel_t;
+
+mcpwm_dev_t MCPWM0 = {MCPWM_UNIT_0};
+mcpwm_dev_t MCPWM1 = {MCPWM_UNIT_1};
+
+static capture_channel_t channels[MCPWM_UNIT_MAX][MCPWM_CAPTURE_CHANNELS];
+static portMUX_TYPE channelsMux = portMUX_INITIALIZER_UNLOCKED;
+
+static uint64_t monotonicNanos() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// Free running 32 bit capture timer, wraps every 53 seconds like the hardware
+static uint32_t captureTimer() {
+	return (uint32_t)(monotonicNanos() * MCPWM_TICKS_PER_MICRO / 1000);
+}
+
+esp_err_t mcpwm_gpio_init(mcpwm_unit_t mcpwm_num, mcpwm_io_signals_t io_signal, int gpio_num) {
+	if (mcpwm_num >= MCPWM_UNIT_MAX || io_signal < MCPWM_CAP_0 || io_signal > MCPWM_CAP_2) {
+		return ESP_ERR_INVALID_ARG;
+	}
+	portENTER_CRITICAL(&channelsMux);
+	capture_channel_t& channel = channels[mcpwm_num][io_signal - MCPWM_CAP_0];
+	channel.routed = true;
+	channel.pin = gpio_num;
+	portEXIT_CRITICAL(&channelsMux);
+	return ESP_OK;
+}
+
+esp_err_t mcpwm_capture_enable_channel(mcpwm_unit_t mcpwm_num, mcpwm_capture_channel_id_t cap_channel, const mcpwm_capture_config_t* cap_conf) {
+	if (mcpwm_num >= MCPWM_UNIT_MAX || cap_channel > MCPWM_SELECT_CAP2) {
+		return ESP_ERR_INVALID_ARG;
+	}
+	portENTER_CRITICAL(&channelsMux);
+	capture_channel_t& channel = channels[mcpwm_num][cap_channel];
+	channel.config = *cap_conf;
+	channel.enabled = true;
+	portEXIT_CRITICAL(&channelsMux);
+	return ESP_OK;
+}
+
+esp_err_t mcpwm_capture_disable_channel(mcpwm_unit_t mcpwm_num, mcpwm_capture_channel_id_t cap_channel) {
+	if (mcpwm_num >= MCPWM_UNIT_MAX || cap_channel > MCPWM_SELECT_CAP2) {
+		return ESP_ERR_INVALID_ARG;
+	}
+	portENTER_CRITICAL(&channelsMux);
+	channels[mcpwm_num][cap_channel].enabled = false;
+	portEXIT_CRITICAL(&channelsMux);
+	return ESP_OK;
+}
+
+uint32_t mcpwm_capture_signal_get_value(mcpwm_unit_t mcpwm_num, mcpwm_capture_channel_id_t cap_channel) {
+	return mcpwm_ll_capture_get_value(mcpwm_num == MCPWM_UNIT_0 ? &MCPWM0 : &MCPWM1, cap_channel);
+}
+
+void mcpwm_ll_trigger_soft_capture(mcpwm_dev_t* mcpwm, int channel) {
+	__atomic_store_n(&channels[mcpwm->unit][channel].value, captureTimer(), __ATOMIC_RELEASE);
+}
+
+uint32_t mcpwm_ll_capture_get_value(mcpwm_dev_t* mcpwm, int channel) {
+	return __atomic_load_n(&channels[mcpwm->unit][channel].value, __ATOMIC_ACQUIRE);
+}
+
+bool nativeMcpwmEdge(uint8_t pin) {
+	uint32_t value = captureTimer();
+	capture_channel_t* bound[MCPWM_UNIT_MAX * MCPWM_CAPTURE_CHANNELS];
+	mcpwm_unit_t units[MCPWM_UNIT_MAX * MCPWM_CAPTURE_CHANNELS];
+	size_t count = 0;
+	portENTER_CRITICAL(&channelsMux);
+	for (int unit = 0; unit < MCPWM_UNIT_MAX; unit++) {
+		for (int i = 0; i < MCPWM_CAPTURE_CHANNELS; i++) {
+			capture_channel_t& channel = channels[unit][i];
+			if (channel.enabled && channel.routed && channel.pin == pin && (channel.config.cap_edge & MCPWM_POS_EDGE)) {
+				channel.value = value;
+				units[count] = (mcpwm_unit_t)unit;
+				bound[count++] = &channel;
+			}
+		}
+	}
+	portEXIT_CRITICAL(&channelsMux);
+	if (count == 0) {
+		return false;
+	}
+
+	// the hardware latched the edge, the callback runs whenever the interrupt is dispatched
+	uint64_t dispatch = monotonicNanos() + MCPWM_LATENCY_MIN_NANOS + rand() % (MCPWM_LATENCY_MAX_NANOS - MCPWM_LATENCY_MIN_NANOS);
+	while (monotonicNanos() < dispatch) {
+	}
+	for (size_t i = 0; i < count; i++) {
+		capture_channel_t* channel = bound[i];
+		if (channel->config.capture_cb) {
+			cap_event_data_t edata = {MCPWM_POS_EDGE, value};
+			channel->config.capture_cb(units[i], (mcpwm_capture_channel_id_t)(channel - channels[units[i]]), &edata, channel->config.user_data);
+		}
+	}
+	return true;
+}
@@ -0,0 +1,248 @@
+#include <Arduino.h>
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include "driver/uart.h"
+
+#define UART_FIFO_LEN 128  // the driver refuses smaller RX buffers
+
+typedef struct {
+	bool installed;
+	std::mutex mutex;
+	std::condition_variable received;
+	uint8_t* buffer;
+	size_t size;
+	size_t head;	 // next byte to read
+	size_t count;	 // bytes buffered
+	bool full;		 // UART_BUFFER_FULL was posted and nothing has been read since
+	QueueHandle_t events;
+	int pattern;	 // pattern character, -1 when detection is off
+	std::deque<uint64_t> patterns;	// stream offsets of detected patterns, oldest first
+	size_t patternsMax;
+	uint64_t receivedTotal;			// bytes ever stored in the buffer
+	uint64_t readTotal;				// bytes ever taken out of it
+	std::deque<uint8_t> transmitted;	// written by the port, not yet read by the device
+} native_uart_t;
+
+static native_uart_t ports[UART_NUM_MAX];
+
+static bool valid(uart_port_t uart_num) {
+	return uart_num >= UART_NUM_0 && uart_num < UART_NUM_MAX && ports[uart_num].installed;
+}
+
+static void post(native_uart_t& port, uart_event_type_t type, size_t size) {
+	if (port.events) {
+		uart_event_t event = {type, size, false};
+		xQueueSendFromISR(port.events, &event, NULL);
+	}
+}
+
+esp_err_t uart_driver_install(uart_port_t uart_num, int rx_buffer_size, int tx_buffer_size, int queue_size, QueueHandle_t* uart_queue, int intr_alloc_flags) {
+	if (uart_num < UART_NUM_0 || uart_num >= UART_NUM_MAX || rx_buffer_size <= UART_FIFO_LEN) {
+		return ESP_ERR_INVALID_ARG;
+	}
+	native_uart_t& port = ports[uart_num];
+	std::lock_guard<std::mutex> lock(port.mutex);
+	if (port.installed) {
+		return ESP_FAIL;
+	}
+	port.buffer = new uint8_t[rx_buffer_size];
+	port.size = rx_buffer_size;
+	port.head = 0;
+	port.count = 0;
+	port.full = false;
+	port.events = NULL;
+	if (uart_queue && queue_size > 0) {
+		port.events = xQueueCreate(queue_size, sizeof(uart_event_t));
+		*uart_queue = port.events;
+	}
+	port.pattern = -1;
+	port.patterns.clear();
+	port.patternsMax = 0;
+	port.receivedTotal = 0;
+	port.readTotal = 0;
+	port.transmitted.clear();
+	port.installed = true;
+	return ESP_OK;
+}
+
+esp_err_t uart_driver_delete(uart_port_t uart_num) {
+	if (!valid(uart_num)) {
+		return ESP_FAIL;
+	}
+	native_uart_t& port = ports[uart_num];
+	std::lock_guard<std::mutex> lock(port.mutex);
+	delete[] port.buffer;
+	if (port.events) {
+		vQueueDelete(port.events);
+	}
+	port.installed = false;
+	return ESP_OK;
+}
+
+esp_err_t uart_param_config(uart_port_t uart_num, const uart_config_t* uart_config) {
+	return uart_num >= UART_NUM_0 && uart_num < UART_NUM_MAX && uart_config ? ESP_OK : ESP_ERR_INVALID_ARG;
+}
+
+esp_err_t uart_set_pin(uart_port_t uart_num, int tx_io_num, int rx_io_num, int rts_io_num, int cts_io_num) {
+	return uart_num >= UART_NUM_0 && uart_num < UART_NUM_MAX ? ESP_OK : ESP_ERR_INVALID_ARG;
+}
+
+esp_err_t uart_enable_pattern_det_baud_intr(uart_port_t uart_num, char pattern_chr, uint8_t chr_num, int chr_tout, int post_idle, int pre_idle) {
+	if (!valid(uart_num) || chr_num != 1) {
+		return ESP_ERR_INVALID_ARG;	 // repeated pattern characters are not simulated
+	}
+	native_uart_t& port = ports[uart_num];
+	std::lock_guard<std::mutex> lock(port.mutex);
+	port.pattern = (uint8_t)pattern_chr;
+	return ESP_OK;
+}
+
+esp_err_t uart_disable_pattern_det_intr(uart_port_t uart_num) {
+	if (!valid(uart_num)) {
+		return ESP_FAIL;
+	}
+	native_uart_t& port = ports[uart_num];
+	std::lock_guard<std::mutex> lock(port.mutex);
+	port.pattern = -1;
+	return ESP_OK;
+}
+
+esp_err_t uart_pattern_queue_reset(uart_port_t uart_num, int queue_length) {
+	if (!valid(uart_num)) {
+		return ESP_ERR_INVALID_STATE;
+	}
+	native_uart_t& port = ports[uart_num];
+	std::lock_guard<std::mutex> lock(port.mutex);
+	port.patterns.clear();
+	port.patternsMax = queue_length;
+	return ESP_OK;
+}
+
+int uart_pattern_pop_pos(uart_port_t uart_num) {
+	if (!valid(uart_num)) {
+		return -1;
+	}
+	native_uart_t& port = ports[uart_num];
+	std::lock_guard<std::mutex> lock(port.mutex);
+	// patterns that were flushed or read past are gone, like the driver updating its queue on read
+	while (!port.patterns.empty() && port.patterns.front() < port.readTotal) {
+		port.patterns.pop_front();
+	}
+	if (port.patterns.empty()) {
+		return -1;
+	}
+	int pos = (int)(port.patterns.front() - port.readTotal);
+	port.patterns.pop_front();
+	return pos;
+}
+
+int uart_read_bytes(uart_port_t uart_num, void* buf, uint32_t length, TickType_t ticks_to_wait) {
+	if (!valid(uart_num) || buf == NULL) {
+		return -1;
+	}
+	native_uart_t& port = ports[uart_num];
+	std::unique_lock<std::mutex> lock(port.mutex);
+	auto ready = [&port, length] { return port.count >= length; };
+	if (ticks_to_wait == portMAX_DELAY) {
+		port.received.wait(lock, ready);
+	} else if (ticks_to_wait != 0) {
+		port.received.wait_for(lock, std::chrono::milliseconds(ticks_to_wait * portTICK_PERIOD_MS), ready);
+	}
+	size_t n = min((size_t)length, port.count);
+	for (size_t i = 0; i < n; i++) {
+		((uint8_t*)buf)[i] = port.buffer[(port.head + i) % port.size];
+	}
+	port.head = (port.head + n) % port.size;
+	port.count -= n;
+	port.readTotal += n;
+	if (n > 0) {
+		port.full = false;
+	}
+	return (int)n;
+}
+
+esp_err_t uart_get_buffered_data_len(uart_port_t uart_num, size_t* size) {
+	if (!valid(uart_num)) {
+		return ESP_FAIL;
+	}
+	native_uart_t& port = ports[uart_num];
+	std::lock_guard<std::mutex> lock(port.mutex);
+	*size = port.count;
+	return ESP_OK;
+}
+
+esp_err_t uart_flush_input(uart_port_t uart_num) {
+	if (!valid(uart_num)) {
+		return ESP_FAIL;
+	}
+	native_uart_t& port = ports[uart_num];
+	std::lock_guard<std::mutex> lock(port.mutex);
+	port.readTotal += port.count;
+	port.head = 0;
+	port.count = 0;
+	port.full = false;
+	port.patterns.clear();
+	return ESP_OK;
+}
+
+int uart_write_bytes(uart_port_t uart_num, const void* src, size_t size) {
+	if (!valid(uart_num) || src == NULL) {
+		return -1;
+	}
+	native_uart_t& port = ports[uart_num];
+	std::lock_guard<std::mutex> lock(port.mutex);
+	port.transmitted.insert(port.transmitted.end(), (const uint8_t*)src, (const uint8_t*)src + size);
+	return (int)size;
+}
+
+size_t nativeUartReceive(uart_port_t uart_num, const uint8_t* data, size_t length) {
+	if (!valid(uart_num)) {
+		return 0;
+	}
+	native_uart_t& port = ports[uart_num];
+	size_t stored;
+	{
+		std::lock_guard<std::mutex> lock(port.mutex);
+		stored = min(length, port.size - port.count);
+		size_t patterns = 0;
+		for (size_t i = 0; i < stored; i++) {
+			port.buffer[(port.head + port.count + i) % port.size] = data[i];
+			if (data[i] == port.pattern) {
+				// the driver logs and drops the position when its queue is full, the event still goes out
+				if (port.patterns.size() < port.patternsMax) {
+					port.patterns.push_back(port.receivedTotal + i);
+				}
+				patterns++;
+			}
+		}
+		port.count += stored;
+		port.receivedTotal += stored;
+		if (stored > 0) {
+			post(port, UART_DATA, stored);
+		}
+		for (size_t i = 0; i < patterns; i++) {
+			post(port, UART_PATTERN_DET, 0);
+		}
+		if (stored < length && !port.full) {
+			port.full = true;
+			post(port, UART_BUFFER_FULL, 0);
+		}
+	}
+	port.received.notify_all();
+	return stored;
+}
+
+size_t nativeUartTransmitted(uart_port_t uart_num, uint8_t* data, size_t length) {
+	if (!valid(uart_num)) {
+		return 0;
+	}
+	native_uart_t& port = ports[uart_num];
+	std::lock_guard<std::mutex> lock(port.mutex);
+	size_t n = min(length, port.transmitted.size());
+	std::copy(port.transmitted.begin(), port.transmitted.begin() + n, data);
+	port.transmitted.erase(port.transmitted.begin(), port.transmitted.begin() + n);
+	return n;
+}
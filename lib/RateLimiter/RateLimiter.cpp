@@ -0,0 +1,73 @@
+#include <RateLimiter.h>
+#include <string.h>
+
+RateLimiter::RateLimiter() {
+	_entries = new rate_limit_entry_t[1 << RATE_LIMIT_BITS]();
+	_interval = 0;
+	_limit = 0;
+	_stats = {};
+}
+
+RateLimiter::~RateLimiter() {
+	delete[] _entries;
+}
+
+void RateLimiter::configure(uint32_t intervalMicros, uint32_t burst) {
+	// Entries are kept, those further ahead than the new limit read as stale
+	_interval = intervalMicros;
+	_limit = intervalMicros * (burst > 0 ? burst : 1);
+}
+
+bool RateLimiter::allow(uint32_t ip, uint32_t nowMicros) {
+	if (_interval == 0 || ip == 0) {
+		return true;
+	}
+	uint32_t index = (uint32_t)(ip * 2654435761UL) >> (32 - RATE_LIMIT_BITS);
+	rate_limit_entry_t* free = NULL;
+	rate_limit_entry_t* victim = NULL;
+	int32_t victimAhead = 0;
+	for (uint32_t i = 0; i < RATE_LIMIT_PROBES; i++) {
+		rate_limit_entry_t* entry = &_entries[(index + i) & ((1 << RATE_LIMIT_BITS) - 1)];
+		// How long until the bucket is full again. Further ahead than the limit can only be a
+		// 32 bit wrap after a long silence, which is as good as full.
+		int32_t ahead = (int32_t)(entry->due - nowMicros);
+		bool stale = ahead <= 0 || (uint32_t)ahead > _limit;
+		if (entry->ip == ip) {
+			if (stale) {
+				ahead = 0;
+			} else if ((uint32_t)ahead > _limit - _interval) {
+				_stats.limited++;
+				return false;
+			}
+			entry->due = nowMicros + ahead + _interval;
+			return true;
+		}
+		if (entry->ip == 0) {
+			// slots are never emptied again, so ip cannot be further along
+			if (!free) {
+				free = entry;
+			}
+			break;
+		}
+		if (stale) {
+			if (!free) {
+				free = entry;
+			}
+		} else if (!victim || ahead < victimAhead) {
+			victim = entry;
+			victimAhead = ahead;
+		}
+	}
+	if (!free) {
+		// every source in the window is still limited, forget the one closest to being full
+		free = victim;
+		_stats.evicted++;
+	}
+	free->ip = ip;
+	free->due = nowMicros + _interval;
+	return true;
+}
+
+rate_limiter_stats_t RateLimiter::stats() {
+	return _stats;
+}
@@ -0,0 +1,40 @@
+#pragma once
+#include <inttypes.h>
+
+#define RATE_LIMIT_BITS 10	  // table of 2^10 sources, 8 KB
+#define RATE_LIMIT_PROBES 8	  // slots searched for a source before one is evicted
+
+// Per source address rate limiting in a fixed size, open addressed table. Each source
+// keeps only the time its bucket is next due to be full (GCRA), so an entry is 8 bytes
+// and ages out by itself: once that time has passed the slot can be handed to another
+// source. Not thread safe, one task should do all the lookups.
+
+typedef struct {
+	uint32_t limited;	// requests refused
+	uint32_t evicted;	// sources pushed out of a full probe window while still limited
+} rate_limiter_stats_t;
+
+class RateLimiter {
+	public:
+		RateLimiter();
+		~RateLimiter();
+
+		// Allow burst requests at once and one per intervalMicros on average, 0 disables limiting.
+		// burst * intervalMicros has to stay below 2^31 microseconds.
+		void configure(uint32_t intervalMicros, uint32_t burst);
+		// Charges a request from ip, network byte order, at nowMicros, false if it is over its limit.
+		// Address 0 is never limited.
+		bool allow(uint32_t ip, uint32_t nowMicros);
+		rate_limiter_stats_t stats();
+
+	private:
+		typedef struct {
+			uint32_t ip;   // 0 when never used
+			uint32_t due;  // microseconds, when the source's bucket is full again
+		} rate_limit_entry_t;
+
+		rate_limit_entry_t* _entries;
+		uint32_t _interval;
+		uint32_t _limit;  // burst * interval, how far ahead of now due may run
+		rate_limiter_stats_t _stats;
+};
@@ -0,0 +1,156 @@
+#include <RxTimestamp.h>
+
+#define RX_TIMESTAMP_ENTRIES 32		   // stamps awaiting their packet, more than the AsyncUDP queue holds
+#define RX_TIMESTAMP_KEY_OFFSET 40	   // NTP transmit timestamp, unique per request from a client
+#define RX_TIMESTAMP_STATS_SHIFT 4	   // delay average time constant, 2^4 packets
+#define RX_TIMESTAMP_MIN_LENGTH 48	   // NTP header, anything shorter is never answered
+#define ETH_HEADER_SIZE 14
+#define ETH_TYPE_IPV4 0x0800
+#define ETH_TYPE_VLAN 0x8100
+#define IP_PROTOCOL_UDP 17
+#define UDP_HEADER_SIZE 8
+
+typedef struct {
+	bool valid;
+	uint32_t srcIp;
+	uint16_t srcPort;
+	uint64_t key;
+	uint64_t localMicros;
+} rx_timestamp_t;
+
+static rx_timestamp_t entries[RX_TIMESTAMP_ENTRIES];
+static uint32_t nextEntry = 0;
+static uint16_t listenPort = 0;
+static rx_timestamp_stats_t stats = {};
+static uint32_t delayMean = 0;	// delay mean << RX_TIMESTAMP_STATS_SHIFT
+static portMUX_TYPE entriesMux = portMUX_INITIALIZER_UNLOCKED;
+
+static inline uint16_t readUint16(const uint8_t* buf) {
+	return ((uint16_t)buf[0] << 8) | buf[1];
+}
+
+static inline uint64_t readKey(const uint8_t* payload, size_t len) {
+	uint64_t key = 0;
+	if (len >= RX_TIMESTAMP_KEY_OFFSET + 8) {
+		memcpy(&key, payload + RX_TIMESTAMP_KEY_OFFSET, 8);
+	}
+	return key;
+}
+
+// Only requests that can be answered are stamped, mode 6 queries and anything else on the port
+// would never be looked up and would push out stamps that are
+static inline bool stamped(const uint8_t* payload, size_t len) {
+	uint8_t mode = len >= RX_TIMESTAMP_MIN_LENGTH ? payload[0] & 0x07 : 0;
+	return mode == 3 || mode == 1;
+}
+
+// Removes the newest stamp of the packet, newest first so a retransmitted request matches its
+// latest copy. Call with entriesMux held.
+static bool take(IPAddress srcIp, uint16_t srcPort, const uint8_t* payload, size_t len, uint64_t& localMicros) {
+	uint64_t key = readKey(payload, len);
+	uint32_t ip = (uint32_t)srcIp;
+	for (uint32_t i = 1; i <= RX_TIMESTAMP_ENTRIES; i++) {
+		rx_timestamp_t& entry = entries[(nextEntry + RX_TIMESTAMP_ENTRIES - i) % RX_TIMESTAMP_ENTRIES];
+		if (entry.valid && entry.key == key && entry.srcPort == srcPort && entry.srcIp == ip) {
+			entry.valid = false;
+			localMicros = entry.localMicros;
+			return true;
+		}
+	}
+	return false;
+}
+
+void rxTimestampListen(uint16_t port) {
+	portENTER_CRITICAL(&entriesMux);
+	listenPort = port;
+	memset(entries, 0, sizeof(entries));
+	portEXIT_CRITICAL(&entriesMux);
+}
+
+void rxTimestampFrame(const uint8_t* frame, size_t len, uint64_t localMicros) {
+	if (len < ETH_HEADER_SIZE + 20 + UDP_HEADER_SIZE) {
+		return;
+	}
+	size_t offset = ETH_HEADER_SIZE;
+	uint16_t type = readUint16(frame + 12);
+	if (type == ETH_TYPE_VLAN) {
+		type = readUint16(frame + 16);
+		offset += 4;
+	}
+	if (type != ETH_TYPE_IPV4 || len < offset + 20 + UDP_HEADER_SIZE) {
+		return;
+	}
+	const uint8_t* ip = frame + offset;
+	size_t ipHeader = (ip[0] & 0x0F) * 4;
+	// IPv4 UDP, and not a fragment, only the first fragment carries the UDP header
+	if ((ip[0] >> 4) != 4 || ipHeader < 20 || ip[9] != IP_PROTOCOL_UDP || (readUint16(ip + 6) & 0x3FFF) != 0) {
+		return;
+	}
+	if (len < offset + ipHeader + UDP_HEADER_SIZE) {
+		return;
+	}
+	const uint8_t* udp = ip + ipHeader;
+	size_t udpLen = readUint16(udp + 4);
+	if (udpLen < UDP_HEADER_SIZE || len < offset + ipHeader + udpLen) {
+		return;
+	}
+	uint32_t srcIp;
+	memcpy(&srcIp, ip + 12, 4);
+	rxTimestampPacket(srcIp, readUint16(udp), readUint16(udp + 2), udp + UDP_HEADER_SIZE, udpLen - UDP_HEADER_SIZE, localMicros);
+}
+
+void rxTimestampPacket(uint32_t srcIp, uint16_t srcPort, uint16_t dstPort, const uint8_t* payload, size_t len, uint64_t localMicros) {
+	if (dstPort == 0 || dstPort != __atomic_load_n(&listenPort, __ATOMIC_RELAXED) || !stamped(payload, len)) {
+		return;
+	}
+	uint64_t key = readKey(payload, len);
+	portENTER_CRITICAL(&entriesMux);
+	rx_timestamp_t& entry = entries[nextEntry];
+	nextEntry = (nextEntry + 1) % RX_TIMESTAMP_ENTRIES;
+	if (entry.valid) {
+		stats.overwritten++;
+	}
+	entry.valid = true;
+	entry.srcIp = srcIp;
+	entry.srcPort = srcPort;
+	entry.key = key;
+	entry.localMicros = localMicros;
+	stats.stamped++;
+	portEXIT_CRITICAL(&entriesMux);
+}
+
+bool rxTimestampLookup(IPAddress srcIp, uint16_t srcPort, const uint8_t* payload, size_t len, uint64_t& localMicros) {
+	portENTER_CRITICAL(&entriesMux);
+	bool found = take(srcIp, srcPort, payload, len, localMicros);
+	if (found) {
+		uint32_t queued = (uint32_t)(esp_timer_get_time() - localMicros);
+		if (stats.matched++ == 0) {
+			delayMean = queued << RX_TIMESTAMP_STATS_SHIFT;
+		}
+		stats.delay = queued;
+		stats.delayMax = max(stats.delayMax, queued);
+		delayMean += queued - (delayMean >> RX_TIMESTAMP_STATS_SHIFT);
+		stats.delayMean = delayMean >> RX_TIMESTAMP_STATS_SHIFT;
+	} else {
+		stats.unmatched++;
+	}
+	portEXIT_CRITICAL(&entriesMux);
+	return found;
+}
+
+void rxTimestampDiscard(IPAddress srcIp, uint16_t srcPort, const uint8_t* payload, size_t len) {
+	if (!stamped(payload, len)) {
+		return;
+	}
+	uint64_t localMicros;
+	portENTER_CRITICAL(&entriesMux);
+	take(srcIp, srcPort, payload, len, localMicros);
+	portEXIT_CRITICAL(&entriesMux);
+}
+
+rx_timestamp_stats_t rxTimestampStats() {
+	portENTER_CRITICAL(&entriesMux);
+	rx_timestamp_stats_t copy = stats;
+	portEXIT_CRITICAL(&entriesMux);
+	return copy;
+}
@@ -0,0 +1,30 @@
+#pragma once
+#include <Arduino.h>
+#include <IPAddress.h>
+
+// Receive timestamps taken below AsyncUDP. The Ethernet driver stamps client and symmetric
+// mode requests to a listening port as they come off the EMAC, before lwIP and the AsyncUDP
+// task queue, and the packet handler looks the stamp up again by sender and payload. Stamps are
+// esp_timer_get_time() microseconds, the same clock as micros64().
+
+// Queueing delay from the driver stamp to the packet handler, in microseconds
+typedef struct {
+	uint32_t stamped;	   // frames stamped by the driver
+	uint32_t matched;	   // packets that found their stamp
+	uint32_t unmatched;	   // packets without a stamp, timestamped late by the handler
+	uint32_t overwritten;  // stamps evicted before their packet was handled
+	uint32_t delay;		   // last packet
+	uint32_t delayMax;
+	uint32_t delayMean;
+} rx_timestamp_stats_t;
+
+void rxTimestampListen(uint16_t port);	 // stamp UDP frames addressed to port, 0 to stop
+// Ethernet frame as passed to the driver input path
+void rxTimestampFrame(const uint8_t* frame, size_t len, uint64_t localMicros);
+// UDP datagram already taken apart, addresses in network byte order
+void rxTimestampPacket(uint32_t srcIp, uint16_t srcPort, uint16_t dstPort, const uint8_t* payload, size_t len, uint64_t localMicros);
+// Removes and returns the stamp of a received packet, false if it was not stamped
+bool rxTimestampLookup(IPAddress srcIp, uint16_t srcPort, const uint8_t* payload, size_t len, uint64_t& localMicros);
+// Removes the stamp of a packet dropped unanswered, so it does not push out stamps still awaited
+void rxTimestampDiscard(IPAddress srcIp, uint16_t srcPort, const uint8_t* payload, size_t len);
+rx_timestamp_stats_t rxTimestampStats();
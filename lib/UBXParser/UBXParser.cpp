@@ -0,0 +1,244 @@
+#include <UBXParser.h>
+#include <string.h>
+
+#define UBX_NAV_PVT_LENGTH 24  // bytes used, 84 on protocol 14 receivers and 92 from protocol 15 on
+#define UBX_NAV_TIMEUTC_LENGTH 20
+#define UBX_TIM_TP_LENGTH 16
+#define UBX_ACK_LENGTH 2
+
+#define UBX_PVT_VALID 0x07		 // validDate, validTime and fullyResolved
+#define UBX_TIMEUTC_VALID 0x07	 // validTOW, validWKN and validUTC
+#define UBX_PVT_FIX_OK 0x01
+#define UBX_TP_QERR_INVALID 0x10
+#define UBX_TP_TIME_BASE_UTC 0x01
+
+enum {
+	UBX_STATE_IDLE,
+	UBX_STATE_SYNC,
+	UBX_STATE_CLASS,
+	UBX_STATE_ID,
+	UBX_STATE_LENGTH_LOW,
+	UBX_STATE_LENGTH_HIGH,
+	UBX_STATE_PAYLOAD,
+	UBX_STATE_CHECK_A,
+	UBX_STATE_CHECK_B
+};
+
+// Little endian fields, byte by byte as payloads are not aligned
+static uint16_t u16(const uint8_t* p) {
+	return p[0] | p[1] << 8;
+}
+
+static uint32_t u32(const uint8_t* p) {
+	return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+UBXParser::UBXParser() {
+	_state = UBX_STATE_IDLE;
+	_class = 0;
+	_id = 0;
+	_length = 0;
+	_received = 0;
+	_checkA = 0;
+	_checkB = 0;
+	_frameA = 0;
+	_time = {};
+	_timePulse = {};
+	_fixType = 0;
+	_fixOK = false;
+	_satellites = 0;
+	_acknowledged = 0;
+	_stats = {};
+}
+
+ubx_message_t UBXParser::encode(uint8_t c) {
+	switch (_state) {
+	case UBX_STATE_IDLE:
+		if (c != UBX_SYNC1) {
+			return UBX_NONE;
+		}
+		_state = UBX_STATE_SYNC;
+		_stats.chars++;
+		return UBX_PENDING;
+	case UBX_STATE_SYNC:
+		if (c != UBX_SYNC2) {
+			// a stray first sync byte, this one may start an NMEA sentence or another frame
+			_state = UBX_STATE_IDLE;
+			return encode(c);
+		}
+		_state = UBX_STATE_CLASS;
+		_checkA = 0;
+		_checkB = 0;
+		_stats.chars++;
+		return UBX_PENDING;
+	case UBX_STATE_CHECK_A:
+		_frameA = c;
+		_state = UBX_STATE_CHECK_B;
+		_stats.chars++;
+		return UBX_PENDING;
+	case UBX_STATE_CHECK_B:
+		_state = UBX_STATE_IDLE;
+		_stats.chars++;
+		if (_frameA != _checkA || c != _checkB) {
+			_stats.failed++;
+			return UBX_FAILED;
+		}
+		_stats.passed++;
+		return decode();
+	}
+
+	// the rest of the header and the payload are covered by the 8-bit Fletcher checksum
+	_stats.chars++;
+	_checkA += c;
+	_checkB += _checkA;
+	switch (_state) {
+	case UBX_STATE_CLASS:
+		_class = c;
+		_state = UBX_STATE_ID;
+		break;
+	case UBX_STATE_ID:
+		_id = c;
+		_state = UBX_STATE_LENGTH_LOW;
+		break;
+	case UBX_STATE_LENGTH_LOW:
+		_length = c;
+		_state = UBX_STATE_LENGTH_HIGH;
+		break;
+	case UBX_STATE_LENGTH_HIGH:
+		_length |= c << 8;
+		_received = 0;
+		if (_length > UBX_LENGTH_MAX) {
+			// most likely lost bytes made a length out of something else, look for the next frame
+			_stats.failed++;
+			_state = UBX_STATE_IDLE;
+			return UBX_FAILED;
+		}
+		_state = _length > 0 ? UBX_STATE_PAYLOAD : UBX_STATE_CHECK_A;
+		break;
+	case UBX_STATE_PAYLOAD:
+		if (_received < UBX_PAYLOAD_SIZE) {
+			_payload[_received] = c;
+		}
+		if (++_received == _length) {
+			_state = UBX_STATE_CHECK_A;
+		}
+		break;
+	}
+	return UBX_PENDING;
+}
+
+ubx_message_t UBXParser::decode() {
+	const uint8_t* p = _payload;
+	switch (_class << 8 | _id) {
+	case UBX_CLASS_NAV << 8 | UBX_ID_NAV_PVT:
+		if (_length < UBX_NAV_PVT_LENGTH) {
+			return UBX_OTHER;
+		}
+		decodeTime(p, true);
+		_fixType = p[20];
+		_fixOK = p[21] & UBX_PVT_FIX_OK;
+		_satellites = p[23];
+		return UBX_NAV_PVT;
+	case UBX_CLASS_NAV << 8 | UBX_ID_NAV_TIMEUTC:
+		if (_length != UBX_NAV_TIMEUTC_LENGTH) {
+			return UBX_OTHER;
+		}
+		decodeTime(p, false);
+		return UBX_NAV_TIMEUTC;
+	case UBX_CLASS_TIM << 8 | UBX_ID_TIM_TP:
+		if (_length != UBX_TIM_TP_LENGTH) {
+			return UBX_OTHER;
+		}
+		_timePulse.towMillis = u32(p);
+		_timePulse.qErr = (int32_t)u32(p + 8);
+		_timePulse.week = u16(p + 12);
+		_timePulse.qErrValid = !(p[14] & UBX_TP_QERR_INVALID);
+		_timePulse.utc = p[14] & UBX_TP_TIME_BASE_UTC;
+		return UBX_TIM_TP;
+	case UBX_CLASS_ACK << 8 | UBX_ID_ACK_ACK:
+	case UBX_CLASS_ACK << 8 | UBX_ID_ACK_NAK:
+		if (_length != UBX_ACK_LENGTH) {
+			return UBX_OTHER;
+		}
+		_acknowledged = p[0] << 8 | p[1];
+		return _id == UBX_ID_ACK_ACK ? UBX_ACK_ACK : UBX_ACK_NAK;
+	default:
+		return UBX_OTHER;
+	}
+}
+
+// NAV-PVT and NAV-TIMEUTC carry the same fields at different offsets
+void UBXParser::decodeTime(const uint8_t* p, bool pvt) {
+	const uint8_t* date = pvt ? p + 4 : p + 12;
+	_time.year = u16(date);
+	_time.month = date[2];
+	_time.day = date[3];
+	_time.hour = date[4];
+	_time.minute = date[5];
+	_time.second = date[6];
+	uint8_t valid = date[7];
+	_time.accuracy = u32(pvt ? p + 12 : p + 4);
+	_time.nanos = (int32_t)u32(pvt ? p + 16 : p + 8);
+	_time.valid = pvt ? (valid & UBX_PVT_VALID) == UBX_PVT_VALID : (valid & UBX_TIMEUTC_VALID) == UBX_TIMEUTC_VALID;
+}
+
+size_t UBXParser::frame(uint8_t messageClass, uint8_t id, const uint8_t* payload, uint16_t length, uint8_t* buffer, size_t size) {
+	if (size < (size_t)length + UBX_FRAME_OVERHEAD) {
+		return 0;
+	}
+	buffer[0] = UBX_SYNC1;
+	buffer[1] = UBX_SYNC2;
+	buffer[2] = messageClass;
+	buffer[3] = id;
+	buffer[4] = length & 0xFF;
+	buffer[5] = length >> 8;
+	memcpy(buffer + 6, payload, length);
+	uint8_t a = 0, b = 0;
+	for (size_t i = 2; i < (size_t)length + 6; i++) {
+		a += buffer[i];
+		b += a;
+	}
+	buffer[length + 6] = a;
+	buffer[length + 7] = b;
+	return length + UBX_FRAME_OVERHEAD;
+}
+
+ubx_time_t UBXParser::time() {
+	return _time;
+}
+
+ubx_timepulse_t UBXParser::timePulse() {
+	return _timePulse;
+}
+
+uint8_t UBXParser::fixType() {
+	return _fixType;
+}
+
+bool UBXParser::fixOK() {
+	return _fixOK;
+}
+
+uint8_t UBXParser::satellites() {
+	return _satellites;
+}
+
+uint16_t UBXParser::acknowledged() {
+	return _acknowledged;
+}
+
+uint16_t UBXParser::message() {
+	return _class << 8 | _id;
+}
+
+const uint8_t* UBXParser::payload() {
+	return _payload;
+}
+
+uint16_t UBXParser::length() {
+	return _length;
+}
+
+ubx_stats_t UBXParser::stats() {
+	return _stats;
+}
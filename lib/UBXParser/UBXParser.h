@@ -0,0 +1,109 @@
+#pragma once
+#include <inttypes.h>
+#include <stddef.h>
+
+#define UBX_PAYLOAD_SIZE 96	  // payload bytes kept, NAV-PVT is 92, longer messages are only checksummed
+#define UBX_LENGTH_MAX 1024	  // a longer frame is taken to be a corrupted header
+#define UBX_FRAME_OVERHEAD 8  // sync, class, id, length and checksum
+
+#define UBX_SYNC1 0xB5
+#define UBX_SYNC2 0x62
+#define UBX_CLASS_NAV 0x01
+#define UBX_CLASS_ACK 0x05
+#define UBX_CLASS_CFG 0x06
+#define UBX_CLASS_TIM 0x0D
+#define UBX_ID_NAV_PVT 0x07
+#define UBX_ID_NAV_TIMEUTC 0x21
+#define UBX_ID_ACK_NAK 0x00
+#define UBX_ID_ACK_ACK 0x01
+#define UBX_ID_CFG_MSG 0x01
+#define UBX_ID_TIM_TP 0x01
+
+// Decodes the u-blox UBX binary messages the clock uses: NAV-PVT and NAV-TIMEUTC for the
+// time and fix, TIM-TP for the quantization error of the next PPS edge, and ACK for
+// configuration. Bytes come one at a time through encode(), which tells whether each was
+// part of a frame, so NMEA sentences interleaved on the same port can go to NMEAParser.
+// frame() builds the messages that configure the receiver. Not thread safe.
+
+typedef enum {
+	UBX_NONE,	   // the byte was not part of a frame
+	UBX_PENDING,   // the byte was part of a frame still being received
+	UBX_FAILED,	   // the byte completed a frame with a bad checksum
+	UBX_NAV_PVT,
+	UBX_NAV_TIMEUTC,
+	UBX_TIM_TP,
+	UBX_ACK_ACK,
+	UBX_ACK_NAK,
+	UBX_OTHER  // a good frame that is not decoded
+} ubx_message_t;
+
+// UTC of a navigation epoch, from NAV-PVT or NAV-TIMEUTC
+typedef struct {
+	uint16_t year;
+	uint8_t month;
+	uint8_t day;
+	uint8_t hour;
+	uint8_t minute;
+	uint8_t second;		// up to 60 for a leap second
+	int32_t nanos;		// fraction of the second, negative when the epoch is just before it
+	uint32_t accuracy;	// nanos, the receiver's estimate
+	bool valid;			// date and time known and UTC fully resolved, leap seconds included
+} ubx_time_t;
+
+// TIM-TP, sent ahead of the time pulse it describes
+typedef struct {
+	uint32_t towMillis;	 // time of week of the next pulse, in the time base below
+	uint16_t week;		 // weeks since the GPS epoch, in the same time base
+	int32_t qErr;		 // picoseconds the next pulse will be late, it is output on a receiver clock tick
+	bool qErrValid;
+	bool utc;			 // towMillis and week count UTC, otherwise GPS time, which is ahead by the leap seconds
+} ubx_timepulse_t;
+
+typedef struct {
+	uint32_t chars;	   // bytes in frames
+	uint32_t passed;   // frames with a good checksum
+	uint32_t failed;   // frames with a bad checksum or an impossible length
+} ubx_stats_t;
+
+class UBXParser {
+	public:
+		UBXParser();
+
+		// Feeds one byte, returns whether it belonged to a frame and what the frame it completes was
+		ubx_message_t encode(uint8_t c);
+		// Builds a frame with its sync bytes and checksum into buffer, returns its length or 0 if it does not fit
+		static size_t frame(uint8_t messageClass, uint8_t id, const uint8_t* payload, uint16_t length, uint8_t* buffer, size_t size);
+
+		ubx_time_t time();				 // from the last NAV-PVT or NAV-TIMEUTC
+		ubx_timepulse_t timePulse();	 // from the last TIM-TP
+		uint8_t fixType();				 // NAV-PVT, 0 none, 2 2D, 3 3D, 5 time only
+		bool fixOK();					 // NAV-PVT, the fix is within the receiver's accuracy limits
+		uint8_t satellites();			 // NAV-PVT satellites used
+		uint16_t acknowledged();		 // class << 8 | id of the message the last ACK-ACK or ACK-NAK answered
+		// The frame encode() just completed, until the next byte is fed
+		uint16_t message();			 // class << 8 | id
+		const uint8_t* payload();	 // up to UBX_PAYLOAD_SIZE bytes of it
+		uint16_t length();			 // of the whole payload
+		ubx_stats_t stats();
+
+	private:
+		ubx_message_t decode();
+		void decodeTime(const uint8_t* p, bool pvt);
+
+		uint8_t _state;
+		uint8_t _class;
+		uint8_t _id;
+		uint16_t _length;
+		uint16_t _received;
+		uint8_t _checkA;
+		uint8_t _checkB;
+		uint8_t _frameA;  // checksum bytes as received
+		uint8_t _payload[UBX_PAYLOAD_SIZE];
+		ubx_time_t _time;
+		ubx_timepulse_t _timePulse;
+		uint8_t _fixType;
+		bool _fixOK;
+		uint8_t _satellites;
+		uint16_t _acknowledged;
+		ubx_stats_t _stats;
+};
@@ -1,149 +1,431 @@
-#include <WiFi.h>
-#include <ESPmDNS.h>
-#include <WiFiUdp.h>
-#include <ETHClass.h>           //Is to use the modified ETHClass
-#include <AsyncTCP.h>
-#include <ESPAsyncWebServer.h>
-#include <AsyncElegantOTA.h>
-#include <SoftwareSerial.h>
-#include <NTPServer.h>
-#include <GPSManager.h>
-#include "pindefinitions.h"     //Board PinMap
-#include "secrets.h"            // OTA_USERNAME and OTA_PASSWORD definitions
-
-#define GPS_PPS_PIN 12
-#define GPS_RX_PIN 14
-#define GPS_TX_PIN 15
-
-#define MONITOR_UART_BPS 115200
-#define GPS_UART_BPS 115200
-
-// Define OTA_USERNAME and OTA_PASSWORD in "secrets.h"
-#define HOSTNAME "esp32-ntpserver-1"
-
-void wifiEvent(WiFiEvent_t event);
-
-AsyncWebServer server(80);
-static bool eth_connected = false;
-EspSoftwareSerial::UART gpsSerial;
-
-GPSManager* gpsManager;
-NTPServer* ntpServer;
-
-void setup() {
-  Serial.begin(MONITOR_UART_BPS);
-  Serial.println("Booting " HOSTNAME "...");
-
-  gpsSerial.begin(GPS_UART_BPS, SWSERIAL_8N1, GPS_RX_PIN, GPS_TX_PIN, false);
-  if (!gpsSerial) {
-    Serial.println("Invalid GPS serial config");
-  }
-
-  WiFi.onEvent(wifiEvent);
-
-#ifdef ETH_POWER_PIN
-  pinMode(ETH_POWER_PIN, OUTPUT);
-  digitalWrite(ETH_POWER_PIN, HIGH);
-#endif
-
-#if CONFIG_IDF_TARGET_ESP32
-  if (!ETH.begin(ETH_ADDR, ETH_RESET_PIN, ETH_MDC_PIN, ETH_MDIO_PIN, ETH_TYPE, ETH_CLK_MODE)) {
-    Serial.println("Ethernet failed to start!");
-  }
-#else
-  if (!ETH.beginSPI(ETH_MISO_PIN, ETH_MOSI_PIN, ETH_SCLK_PIN, ETH_CS_PIN, ETH_RST_PIN, ETH_INT_PIN)) {
-    Serial.println("Ethernet failed to start!");
-  }
-#endif
-
-  AsyncElegantOTA.begin(&server, OTA_USERNAME, OTA_PASSWORD);
-
-  while (!eth_connected) {
-    Serial.println("Wait for network to connect...");
-    delay(500);
-  }
-
-  if (MDNS.begin(HOSTNAME)) {
-    Serial.println("mDNS responder started");
-  }
-
-  server.on("/", HTTP_GET, [](AsyncWebServerRequest* request) {
-    request->send(200, "text/html", "<!DOCTYPE html><title>" HOSTNAME "</title><h1>" HOSTNAME "</h1><p><a href='/update'>Update</a></p><p><a href='/status'>Status</a></p>");
-    });
-
-  server.on("/status", HTTP_GET, [](AsyncWebServerRequest* request) {
-    String timestr = "No Fix";
-    if (gpsManager->validFix()) {
-      uint32_t micros = 0;
-      time_t time = now(micros);
-      timestr =  String(day(time)) + "-" + String(month(time)) + "-" + String(year(time)) + " " + String(hour(time)) + ":" + String(minute(time)) + ":" + String(second(time)) + "." + (micros % 1000000);
-    }
-    request->send(200, "text/html", "<!DOCTYPE html><title>" HOSTNAME "</title><h1>" HOSTNAME " Status</h1><p>GPS Time: " + timestr + "</p>");
-    });
-
-  server.onNotFound([](AsyncWebServerRequest* request) {
-    String message = "URL: ";
-    message += request->url();
-    message += "<br />Method: ";
-    message += (request->method() == HTTP_GET) ? "GET" : "POST";
-    message += "<br />Arguments: ";
-    message += request->args();
-    message += "<br />";
-    for (uint8_t i = 0; i < request->args(); i++) {
-      message += " " + request->argName(i) + ": " + request->arg(i) + "<br />";
-    }
-    request->send(404, "text/html", "<!DOCTYPE html><title>" HOSTNAME "</title><h1>404 - File Not Found</h1><p>" + message + "</p>");
-    });
-
-  server.begin();
-  Serial.println("HTTP server started");
-  gpsManager = new GPSManager(gpsSerial, GPS_PPS_PIN);
-  Serial.println("GPS manager started");
-  ntpServer = new NTPServer(Serial, *gpsManager);
-  Serial.println("NTP server started");
-
-  Serial.println("Ready");
-}
-
-void loop() {
-  gpsManager->loop();
-}
-
-void wifiEvent(WiFiEvent_t event) {
-  switch (event) {
-  case ARDUINO_EVENT_ETH_START:
-    Serial.println("Ethernet started");
-    //set eth hostname here
-    ETH.setHostname(HOSTNAME);
-    break;
-  case ARDUINO_EVENT_ETH_CONNECTED:
-    Serial.println("Ethernet connected");
-    break;
-  case ARDUINO_EVENT_ETH_GOT_IP:
-    Serial.print("Ethernet MAC: ");
-    Serial.print(ETH.macAddress());
-    Serial.print(", IPv4: ");
-    Serial.print(ETH.localIP());
-    if (ETH.fullDuplex()) {
-      Serial.print(", FULL_DUPLEX");
-    }
-    Serial.print(", ");
-    Serial.print(ETH.linkSpeed());
-    Serial.print("Mbps");
-    Serial.print(", ");
-    Serial.print("Gateway IP:");
-    Serial.println(ETH.gatewayIP());
-    eth_connected = true;
-    break;
-  case ARDUINO_EVENT_ETH_DISCONNECTED:
-    Serial.println("Ethernet disconnected");
-    eth_connected = false;
-    break;
-  case ARDUINO_EVENT_ETH_STOP:
-    Serial.println("Ethernet stopped");
-    eth_connected = false;
-    break;
-  default:
-    break;
-  }
+#include <WiFi.h>
+#include <ESPmDNS.h>
+#include <WiFiUdp.h>
+#include <ETHClass.h>           //Is to use the modified ETHClass
+#include <AsyncTCP.h>
+#include <ESPAsyncWebServer.h>
+#include <AsyncElegantOTA.h>
+#include <SoftwareSerial.h>
+#include <NTPServer.h>
+#include <GPSManager.h>
+#include "pindefinitions.h"     //Board PinMap
+#include "secrets.h"            // OTA_USERNAME and OTA_PASSWORD definitions
+
+#define GPS_UART UART_NUM_1  // pins are set per board in pindefinitions.h
+// #define GPS_SOFTWARE_SERIAL  // bit-banged receive on the same pins, for comparing against the UART
+#define GPS_PPS_MODE PPS_INTERRUPT  // PPS_CAPTURE latches the edge in the MCPWM capture unit
+#define GPS_UBX  // configure a u-blox receiver for UBX time and PPS quantization error, comment out for NMEA only
+// #define NTP_BROADCAST_ADDRESS NTP_BROADCAST_SUBNET  // mode 5 broadcasts to the Ethernet subnet, or NTP_BROADCAST_GROUP to multicast
+// #define NTP_CONTROL  // answer ntpq (mode 6) queries from the local subnet
+// #define NTP_RATE_LIMIT  // limit each client address, too strict for many clients behind one NAT address
+
+#define MONITOR_UART_BPS 115200
+#define GPS_UART_BPS 115200
+
+// Define OTA_USERNAME and OTA_PASSWORD in "secrets.h"
+#define HOSTNAME "esp32-ntpserver-1"
+
+void wifiEvent(WiFiEvent_t event);
+void sendMetrics(AsyncWebServerRequest* request);
+
+AsyncWebServer server(80);
+static bool eth_connected = false;
+#ifdef GPS_SOFTWARE_SERIAL
+EspSoftwareSerial::UART gpsSerial;
+#endif
+
+GPSManager* gpsManager;
+NTPServer* ntpServer;
+
+// Pages are formatted into this buffer instead of concatenating Strings, which took a heap
+// allocation for every piece. All handlers run in the AsyncTCP task, and a page this size is
+// copied into the TCP send buffer (5744 bytes) within send(), so the next request can reuse it.
+static char page[2048];
+static size_t pageLength;
+
+static void pageBegin() {
+  pageLength = 0;
+  page[0] = 0;
+}
+
+// Appends to the page, cutting it off when it is full
+static void pageAppend(const char* format, ...) {
+  va_list args;
+  va_start(args, format);
+  int len = vsnprintf(page + pageLength, sizeof(page) - pageLength, format, args);
+  va_end(args);
+  if (len > 0) {
+    pageLength += len;
+    if (pageLength >= sizeof(page)) {
+      pageLength = sizeof(page) - 1;
+    }
+  }
+}
+
+static void pageSend(AsyncWebServerRequest* request, int code, const char* contentType) {
+  request->send(request->beginResponse_P(code, contentType, (const uint8_t*)page, pageLength));
+}
+
+void setup() {
+  Serial.begin(MONITOR_UART_BPS);
+  Serial.println("Booting " HOSTNAME "...");
+
+  WiFi.onEvent(wifiEvent);
+
+#ifdef ETH_POWER_PIN
+  pinMode(ETH_POWER_PIN, OUTPUT);
+  digitalWrite(ETH_POWER_PIN, HIGH);
+#endif
+
+#if CONFIG_IDF_TARGET_ESP32
+  if (!ETH.begin(ETH_ADDR, ETH_RESET_PIN, ETH_MDC_PIN, ETH_MDIO_PIN, ETH_TYPE, ETH_CLK_MODE)) {
+    Serial.println("Ethernet failed to start!");
+  }
+#else
+  if (!ETH.beginSPI(ETH_MISO_PIN, ETH_MOSI_PIN, ETH_SCLK_PIN, ETH_CS_PIN, ETH_RST_PIN, ETH_INT_PIN)) {
+    Serial.println("Ethernet failed to start!");
+  }
+#endif
+
+  AsyncElegantOTA.begin(&server, OTA_USERNAME, OTA_PASSWORD);
+
+  while (!eth_connected) {
+    Serial.println("Wait for network to connect...");
+    delay(500);
+  }
+
+  if (MDNS.begin(HOSTNAME)) {
+    Serial.println("mDNS responder started");
+  }
+
+  server.on("/", HTTP_GET, [](AsyncWebServerRequest* request) {
+    request->send(200, "text/html", "<!DOCTYPE html><title>" HOSTNAME "</title><h1>" HOSTNAME "</h1><p><a href='/update'>Update</a></p><p><a href='/status'>Status</a></p><p><a href='/clients'>Clients</a></p><p><a href='/metrics'>Metrics</a></p><p><a href='/api/status'>Status JSON</a></p>");
+    });
+
+  server.on("/status", HTTP_GET, [](AsyncWebServerRequest* request) {
+    pageBegin();
+    pageAppend("<!DOCTYPE html><title>" HOSTNAME "</title><h1>" HOSTNAME " Status</h1><p>GPS Time: ");
+    if (gpsManager->validFix()) {
+      uint32_t micros = 0;
+      time_t time = now(micros);
+      pageAppend("%d-%d-%d %d:%d:%d.%06u</p>", day(time), month(time), year(time), hour(time), minute(time), second(time), micros % 1000000);
+    } else {
+      pageAppend("No Fix</p>");
+    }
+    pps_stats_t pps = ppsStats();
+    pageAppend("<p>PPS: %u of %u edges accepted, %u outliers, %u missed, %u extra, interval median %d ns, jitter %u ns</p>",
+      pps.accepted, pps.edges, pps.outliers, pps.missed, pps.extra, pps.intervalMedian, pps.intervalJitter);
+    if (pps.corrected > 0) {
+      pageAppend("<p>PPS quantization error: %u edges corrected, last by %d ns</p>", pps.corrected, pps.correction);
+    }
+    pps_capture_stats_t stats = gpsManager->captureStats();
+    if (stats.edges > 0) {
+      pageAppend("<p>PPS capture latency: %u ns mean, %u ns jitter, %u-%u ns over %u edges</p>",
+        stats.latencyMean, stats.latencyJitter, stats.latencyMin, stats.latencyMax, stats.edges);
+    }
+    rx_timestamp_stats_t rx = rxTimestampStats();
+    pageAppend("<p>NTP receive queueing: %u us mean, %u us max, %u stamped, %u unstamped, %u evicted</p>",
+      rx.delayMean, rx.delayMax, rx.matched, rx.unmatched, rx.overwritten);
+    ntp_server_stats_t ntp = ntpServer->stats();
+    pageAppend("<p>NTP requests: %u served, %u dropped, %u rate limited, %u authenticated, %u failed authentication, %u broadcasts, %u control queries, queue %u deep, %u max</p>",
+      ntp.received, ntp.dropped, ntp.limited, ntp.authenticated, ntp.authFailed, ntp.broadcasts, ntp.control, ntp.queueDepth, ntp.queueMax);
+    pageAppend("<p>NTP invalid datagrams: %u short, %u long, %u malformed, %u bad version, %u from servers, %u bad mode</p>",
+      ntp.invalid[NTP_DROP_SHORT], ntp.invalid[NTP_DROP_LONG], ntp.invalid[NTP_DROP_MALFORMED],
+      ntp.invalid[NTP_DROP_VERSION], ntp.invalid[NTP_DROP_SERVER], ntp.invalid[NTP_DROP_MODE]);
+    pageSend(request, 200, "text/html");
+    });
+
+  server.on("/api/status", HTTP_GET, [](AsyncWebServerRequest* request) {
+    static const char* const timeStatuses[] = {"notSet", "needsSync", "set"};
+    uint32_t micros = 0;
+    time_t time = now(micros);
+    bool fix = gpsManager->validFix();
+    gps_stats_t gps = gpsManager->stats();
+    pps_stats_t pps = ppsStats();
+    pps_capture_stats_t capture = gpsManager->captureStats();
+    rx_timestamp_stats_t rx = rxTimestampStats();
+    ntp_server_stats_t ntp = ntpServer->stats();
+    pageBegin();
+    pageAppend("{\"time\":{\"unix\":%u,\"micros\":%u,\"status\":\"%s\"},", (uint32_t)time, micros, timeStatuses[timeStatus()]);
+    pageAppend("\"gps\":{\"fix\":%s,\"fixAge\":", fix ? "true" : "false");
+    if (fix) {
+      pageAppend("%u", gpsManager->lastFix());
+    } else {
+      pageAppend("null");
+    }
+    pageAppend(",\"bytes\":%u,\"sentences\":%u,\"checksumErrors\":%u,\"sentencesWithFix\":%u,\"overflows\":%u,\"droppedBytes\":%u,\"taskWakeups\":%u,\"taskBusy\":%llu,",
+      gps.chars, gps.passed, gps.failed, gps.withFix, gps.overflows, gps.dropped, gps.wakeups, gps.busy);
+    pageAppend("\"ubxFrames\":%u,\"ubxChecksumErrors\":%u,\"ubxConfigured\":%u},", gps.ubxPassed, gps.ubxFailed, gps.configured);
+    pageAppend("\"clock\":{\"offset\":%d,\"frequency\":%.3f,\"jitter\":%u},", clockOffset(), clockFrequency(), clockJitter());
+    pageAppend("\"pps\":{\"edges\":%u,\"accepted\":%u,\"outliers\":%u,\"missed\":%u,\"extra\":%u,\"overflows\":%u,\"intervalMedian\":%d,\"intervalJitter\":%u,\"corrected\":%u,\"correction\":%d",
+      pps.edges, pps.accepted, pps.outliers, pps.missed, pps.extra, pps.overflows, pps.intervalMedian, pps.intervalJitter, pps.corrected, pps.correction);
+    if (capture.edges > 0) {
+      pageAppend(",\"capture\":{\"edges\":%u,\"latencyMean\":%u,\"latencyJitter\":%u,\"latencyMin\":%u,\"latencyMax\":%u}",
+        capture.edges, capture.latencyMean, capture.latencyJitter, capture.latencyMin, capture.latencyMax);
+    }
+    pageAppend("},\"rx\":{\"stamped\":%u,\"matched\":%u,\"unmatched\":%u,\"overwritten\":%u,\"delayMean\":%u,\"delayMax\":%u},",
+      rx.stamped, rx.matched, rx.unmatched, rx.overwritten, rx.delayMean, rx.delayMax);
+    pageAppend("\"ntp\":{\"received\":%u,\"answered\":%u,\"dropped\":%u,\"limited\":%u,\"authenticated\":%u,\"authFailed\":%u,\"broadcasts\":%u,\"control\":%u,\"queueDepth\":%u,\"queueMax\":%u,",
+      ntp.received, ntp.received - ntp.authFailed, ntp.dropped, ntp.limited, ntp.authenticated, ntp.authFailed, ntp.broadcasts, ntp.control, ntp.queueDepth, ntp.queueMax);
+    pageAppend("\"invalid\":{\"short\":%u,\"long\":%u,\"malformed\":%u,\"version\":%u,\"server\":%u,\"mode\":%u}},",
+      ntp.invalid[NTP_DROP_SHORT], ntp.invalid[NTP_DROP_LONG], ntp.invalid[NTP_DROP_MALFORMED],
+      ntp.invalid[NTP_DROP_VERSION], ntp.invalid[NTP_DROP_SERVER], ntp.invalid[NTP_DROP_MODE]);
+    pageAppend("\"heap\":{\"free\":%u,\"minFree\":%u,\"maxAlloc\":%u}}", ESP.getFreeHeap(), ESP.getMinFreeHeap(), ESP.getMaxAllocHeap());
+    pageSend(request, 200, "application/json");
+    });
+
+  server.on("/clients", HTTP_GET, [](AsyncWebServerRequest* request) {
+    // Copied out first so the NTP handler is only held up for the copy, not the formatting
+    mru_entry_t* clients = new mru_entry_t[MRU_ENTRIES];
+    size_t count = ntpServer->mruList().snapshot(clients, MRU_ENTRIES);
+    uint64_t now = esp_timer_get_time();
+    AsyncResponseStream* response = request->beginResponseStream("text/html");
+    response->print("<!DOCTYPE html><title>" HOSTNAME "</title><h1>" HOSTNAME " Clients</h1>");
+    response->printf("<p>%u clients, %u evicted</p>", count, ntpServer->mruList().evicted());
+    response->print("<table><tr><th>Address</th><th>Port</th><th>Mode</th><th>Version</th><th>Count</th><th>Avg interval (s)</th><th>Last seen (s ago)</th><th>First seen (s ago)</th></tr>");
+    for (size_t i = 0; i < count; i++) {
+      mru_entry_t* client = &clients[i];
+      response->printf("<tr><td>%s</td><td>%u</td><td>%u</td><td>%u</td><td>%u</td><td>%.1f</td><td>%.1f</td><td>%.1f</td></tr>",
+        IPAddress(client->ip).toString().c_str(), client->port, client->mode, client->version, client->count,
+        client->interval / 1e6, (now - client->last) / 1e6, (now - client->first) / 1e6);
+    }
+    response->print("</table>");
+    delete[] clients;
+    request->send(response);
+    });
+
+  server.on("/metrics", HTTP_GET, sendMetrics);
+
+  server.onNotFound([](AsyncWebServerRequest* request) {
+    pageBegin();
+    pageAppend("<!DOCTYPE html><title>" HOSTNAME "</title><h1>404 - File Not Found</h1><p>URL: %s<br />Method: %s<br />Arguments: %u<br />",
+      request->url().c_str(), (request->method() == HTTP_GET) ? "GET" : "POST", request->args());
+    for (uint8_t i = 0; i < request->args(); i++) {
+      pageAppend(" %s: %s<br />", request->argName(i).c_str(), request->arg(i).c_str());
+    }
+    pageAppend("</p>");
+    pageSend(request, 404, "text/html");
+    });
+
+  server.begin();
+  Serial.println("HTTP server started");
+#ifdef GPS_SOFTWARE_SERIAL
+  // 256 bytes buffered, 22 ms at full rate, as the GPS task reads it every GPS_POLL_INTERVAL
+  gpsSerial.begin(GPS_UART_BPS, SWSERIAL_8N1, GPS_RX_PIN, GPS_TX_PIN, false, 256);
+  if (!gpsSerial) {
+    Serial.println("Invalid GPS serial config");
+  }
+  gpsManager = new GPSManager(gpsSerial, GPS_PPS_PIN, GPS_PPS_MODE);
+#else
+  gpsManager = new GPSManager(GPS_UART, GPS_RX_PIN, GPS_TX_PIN, GPS_UART_BPS, GPS_PPS_PIN, GPS_PPS_MODE);
+  if (!gpsManager->ready()) {
+    Serial.println("Invalid GPS serial config");
+  }
+#endif
+#ifdef GPS_UBX
+  gpsManager->enableUBX();
+#endif
+  if (!gpsManager->begin(GPS_TASK_CORE, GPS_TASK_PRIORITY)) {
+    Serial.println("GPS task failed to start");
+  }
+  Serial.println("GPS manager started");
+  ntpServer = new NTPServer(Serial, *gpsManager);
+#ifdef NTP_KEYS
+  static const struct {
+    uint32_t id;
+    ntp_key_type_t type;
+    const char* hexKey;
+  } ntpKeys[] = NTP_KEYS;
+  for (size_t i = 0; i < sizeof(ntpKeys) / sizeof(ntpKeys[0]); i++) {
+    if (!ntpServer->addKey(ntpKeys[i].id, ntpKeys[i].type, ntpKeys[i].hexKey)) {
+      Serial.printf("Invalid NTP key %u\n", ntpKeys[i].id);
+    }
+  }
+#endif
+#ifdef NTP_BROADCAST_ADDRESS
+  ntpServer->broadcast(NTP_BROADCAST_ADDRESS);
+#endif
+#ifdef NTP_CONTROL
+  ntpServer->controlQueries(true);
+#endif
+#ifdef NTP_RATE_LIMIT
+  ntpServer->rateLimit(NTP_RATE_INTERVAL, NTP_RATE_BURST, NTP_RATE_KISS_OF_DEATH);
+#endif
+  Serial.println("NTP server started");
+
+  Serial.println("Ready");
+}
+
+void loop() {
+  ntpServer->loop();
+  delay(1);  // GPS is read in its own task, this only has to notice each new second
+}
+
+// Printed in pieces, Print::printf() allocates for anything longer than 64 characters
+static void metricHeader(AsyncResponseStream* response, const char* name, const char* type, const char* help) {
+  response->print("# HELP ");
+  response->print(name);
+  response->print(" ");
+  response->print(help);
+  response->print("\n# TYPE ");
+  response->print(name);
+  response->print(" ");
+  response->print(type);
+  response->print("\n");
+}
+
+// Prometheus text format. Everything is copied out of the counters first, which the NTP path
+// bumps with relaxed atomics, so scraping never holds it up.
+void sendMetrics(AsyncWebServerRequest* request) {
+  static const char* const dropReasons[NTP_DROP_REASONS] = {"short", "long", "malformed", "version", "server", "mode"};
+  ntp_server_stats_t ntp = ntpServer->stats();
+  ntp_latency_t latency = ntpServer->latency();
+  pps_stats_t pps = ppsStats();
+  gps_stats_t gps = gpsManager->stats();
+  AsyncResponseStream* response = request->beginResponseStream("text/plain; version=0.0.4");
+
+  metricHeader(response, "ntp_requests_received_total", "counter", "NTP requests taken for an answer, before authentication");
+  response->printf("ntp_requests_received_total %u\n", ntp.received);
+  metricHeader(response, "ntp_requests_answered_total", "counter", "NTP requests answered");
+  response->printf("ntp_requests_answered_total %u\n", ntp.received - ntp.authFailed);
+  metricHeader(response, "ntp_requests_dropped_total", "counter", "NTP datagrams not answered with time, by reason");
+  for (int i = 0; i < NTP_DROP_REASONS; i++) {
+    response->printf("ntp_requests_dropped_total{reason=\"%s\"} %u\n", dropReasons[i], ntp.invalid[i]);
+  }
+  response->printf("ntp_requests_dropped_total{reason=\"queue_full\"} %u\n", ntp.dropped);
+  response->printf("ntp_requests_dropped_total{reason=\"auth\"} %u\n", ntp.authFailed);
+  response->printf("ntp_requests_dropped_total{reason=\"rate_limit\"} %u\n", ntp.limited);
+  metricHeader(response, "ntp_requests_authenticated_total", "counter", "NTP requests with a valid MAC");
+  response->printf("ntp_requests_authenticated_total %u\n", ntp.authenticated);
+  metricHeader(response, "ntp_broadcasts_total", "counter", "NTP mode 5 packets sent");
+  response->printf("ntp_broadcasts_total %u\n", ntp.broadcasts);
+  metricHeader(response, "ntp_control_queries_total", "counter", "NTP mode 6 queries answered");
+  response->printf("ntp_control_queries_total %u\n", ntp.control);
+  metricHeader(response, "ntp_queue_depth", "gauge", "NTP requests waiting for the serving task");
+  response->printf("ntp_queue_depth %u\n", ntp.queueDepth);
+  metricHeader(response, "ntp_queue_depth_max", "gauge", "Deepest the NTP request queue has been");
+  response->printf("ntp_queue_depth_max %u\n", ntp.queueMax);
+
+  metricHeader(response, "ntp_reply_latency_seconds", "histogram", "Time from a request arriving to its reply being handed to the driver");
+  uint32_t replies = 0;
+  for (int i = 0; i < NTP_LATENCY_BUCKETS - 1; i++) {
+    replies += latency.buckets[i];
+    response->printf("ntp_reply_latency_seconds_bucket{le=\"%g\"} %u\n", NTP_LATENCY_BOUNDS[i] / 1e6, replies);
+  }
+  replies += latency.buckets[NTP_LATENCY_BUCKETS - 1];
+  response->printf("ntp_reply_latency_seconds_bucket{le=\"+Inf\"} %u\n", replies);
+  response->printf("ntp_reply_latency_seconds_sum %.6f\n", latency.sum / 1e6);
+  response->printf("ntp_reply_latency_seconds_count %u\n", replies);
+
+  metricHeader(response, "pps_edges_total", "counter", "PPS edges timestamped");
+  response->printf("pps_edges_total %u\n", pps.edges);
+  metricHeader(response, "pps_edges_accepted_total", "counter", "PPS edges used to discipline the clock");
+  response->printf("pps_edges_accepted_total %u\n", pps.accepted);
+  metricHeader(response, "pps_outliers_total", "counter", "PPS edges rejected by the median filter");
+  response->printf("pps_outliers_total %u\n", pps.outliers);
+  metricHeader(response, "pps_missed_total", "counter", "PPS pulses missing between edges");
+  response->printf("pps_missed_total %u\n", pps.missed);
+  metricHeader(response, "pps_edges_corrected_total", "counter", "PPS edges corrected by the receiver's quantization error");
+  response->printf("pps_edges_corrected_total %u\n", pps.corrected);
+  metricHeader(response, "pps_quantization_error_seconds", "gauge", "Quantization error taken off the last corrected PPS edge");
+  response->printf("pps_quantization_error_seconds %.9f\n", pps.correction / 1e9);
+  metricHeader(response, "pps_interval_jitter_seconds", "gauge", "RMS deviation of PPS intervals from their median");
+  response->printf("pps_interval_jitter_seconds %.9f\n", pps.intervalJitter / 1e9);
+  metricHeader(response, "clock_offset_seconds", "gauge", "How far the clock was ahead of the last PPS edge");
+  response->printf("clock_offset_seconds %.9f\n", clockOffset() / 1e9);
+  metricHeader(response, "clock_frequency_ppm", "gauge", "Estimated oscillator frequency error, positive when fast");
+  response->printf("clock_frequency_ppm %.3f\n", clockFrequency());
+  metricHeader(response, "clock_jitter_seconds", "gauge", "RMS of the PPS offsets");
+  response->printf("clock_jitter_seconds %.9f\n", clockJitter() / 1e9);
+
+  metricHeader(response, "gps_bytes_total", "counter", "Bytes read from the GPS");
+  response->printf("gps_bytes_total %u\n", gps.chars);
+  metricHeader(response, "gps_sentences_total", "counter", "NMEA sentences, by checksum result");
+  response->printf("gps_sentences_total{checksum=\"good\"} %u\n", gps.passed);
+  response->printf("gps_sentences_total{checksum=\"bad\"} %u\n", gps.failed);
+  metricHeader(response, "gps_ubx_messages_total", "counter", "UBX messages, by checksum result");
+  response->printf("gps_ubx_messages_total{checksum=\"good\"} %u\n", gps.ubxPassed);
+  response->printf("gps_ubx_messages_total{checksum=\"bad\"} %u\n", gps.ubxFailed);
+  metricHeader(response, "gps_fix_sentences_total", "counter", "NMEA sentences that carried a fix");
+  response->printf("gps_fix_sentences_total %u\n", gps.withFix);
+  metricHeader(response, "gps_overflows_total", "counter", "Times the GPS UART input overflowed and was flushed");
+  response->printf("gps_overflows_total %u\n", gps.overflows);
+  metricHeader(response, "gps_dropped_bytes_total", "counter", "Bytes flushed from the GPS UART buffer after an overflow");
+  response->printf("gps_dropped_bytes_total %u\n", gps.dropped);
+  metricHeader(response, "gps_task_wakeups_total", "counter", "Times the GPS task woke up");
+  response->printf("gps_task_wakeups_total %u\n", gps.wakeups);
+  metricHeader(response, "gps_task_busy_seconds_total", "counter", "Time the GPS task spent reading and processing");
+  response->printf("gps_task_busy_seconds_total %.6f\n", gps.busy / 1e6);
+  metricHeader(response, "gps_fix_valid", "gauge", "Whether the GPS has a time and date fix");
+  response->printf("gps_fix_valid %u\n", gpsManager->validFix() ? 1 : 0);
+
+  metricHeader(response, "esp32_heap_free_bytes", "gauge", "Free heap");
+  response->printf("esp32_heap_free_bytes %u\n", ESP.getFreeHeap());
+  metricHeader(response, "esp32_heap_min_free_bytes", "gauge", "Lowest free heap since boot");
+  response->printf("esp32_heap_min_free_bytes %u\n", ESP.getMinFreeHeap());
+  metricHeader(response, "esp32_heap_max_alloc_bytes", "gauge", "Largest block the heap can allocate");
+  response->printf("esp32_heap_max_alloc_bytes %u\n", ESP.getMaxAllocHeap());
+  metricHeader(response, "esp32_uptime_seconds", "counter", "Time since boot");
+  response->printf("esp32_uptime_seconds %.3f\n", esp_timer_get_time() / 1e6);
+
+#if configUSE_TRACE_FACILITY && configGENERATE_RUN_TIME_STATS
+  // Run time is counted on esp_timer in microseconds and wraps every 71 minutes, which rate() takes as a reset
+  UBaseType_t taskCount = uxTaskGetNumberOfTasks() + 2;
+  TaskStatus_t* tasks = new TaskStatus_t[taskCount];
+  uint32_t totalRunTime;
+  taskCount = uxTaskGetSystemState(tasks, taskCount, &totalRunTime);
+  metricHeader(response, "esp32_task_cpu_seconds_total", "counter", "CPU time used by each FreeRTOS task");
+  for (UBaseType_t i = 0; i < taskCount; i++) {
+#if configTASKLIST_INCLUDE_COREID
+    char core[4] = "any";
+    if (tasks[i].xCoreID != tskNO_AFFINITY) {
+      snprintf(core, sizeof(core), "%d", (int)tasks[i].xCoreID);
+    }
+    response->printf("esp32_task_cpu_seconds_total{task=\"%s\",core=\"%s\"} %.6f\n", tasks[i].pcTaskName, core, tasks[i].ulRunTimeCounter / 1e6);
+#else
+    response->printf("esp32_task_cpu_seconds_total{task=\"%s\"} %.6f\n", tasks[i].pcTaskName, tasks[i].ulRunTimeCounter / 1e6);
+#endif
+  }
+  delete[] tasks;
+#endif
+  request->send(response);
+}
+
+void wifiEvent(WiFiEvent_t event) {
+  switch (event) {
+  case ARDUINO_EVENT_ETH_START:
+    Serial.println("Ethernet started");
+    //set eth hostname here
+    ETH.setHostname(HOSTNAME);
+    break;
+  case ARDUINO_EVENT_ETH_CONNECTED:
+    Serial.println("Ethernet connected");
+    break;
+  case ARDUINO_EVENT_ETH_GOT_IP:
+    Serial.print("Ethernet MAC: ");
+    Serial.print(ETH.macAddress());
+    Serial.print(", IPv4: ");
+    Serial.print(ETH.localIP());
+    if (ETH.fullDuplex()) {
+      Serial.print(", FULL_DUPLEX");
+    }
+    Serial.print(", ");
+    Serial.print(ETH.linkSpeed());
+    Serial.print("Mbps");
+    Serial.print(", ");
+    Serial.print("Gateway IP:");
+    Serial.println(ETH.gatewayIP());
+    eth_connected = true;
+    break;
+  case ARDUINO_EVENT_ETH_DISCONNECTED:
+    Serial.println("Ethernet disconnected");
+    eth_connected = false;
+    break;
+  case ARDUINO_EVENT_ETH_STOP:
+    Serial.println("Ethernet stopped");
+    eth_connected = false;
+    break;
+  default:
+    break;
+  }
 }
\ No newline at end of file
@@ -0,0 +1,203 @@
+#include "GPSSimulator.h"
+#include <time.h>
+
+#define GPS_EPOCH 315964800	 // Unix time of the GPS epoch, 6 January 1980
+#define GPS_LEAP_SECONDS 18	 // GPS time ahead of UTC
+#define SECS_PER_GPS_WEEK 604800
+#define GPS_SIMULATOR_COMMAND_POLL 20  // ms between reads of configuration while waiting for the next pulse
+
+static void put16(uint8_t* p, uint16_t value) {
+	p[0] = value;
+	p[1] = value >> 8;
+}
+
+static void put32(uint8_t* p, uint32_t value) {
+	put16(p, value);
+	put16(p + 2, value >> 16);
+}
+
+GPSSimulator::GPSSimulator(Print& output, uint8_t ppsPin) {
+	_output = &output;
+	_ppsPin = ppsPin;
+	_running = false;
+	_port = NULL;
+	_timePulse = false;
+	_timeUTC = false;
+	_pvt = false;
+	_glitch = 0;
+}
+
+GPSSimulator::~GPSSimulator() {
+	stop();
+}
+
+void GPSSimulator::ubx(NativeUartPeer& port) {
+	_port = &port;
+}
+
+void GPSSimulator::glitch(uint32_t interval) {
+	_glitch = interval;
+}
+
+void GPSSimulator::start() {
+	if (_running) {
+		return;
+	}
+	_running = true;
+	_thread = std::thread(&GPSSimulator::run, this);
+}
+
+void GPSSimulator::stop() {
+	_running = false;
+	if (_thread.joinable()) {
+		_thread.join();
+	}
+}
+
+void GPSSimulator::run() {
+	time_t last = 0;
+	while (_running) {
+		struct timespec ts;
+		clock_gettime(CLOCK_REALTIME, &ts);
+		time_t second = max(ts.tv_sec + 1, last + 1);
+		int32_t late = _port ? quantizationError(second) : 0;
+		ts.tv_sec = late < 0 ? second - 1 : second;
+		ts.tv_nsec = late < 0 ? 1000000000 + late : late;
+		if (_port) {
+			// answer configuration while waiting, the receiver replies within a few ms
+			struct timespec now;
+			clock_gettime(CLOCK_REALTIME, &now);
+			while (_running && (ts.tv_sec - now.tv_sec) * 1000 + (ts.tv_nsec - now.tv_nsec) / 1000000 > 2 * GPS_SIMULATOR_COMMAND_POLL) {
+				readCommands();
+				delay(GPS_SIMULATOR_COMMAND_POLL);
+				clock_gettime(CLOCK_REALTIME, &now);
+			}
+		}
+		if (clock_nanosleep(CLOCK_REALTIME, TIMER_ABSTIME, &ts, NULL) != 0) {
+			continue;
+		}
+		nativeRaiseInterrupt(_ppsPin);
+		last = second;
+
+		struct tm utc;
+		gmtime_r(&second, &utc);
+		char body[96];
+		snprintf(body, sizeof(body), "GPRMC,%02d%02d%02d.00,A,4807.038,N,01131.000,E,0.0,0.0,%02d%02d%02d,,,A",
+				 utc.tm_hour, utc.tm_min, utc.tm_sec, utc.tm_mday, utc.tm_mon + 1, utc.tm_year % 100);
+		sendSentence(body);
+		snprintf(body, sizeof(body), "GPGGA,%02d%02d%02d.00,4807.038,N,01131.000,E,1,08,0.9,545.4,M,46.9,M,,",
+				 utc.tm_hour, utc.tm_min, utc.tm_sec);
+		sendSentence(body);
+		if (_port) {
+			sendUBX(second);
+		}
+		if (_glitch != 0 && second % _glitch == 0) {
+			ts.tv_nsec += GPS_SIMULATOR_GLITCH;
+			if (ts.tv_nsec >= 1000000000) {
+				ts.tv_sec++;
+				ts.tv_nsec -= 1000000000;
+			}
+			if (clock_nanosleep(CLOCK_REALTIME, TIMER_ABSTIME, &ts, NULL) == 0) {
+				nativeRaiseInterrupt(_ppsPin);
+			}
+		}
+	}
+}
+
+void GPSSimulator::sendSentence(const char* body) {
+	uint8_t checksum = 0;
+	for (const char* c = body; *c; c++) {
+		checksum ^= *c;
+	}
+	_output->printf("$%s*%02X\r\n", body, checksum);
+}
+
+// The epoch of the pulse just fired, then TIM-TP for the next one
+void GPSSimulator::sendUBX(time_t second) {
+	struct tm utc;
+	gmtime_r(&second, &utc);
+	uint32_t gps = second - GPS_EPOCH + GPS_LEAP_SECONDS;
+	uint32_t tow = gps % SECS_PER_GPS_WEEK * 1000;
+	if (_pvt) {
+		uint8_t pvt[92] = {};
+		put32(pvt, tow);
+		put16(pvt + 4, utc.tm_year + 1900);
+		pvt[6] = utc.tm_mon + 1;
+		pvt[7] = utc.tm_mday;
+		pvt[8] = utc.tm_hour;
+		pvt[9] = utc.tm_min;
+		pvt[10] = utc.tm_sec;
+		pvt[11] = 0x07;	 // validDate, validTime, fullyResolved
+		put32(pvt + 12, 20);
+		pvt[20] = 3;	 // 3D
+		pvt[21] = 0x01;	 // gnssFixOK
+		pvt[23] = 8;
+		put32(pvt + 24, 115166667);	 // longitude and latitude in 1e-7 degrees
+		put32(pvt + 28, 481173000);
+		sendFrame(UBX_CLASS_NAV, UBX_ID_NAV_PVT, pvt, sizeof(pvt));
+	}
+	if (_timeUTC) {
+		uint8_t timeUTC[20] = {};
+		put32(timeUTC, tow);
+		put32(timeUTC + 4, 20);
+		put16(timeUTC + 12, utc.tm_year + 1900);
+		timeUTC[14] = utc.tm_mon + 1;
+		timeUTC[15] = utc.tm_mday;
+		timeUTC[16] = utc.tm_hour;
+		timeUTC[17] = utc.tm_min;
+		timeUTC[18] = utc.tm_sec;
+		timeUTC[19] = 0x07;	 // validTOW, validWKN, validUTC
+		sendFrame(UBX_CLASS_NAV, UBX_ID_NAV_TIMEUTC, timeUTC, sizeof(timeUTC));
+	}
+	if (_timePulse) {
+		uint8_t timePulse[16] = {};
+		put32(timePulse, (gps + 1) % SECS_PER_GPS_WEEK * 1000);
+		put32(timePulse + 8, quantizationError(second + 1) * 1000);
+		put16(timePulse + 12, (gps + 1) / SECS_PER_GPS_WEEK);
+		timePulse[14] = 0x02;  // GPS time base, UTC available
+		sendFrame(UBX_CLASS_TIM, UBX_ID_TIM_TP, timePulse, sizeof(timePulse));
+	}
+}
+
+void GPSSimulator::sendFrame(uint8_t messageClass, uint8_t id, const uint8_t* payload, uint16_t length) {
+	uint8_t frame[128];
+	size_t size = UBXParser::frame(messageClass, id, payload, length, frame, sizeof(frame));
+	_output->write(frame, size);
+}
+
+// CFG-MSG turns messages on and off and is acknowledged, any other CFG is refused
+void GPSSimulator::readCommands() {
+	uint8_t buffer[64];
+	size_t n;
+	while ((n = _port->readBytes(buffer, sizeof(buffer))) > 0) {
+		for (size_t i = 0; i < n; i++) {
+			if (_commands.encode(buffer[i]) != UBX_OTHER || (_commands.message() >> 8) != UBX_CLASS_CFG) {
+				continue;
+			}
+			uint8_t ack[2] = {UBX_CLASS_CFG, (uint8_t)_commands.message()};
+			const uint8_t* payload = _commands.payload();
+			if (_commands.message() != (UBX_CLASS_CFG << 8 | UBX_ID_CFG_MSG) || _commands.length() != 3) {
+				sendFrame(UBX_CLASS_ACK, UBX_ID_ACK_NAK, ack, sizeof(ack));
+				continue;
+			}
+			bool enable = payload[2] != 0;
+			switch (payload[0] << 8 | payload[1]) {
+			case UBX_CLASS_TIM << 8 | UBX_ID_TIM_TP:
+				_timePulse = enable;
+				break;
+			case UBX_CLASS_NAV << 8 | UBX_ID_NAV_TIMEUTC:
+				_timeUTC = enable;
+				break;
+			case UBX_CLASS_NAV << 8 | UBX_ID_NAV_PVT:
+				_pvt = enable;
+				break;
+			}
+			sendFrame(UBX_CLASS_ACK, UBX_ID_ACK_ACK, ack, sizeof(ack));
+		}
+	}
+}
+
+// Nanos the pulse at second is late, a sawtooth like the receiver's clock ticks drifting past the second
+int32_t GPSSimulator::quantizationError(time_t second) {
+	return (int32_t)(second * 7 % 41 - 20) * (GPS_SIMULATOR_QERR / 20);
+}
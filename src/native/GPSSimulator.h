@@ -0,0 +1,45 @@
+#pragma once
+#include <Arduino.h>
+#include <UBXParser.h>
+#include <thread>
+#include "driver/uart.h"
+
+// nanos, the largest PPS quantization error in UBX mode. A u-blox M8 pulse is within about
+// 20 ns, this is exaggerated so the correction shows above the host's wakeup jitter.
+#define GPS_SIMULATOR_QERR 20000
+#define GPS_SIMULATOR_GLITCH 700000000	// nanos after a pulse that an injected glitch edge fires
+
+// Emulates a GPS receiver on the host, fires the PPS interrupt on every
+// CLOCK_REALTIME second boundary then writes the NMEA sentences for that second.
+// In UBX mode it also answers CFG-MSG like a u-blox receiver, sends the UBX messages
+// enabled, and fires each pulse late by a sawtooth error that TIM-TP reports ahead of it.
+// Glitches are extra edges between pulses, like ringing or a noisy PPS line would give.
+class GPSSimulator {
+   public:
+	GPSSimulator(Print& output, uint8_t ppsPin);
+	~GPSSimulator();
+
+	void ubx(NativeUartPeer& port);	 // reads configuration from port, call before start()
+	void glitch(uint32_t interval);	 // a glitch edge after every interval-th pulse, 0 for none, call before start()
+	void start();
+	void stop();
+
+   private:
+	void run();
+	void sendSentence(const char* body);
+	void sendUBX(time_t second);
+	void sendFrame(uint8_t messageClass, uint8_t id, const uint8_t* payload, uint16_t length);
+	void readCommands();
+	int32_t quantizationError(time_t second);
+
+	Print* _output;
+	uint8_t _ppsPin;
+	volatile bool _running;
+	std::thread _thread;
+	NativeUartPeer* _port;	// NULL unless in UBX mode
+	UBXParser _commands;
+	bool _timePulse;		// TIM-TP enabled
+	bool _timeUTC;			// NAV-TIMEUTC enabled
+	bool _pvt;				// NAV-PVT enabled
+	uint32_t _glitch;
+};
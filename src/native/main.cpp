@@ -0,0 +1,216 @@
+// Host entry point, serves NTP from a Linux process using the native shims
+// and a simulated GPS so the time serving path can be profiled and load tested.
+#include <Arduino.h>
+#include <LoopbackStream.h>
+#include <NTPServer.h>
+#include <GPSManager.h>
+#include <signal.h>
+#include <strings.h>
+#include <sys/resource.h>
+#include <unistd.h>
+#include "GPSSimulator.h"
+
+#define GPS_PPS_PIN 12
+#define GPS_UART UART_NUM_1
+#define GPS_UART_BPS 115200
+#define NATIVE_NTP_PORT 12300
+
+static volatile bool running = true;
+
+static void handleSignal(int sig) {
+	running = false;
+}
+
+// User and system time of every thread, including the simulator's and NTPServer's
+static uint64_t processCpuMicros() {
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	return (uint64_t)(usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000000 + usage.ru_utime.tv_usec + usage.ru_stime.tv_usec;
+}
+
+typedef struct {
+	uint32_t id;
+	ntp_key_type_t type;
+	char hex[2 * NTP_AUTH_KEY_SIZE + 1];
+} native_key_t;
+
+// Parses id,md5|sha1|aes128cmac,hexkey
+static bool parseKey(const char* arg, native_key_t& key) {
+	char type[16];
+	if (sscanf(arg, "%u,%15[^,],%64s", &key.id, type, key.hex) != 3) {
+		return false;
+	}
+	if (strcasecmp(type, "md5") == 0) {
+		key.type = NTP_KEY_MD5;
+	} else if (strcasecmp(type, "sha1") == 0) {
+		key.type = NTP_KEY_SHA1;
+	} else if (strcasecmp(type, "aes128cmac") == 0) {
+		key.type = NTP_KEY_AES128CMAC;
+	} else {
+		return false;
+	}
+	return true;
+}
+
+int main(int argc, char** argv) {
+	uint16_t port = NATIVE_NTP_PORT;
+	pps_mode_t ppsMode = PPS_INTERRUPT;
+	bool uart = false;
+	bool task = false;
+	bool ubx = false;
+	uint32_t rateInterval = 0;	// off, ntpbench sends everything from one address
+	native_key_t keys[NTP_AUTH_KEYS];
+	size_t keyCount = 0;
+	const char* broadcast = NULL;
+	bool control = false;
+	uint32_t glitch = 0;
+	int opt;
+	while ((opt = getopt(argc, argv, "p:cutxl:k:b:qg:")) != -1) {
+		switch (opt) {
+		case 'p':
+			port = atoi(optarg);
+			break;
+		case 'c':
+			ppsMode = PPS_CAPTURE;
+			break;
+		case 'u':
+			uart = true;
+			break;
+		case 't':
+			task = true;
+			break;
+		case 'x':
+			ubx = true;
+			uart = true;  // the simulator reads configuration from the port
+			break;
+		case 'l':
+			rateInterval = atoi(optarg);
+			break;
+		case 'k':
+			if (keyCount == NTP_AUTH_KEYS || !parseKey(optarg, keys[keyCount])) {
+				fprintf(stderr, "Invalid key %s\n", optarg);
+				return 1;
+			}
+			keyCount++;
+			break;
+		case 'b':
+			broadcast = optarg;
+			break;
+		case 'q':
+			control = true;
+			break;
+		case 'g':
+			glitch = atoi(optarg);
+			break;
+		default:
+			fprintf(stderr, "Usage: %s [-p port] [-c] [-u] [-t] [-x] [-l rate limit interval ms] [-k id,md5|sha1|aes128cmac,hexkey]... [-b address:port,poll[,key id]] [-q] [-g glitch interval s]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	signal(SIGINT, handleSignal);
+	signal(SIGTERM, handleSignal);
+
+	Serial.begin(115200);
+	LoopbackStream gpsSerial;
+	NativeUartPeer gpsUart(GPS_UART);
+	GPSSimulator gpsSimulator(uart ? (Print&)gpsUart : (Print&)gpsSerial, GPS_PPS_PIN);
+
+	GPSManager* gpsManager = uart ? new GPSManager(GPS_UART, UART_PIN_NO_CHANGE, UART_PIN_NO_CHANGE, GPS_UART_BPS, GPS_PPS_PIN, ppsMode)
+								  : new GPSManager(gpsSerial, GPS_PPS_PIN, ppsMode);
+	if (ubx) {
+		gpsManager->enableUBX();
+		gpsSimulator.ubx(gpsUart);
+	}
+	gpsSimulator.glitch(glitch);
+	if (task && !gpsManager->begin()) {
+		fprintf(stderr, "GPS task failed to start\n");
+		return 1;
+	}
+	Serial.println("GPS manager started");
+	NTPServer* ntpServer = new NTPServer(Serial, *gpsManager, port);
+	ntpServer->rateLimit(rateInterval, NTP_RATE_BURST, NTP_RATE_KISS_OF_DEATH);
+	for (size_t i = 0; i < keyCount; i++) {
+		if (!ntpServer->addKey(keys[i].id, keys[i].type, keys[i].hex)) {
+			fprintf(stderr, "Key %u does not fit its type\n", keys[i].id);
+			return 1;
+		}
+	}
+	if (broadcast) {
+		unsigned int a, b, c, d, broadcastPort, poll, keyId = 0;
+		if (sscanf(broadcast, "%u.%u.%u.%u:%u,%u,%u", &a, &b, &c, &d, &broadcastPort, &poll, &keyId) < 6 ||
+			!ntpServer->broadcast(IPAddress(a, b, c, d), poll, keyId, broadcastPort)) {
+			fprintf(stderr, "Invalid broadcast %s\n", broadcast);
+			return 1;
+		}
+	}
+	ntpServer->controlQueries(control);
+	Serial.printf("NTP server started on port %u\r\n", port);
+	gpsSimulator.start();
+
+	uint32_t lastReport = millis();
+	uint64_t lastCpu = processCpuMicros();
+	while (running) {
+		if (!task) {
+			gpsManager->loop();
+		}
+		ntpServer->loop();
+		if (millis() - lastReport >= 10000) {
+			pps_stats_t pps = ppsStats();
+			Serial.printf("PPS: %u edges, %u accepted, %u outliers, %u missed, %u extra, %u overflows, interval median %d ns, jitter %u ns\r\n",
+						  pps.edges, pps.accepted, pps.outliers, pps.missed, pps.extra, pps.overflows, pps.intervalMedian, pps.intervalJitter);
+			Serial.printf("Clock: offset %d ns, frequency %.3f ppm, jitter %u ns, %u edges corrected for quantization error, last by %d ns\r\n",
+						  clockOffset(), clockFrequency(), clockJitter(), pps.corrected, pps.correction);
+			rx_timestamp_stats_t rx = rxTimestampStats();
+			Serial.printf("RX: %u stamped, %u matched, %u unmatched, %u overwritten, queueing delay %u us, mean %u, max %u\r\n",
+						  rx.stamped, rx.matched, rx.unmatched, rx.overwritten, rx.delay, rx.delayMean, rx.delayMax);
+			ntp_server_stats_t ntp = ntpServer->stats();
+			Serial.printf("NTP: %u received, %u dropped, %u rate limited, %u authenticated, %u failed authentication, %u broadcasts, %u control queries, queue depth %u, max %u\r\n",
+						  ntp.received, ntp.dropped, ntp.limited, ntp.authenticated, ntp.authFailed, ntp.broadcasts, ntp.control, ntp.queueDepth, ntp.queueMax);
+			Serial.printf("Invalid: %u short, %u long, %u malformed, %u bad version, %u from servers, %u bad mode\r\n",
+						  ntp.invalid[NTP_DROP_SHORT], ntp.invalid[NTP_DROP_LONG], ntp.invalid[NTP_DROP_MALFORMED],
+						  ntp.invalid[NTP_DROP_VERSION], ntp.invalid[NTP_DROP_SERVER], ntp.invalid[NTP_DROP_MODE]);
+			ntp_latency_t latency = ntpServer->latency();
+			uint32_t replies = 0;
+			Serial.printf("Reply latency:");
+			for (int i = 0; i < NTP_LATENCY_BUCKETS; i++) {
+				replies += latency.buckets[i];
+				if (i < NTP_LATENCY_BUCKETS - 1) {
+					Serial.printf(" <=%uus %u,", NTP_LATENCY_BOUNDS[i], latency.buckets[i]);
+				} else {
+					Serial.printf(" more %u, mean %u us\r\n", latency.buckets[i], replies ? (uint32_t)(latency.sum / replies) : 0);
+				}
+			}
+			gps_stats_t gps = gpsManager->stats();
+			Serial.printf("GPS: %u bytes, %u good sentences, %u bad, %u with fix, %u overflows, %u bytes dropped\r\n", gps.chars,
+						  gps.passed, gps.failed, gps.withFix, gps.overflows, gps.dropped);
+			if (ubx) {
+				Serial.printf("UBX: %u good frames, %u bad, %u of %u messages enabled\r\n", gps.ubxPassed, gps.ubxFailed,
+							  gps.configured, GPS_UBX_MESSAGES);
+			}
+			uint64_t cpu = processCpuMicros();
+			Serial.printf("CPU: %.2f%% of a core, GPS task %u wakeups, %.3f ms busy\r\n",
+						  (cpu - lastCpu) / 10.0 / (millis() - lastReport), gps.wakeups, gps.busy / 1e3);
+			lastCpu = cpu;
+			mru_entry_t clients[3];
+			size_t count = ntpServer->mruList().snapshot(clients, 3);
+			for (size_t i = 0; i < count; i++) {
+				IPAddress ip(clients[i].ip);
+				Serial.printf("Client %u.%u.%u.%u:%u mode %u version %u, %u requests, average interval %u us\r\n", ip[0], ip[1],
+							  ip[2], ip[3], clients[i].port, clients[i].mode, clients[i].version, clients[i].count, clients[i].interval);
+			}
+			if (ppsMode == PPS_CAPTURE) {
+				pps_capture_stats_t stats = gpsManager->captureStats();
+				Serial.printf("PPS capture: %u edges, latency %u ns, min %u, max %u, mean %u, jitter %u\r\n", stats.edges,
+							  stats.latency, stats.latencyMin, stats.latencyMax, stats.latencyMean, stats.latencyJitter);
+			}
+			lastReport = millis();
+		}
+		delay(1);
+	}
+
+	gpsSimulator.stop();
+	delete ntpServer;
+	delete gpsManager;
+	return 0;
+}
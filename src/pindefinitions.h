@@ -18,6 +18,9 @@
 #define SD_MOSI_PIN                     15
 #define SD_SCLK_PIN                     14
 #define SD_CS_PIN                       13
+#define GPS_PPS_PIN                     12
+#define GPS_RX_PIN                      14
+#define GPS_TX_PIN                      15
 
 #elif defined(LILYGO_T_ETH_POE_PRO)
 #define ETH_TYPE                        ETH_PHY_LAN8720
@@ -33,6 +36,9 @@
 #define TFT_DC                          2
 #define RS485_TX                        32
 #define RS485_RX                        33
+#define GPS_PPS_PIN                     4
+#define GPS_RX_PIN                      35
+#define GPS_TX_PIN                      16
 
 #elif defined(LILYGO_T_INTER_COM)
 #define ETH_TYPE                        ETH_PHY_LAN8720
@@ -45,6 +51,9 @@
 #define SD_MOSI_PIN                     15
 #define SD_SCLK_PIN                     14
 #define SD_CS_PIN                       13
+#define GPS_PPS_PIN                     32
+#define GPS_RX_PIN                      33
+#define GPS_TX_PIN                      5
 
 #elif defined(LILYGO_T_ETH_LITE_ESP32)
 #define ETH_TYPE                        ETH_PHY_RTL8201
@@ -58,6 +67,9 @@
 #define SD_MOSI_PIN                     13
 #define SD_SCLK_PIN                     14
 #define SD_CS_PIN                       5
+#define GPS_PPS_PIN                     32
+#define GPS_RX_PIN                      35
+#define GPS_TX_PIN                      4
 
 #elif defined(LILYGO_T_ETH_LITE_ESP32S3)
 #define ETH_MISO_PIN                    11
@@ -71,6 +83,9 @@
 #define SD_MOSI_PIN                     6
 #define SD_SCLK_PIN                     7
 #define SD_CS_PIN                       42
+#define GPS_PPS_PIN                     16
+#define GPS_RX_PIN                      18
+#define GPS_TX_PIN                      17
 
 #else
 #error "Use ArduinoIDE, please open the macro definition corresponding to the board above <utilities.h>"
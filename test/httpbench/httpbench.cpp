@@ -0,0 +1,229 @@
+// HTTP load generator for the status pages
+//
+// Fetches a page over new connections from several threads as fast as the server answers,
+// like a browser or scraper without keep-alive, and reports requests/sec, errors and
+// latency percentiles. Heap is read from /api/status before and after the run, so the
+// change in free heap and its low watermark shows what the load cost.
+//
+// Build: g++ -O2 -std=gnu++17 -pthread test/httpbench/httpbench.cpp -o httpbench
+// Usage: httpbench -s server [-p port] [-u path] [-c connections] [-d seconds]
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+#define RESPONSE_TIMEOUT_MILLIS 5000
+
+struct Options {
+	const char* server = NULL;  // the board, there is no native web server
+	uint16_t port = 80;
+	const char* path = "/api/status";
+	uint32_t concurrency = 4;
+	uint32_t duration = 10;
+};
+
+struct Worker {
+	std::vector<int64_t> latency;  // ns from connect to the server closing the connection
+	uint64_t ok = 0;
+	uint64_t errors = 0;   // connect, send or receive failed
+	uint64_t status = 0;   // answered with something other than 200
+	uint64_t bytes = 0;
+};
+
+struct Heap {
+	bool valid = false;
+	long free = -1;
+	long minFree = -1;
+	long maxAlloc = -1;
+};
+
+static struct sockaddr_in server;
+static std::atomic<bool> running(true);
+
+static uint64_t monotonicNanos() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// One GET on a new connection, returns the HTTP status or -1, and the whole response in body
+static int get(const char* path, std::string& body) {
+	int fd = socket(AF_INET, SOCK_STREAM, 0);
+	if (fd < 0) {
+		return -1;
+	}
+	struct timeval timeout = {RESPONSE_TIMEOUT_MILLIS / 1000, (RESPONSE_TIMEOUT_MILLIS % 1000) * 1000};
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+	setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+	int one = 1;
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+	if (connect(fd, (struct sockaddr*)&server, sizeof(server)) < 0) {
+		close(fd);
+		return -1;
+	}
+	char request[256];
+	int len = snprintf(request, sizeof(request), "GET %s HTTP/1.1\r\nHost: %s\r\nConnection: close\r\n\r\n", path,
+					   inet_ntoa(server.sin_addr));
+	if (send(fd, request, len, 0) != len) {
+		close(fd);
+		return -1;
+	}
+	body.clear();
+	char buf[4096];
+	ssize_t n;
+	while ((n = recv(fd, buf, sizeof(buf), 0)) > 0) {
+		body.append(buf, n);
+	}
+	close(fd);
+	int status;
+	if (n < 0 || sscanf(body.c_str(), "HTTP/1.%*d %d", &status) != 1) {
+		return -1;
+	}
+	return status;
+}
+
+// Value of the first "key": number in body, -1 if there is none
+static long jsonNumber(const std::string& body, const char* key) {
+	size_t at = body.find("\"" + std::string(key) + "\"");
+	if (at == std::string::npos || (at = body.find(':', at)) == std::string::npos) {
+		return -1;
+	}
+	return atol(body.c_str() + at + 1);
+}
+
+static Heap readHeap() {
+	Heap heap;
+	std::string body;
+	if (get("/api/status", body) != 200) {
+		return heap;
+	}
+	size_t at = body.find("\"heap\"");
+	if (at == std::string::npos) {
+		return heap;
+	}
+	std::string section = body.substr(at);
+	heap.free = jsonNumber(section, "free");
+	heap.minFree = jsonNumber(section, "minFree");
+	heap.maxAlloc = jsonNumber(section, "maxAlloc");
+	heap.valid = heap.free >= 0 && heap.minFree >= 0;
+	return heap;
+}
+
+static void loadLoop(Worker* worker, const char* path) {
+	std::string body;
+	while (running) {
+		uint64_t start = monotonicNanos();
+		int status = get(path, body);
+		if (status < 0) {
+			worker->errors++;
+			continue;
+		}
+		if (status != 200) {
+			worker->status++;
+			continue;
+		}
+		worker->ok++;
+		worker->bytes += body.size();
+		worker->latency.push_back(monotonicNanos() - start);
+	}
+}
+
+static double percentile(const std::vector<int64_t>& sorted, double p) {
+	if (sorted.empty()) {
+		return 0;
+	}
+	size_t index = (size_t)(p / 100.0 * (sorted.size() - 1) + 0.5);
+	return sorted[index] / 1e6;
+}
+
+static void usage(const char* name) {
+	fprintf(stderr, "Usage: %s -s server [-p port] [-u path] [-c connections] [-d seconds]\n", name);
+}
+
+int main(int argc, char** argv) {
+	Options options;
+	int opt;
+	while ((opt = getopt(argc, argv, "s:p:u:c:d:h")) != -1) {
+		switch (opt) {
+		case 's':
+			options.server = optarg;
+			break;
+		case 'p':
+			options.port = atoi(optarg);
+			break;
+		case 'u':
+			options.path = optarg;
+			break;
+		case 'c':
+			options.concurrency = atoi(optarg);
+			break;
+		case 'd':
+			options.duration = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+	if (options.server == NULL || options.concurrency == 0 || options.duration == 0) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	server.sin_family = AF_INET;
+	server.sin_port = htons(options.port);
+	if (inet_pton(AF_INET, options.server, &server.sin_addr) != 1) {
+		fprintf(stderr, "Invalid server address %s\n", options.server);
+		return 1;
+	}
+
+	Heap before = readHeap();
+	printf("Fetching %s from %s:%u over %u connections for %u s\n", options.path, options.server, options.port,
+		   options.concurrency, options.duration);
+	std::vector<Worker> workers(options.concurrency);
+	std::vector<std::thread> threads;
+	uint64_t start = monotonicNanos();
+	for (Worker& worker : workers) {
+		threads.emplace_back(loadLoop, &worker, options.path);
+	}
+	usleep(options.duration * 1000000);
+	running = false;
+	for (std::thread& thread : threads) {
+		thread.join();
+	}
+	double elapsed = (monotonicNanos() - start) / 1e9;
+	Heap after = readHeap();
+
+	Worker total;
+	for (Worker& worker : workers) {
+		total.ok += worker.ok;
+		total.errors += worker.errors;
+		total.status += worker.status;
+		total.bytes += worker.bytes;
+		total.latency.insert(total.latency.end(), worker.latency.begin(), worker.latency.end());
+	}
+	std::sort(total.latency.begin(), total.latency.end());
+	printf("%llu ok, %llu failed, %llu not 200, %.1f requests/sec, %.1f KB/s\n", (unsigned long long)total.ok,
+		   (unsigned long long)total.errors, (unsigned long long)total.status, total.ok / elapsed, total.bytes / elapsed / 1024);
+	printf("Latency      p50 %9.2f ms  p99 %9.2f ms  max %9.2f ms\n", percentile(total.latency, 50),
+		   percentile(total.latency, 99), percentile(total.latency, 100));
+	if (before.valid && after.valid) {
+		printf("Heap free %ld -> %ld bytes, low watermark %ld -> %ld, largest block %ld -> %ld\n", before.free, after.free,
+			   before.minFree, after.minFree, before.maxAlloc, after.maxAlloc);
+	} else {
+		printf("Heap not available from /api/status\n");
+	}
+	return 0;
+}
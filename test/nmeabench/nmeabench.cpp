@@ -0,0 +1,232 @@
+// NMEA decoding throughput on the host
+//
+// Runs a log of NMEA output through NMEAParser, a byte at a time as from a Stream and a
+// line at a time as from the UART driver, and through TinyGPSPlus when its source is on the
+// include path. Reports bytes/sec and ns per byte of each, and the sentences each accepted,
+// so a decoder that skips work by rejecting lines shows up. Without -f a synthetic log is
+// used, an hour of the GN RMC, VTG, GGA, GSA, GSV and GLL output of a u-blox M8 at 1 Hz.
+// Record a real one with: cat /dev/ttyUSB0 > gps.nmea
+//
+// Build: g++ -O2 -std=gnu++17 -Ilib/NMEAParser -Ilib/NativeShims -I.pio/libdeps/native/TinyGPSPlus/src
+//            test/nmeabench/nmeabench.cpp lib/NMEAParser/NMEAParser.cpp .pio/libdeps/native/TinyGPSPlus/src/TinyGPS++.cpp -o nmeabench
+// Usage: nmeabench [-f log] [-m megabytes]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+#include <NMEAParser.h>
+
+#if __has_include(<TinyGPS++.h>)
+#include <TinyGPS++.h>
+#define HAVE_TINYGPS 1
+
+// TinyGPSPlus stamps every field with millis(), from the Arduino shims' declaration
+unsigned long millis() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000UL + ts.tv_nsec / 1000000;
+}
+#endif
+
+#define SYNTHETIC_SECONDS 3600
+
+struct Options {
+	const char* file = NULL;
+	uint32_t megabytes = 64;  // decoded by each run, the log is repeated to make it up
+};
+
+struct Result {
+	double seconds = 0;
+	uint64_t bytes = 0;
+	uint32_t passed = 0;
+	uint32_t failed = 0;
+	uint32_t clockUpdates = 0;	// lines carrying both time and date, which would set the clock
+};
+
+static uint64_t monotonicNanos() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void appendSentence(std::string& log, const char* body) {
+	uint8_t checksum = 0;
+	for (const char* c = body; *c; c++) {
+		checksum ^= *c;
+	}
+	char line[128];
+	snprintf(line, sizeof(line), "$%s*%02X\r\n", body, checksum);
+	log += line;
+}
+
+static std::string syntheticLog() {
+	std::string log;
+	char body[120];
+	for (int i = 0; i < SYNTHETIC_SECONDS; i++) {
+		int hour = 10 + i / 3600, minute = i / 60 % 60, second = i % 60;
+		snprintf(body, sizeof(body), "GNRMC,%02d%02d%02d.00,A,4807.03812,N,01131.00047,E,0.012,,150326,,,A", hour, minute, second);
+		appendSentence(log, body);
+		appendSentence(log, "GNVTG,,T,,M,0.012,N,0.022,K,A");
+		snprintf(body, sizeof(body), "GNGGA,%02d%02d%02d.00,4807.03812,N,01131.00047,E,1,12,0.67,545.4,M,46.9,M,,", hour, minute, second);
+		appendSentence(log, body);
+		appendSentence(log, "GNGSA,A,3,02,05,06,12,13,15,19,24,25,,,,1.12,0.67,0.90");
+		appendSentence(log, "GNGSA,A,3,66,67,76,77,,,,,,,,,1.12,0.67,0.90");
+		appendSentence(log, "GPGSV,3,1,11,02,45,285,41,05,35,196,38,06,23,094,33,12,68,241,44");
+		appendSentence(log, "GPGSV,3,2,11,13,18,047,30,15,11,300,29,19,09,133,27,24,52,128,42");
+		appendSentence(log, "GPGSV,3,3,11,25,39,065,39,29,03,330,,32,01,018,");
+		appendSentence(log, "GLGSV,2,1,06,66,41,071,36,67,73,319,40,76,33,248,35,77,22,315,31");
+		appendSentence(log, "GLGSV,2,2,06,82,05,156,,83,02,203,");
+		snprintf(body, sizeof(body), "GNGLL,4807.03812,N,01131.00047,E,%02d%02d%02d.00,A,A", hour, minute, second);
+		appendSentence(log, body);
+	}
+	return log;
+}
+
+static bool readLog(const char* path, std::string& log) {
+	FILE* file = fopen(path, "rb");
+	if (!file) {
+		return false;
+	}
+	char buf[65536];
+	size_t n;
+	while ((n = fread(buf, 1, sizeof(buf), file)) > 0) {
+		log.append(buf, n);
+	}
+	fclose(file);
+	return true;
+}
+
+static Result encodeParser(const std::string& log, uint32_t passes) {
+	NMEAParser parser;
+	Result result;
+	uint64_t start = monotonicNanos();
+	for (uint32_t pass = 0; pass < passes; pass++) {
+		for (char c : log) {
+			if (parser.encode(c) != NMEA_NONE && parser.timeUpdated() && parser.dateUpdated()) {
+				result.clockUpdates++;
+			}
+		}
+	}
+	result.seconds = (monotonicNanos() - start) / 1e9;
+	result.bytes = (uint64_t)log.size() * passes;
+	nmea_stats_t stats = parser.stats();
+	result.passed = stats.passed;
+	result.failed = stats.failed;
+	return result;
+}
+
+static Result parseParser(const std::string& log, const std::vector<size_t>& lines, uint32_t passes) {
+	NMEAParser parser;
+	Result result;
+	uint64_t start = monotonicNanos();
+	for (uint32_t pass = 0; pass < passes; pass++) {
+		size_t begin = 0;
+		for (size_t end : lines) {
+			if (parser.parse(log.data() + begin, end - begin) != NMEA_NONE && parser.timeUpdated() && parser.dateUpdated()) {
+				result.clockUpdates++;
+			}
+			begin = end;
+		}
+	}
+	result.seconds = (monotonicNanos() - start) / 1e9;
+	result.bytes = (uint64_t)log.size() * passes;
+	nmea_stats_t stats = parser.stats();
+	result.passed = stats.passed;
+	result.failed = stats.failed;
+	return result;
+}
+
+#ifdef HAVE_TINYGPS
+// The GPSManager loop before NMEAParser
+static Result encodeTinyGPS(const std::string& log, uint32_t passes) {
+	TinyGPSPlus gps;
+	Result result;
+	uint64_t start = monotonicNanos();
+	for (uint32_t pass = 0; pass < passes; pass++) {
+		for (char c : log) {
+			if (gps.encode(c) && gps.time.isUpdated() && gps.date.isUpdated()) {
+				gps.time.value();  // reading clears the updated flags
+				gps.date.value();
+				result.clockUpdates++;
+			}
+		}
+	}
+	result.seconds = (monotonicNanos() - start) / 1e9;
+	result.bytes = (uint64_t)log.size() * passes;
+	result.passed = gps.passedChecksum();
+	result.failed = gps.failedChecksum();
+	return result;
+}
+#endif
+
+static void report(const char* name, const Result& result) {
+	printf("%-26s %8.1f MB/s %7.2f ns/byte   %9u good %7u bad %8u clock updates\n", name, result.bytes / result.seconds / 1e6,
+		   result.seconds * 1e9 / result.bytes, result.passed, result.failed, result.clockUpdates);
+}
+
+static void usage(const char* name) {
+	fprintf(stderr, "Usage: %s [-f log] [-m megabytes]\n", name);
+}
+
+int main(int argc, char** argv) {
+	Options options;
+	int opt;
+	while ((opt = getopt(argc, argv, "f:m:h")) != -1) {
+		switch (opt) {
+		case 'f':
+			options.file = optarg;
+			break;
+		case 'm':
+			options.megabytes = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+	if (options.megabytes == 0) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	std::string log;
+	if (options.file) {
+		if (!readLog(options.file, log)) {
+			fprintf(stderr, "Cannot read %s\n", options.file);
+			return 1;
+		}
+	} else {
+		log = syntheticLog();
+	}
+	if (log.empty()) {
+		fprintf(stderr, "Empty log\n");
+		return 1;
+	}
+	// line ends, as the UART driver's pattern detection reports them
+	std::vector<size_t> lines;
+	for (size_t i = 0; i < log.size(); i++) {
+		if (log[i] == '\n') {
+			lines.push_back(i + 1);
+		}
+	}
+	if (lines.empty() || lines.back() != log.size()) {
+		lines.push_back(log.size());
+	}
+	uint32_t passes = (uint32_t)(((uint64_t)options.megabytes * 1000000 + log.size() - 1) / log.size());
+	printf("%s: %zu bytes in %zu lines, %u passes\n", options.file ? options.file : "synthetic log", log.size(), lines.size(), passes);
+
+	report("NMEAParser::encode()", encodeParser(log, passes));
+	report("NMEAParser::parse()", parseParser(log, lines, passes));
+#ifdef HAVE_TINYGPS
+	report("TinyGPSPlus::encode()", encodeTinyGPS(log, passes));
+#else
+	printf("TinyGPSPlus not on the include path, add -I<TinyGPSPlus>/src and its TinyGPS++.cpp to compare\n");
+#endif
+	return 0;
+}
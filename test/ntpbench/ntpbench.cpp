@@ -0,0 +1,341 @@
+// NTP load generator and latency benchmark
+//
+// Sends mode 3 requests at a fixed rate from several sockets and reports sustained
+// replies/sec, loss, server processing time (T3 - T2 from the reply timestamps)
+// and round trip time percentiles. With -k requests carry a MAC and replies are checked.
+//
+// Build: g++ -O2 -std=gnu++17 -pthread test/ntpbench/ntpbench.cpp -o ntpbench -lmbedcrypto
+// Usage: ntpbench [-s server] [-p port] [-r requests/sec] [-c sockets] [-d seconds] [-k id,md5|sha1|aes128cmac,hexkey]
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include "mbedtls/cmac.h"
+#include "mbedtls/md5.h"
+#include "mbedtls/sha1.h"
+
+#define NTP_PACKET_SIZE 48
+#define NTP_MAX_PACKET_SIZE (NTP_PACKET_SIZE + 4 + 20)
+#define DRAIN_MILLIS 500
+
+enum KeyType { KEY_NONE, KEY_MD5, KEY_SHA1, KEY_AES128CMAC };
+
+struct Key {
+	KeyType type = KEY_NONE;
+	uint32_t id = 0;
+	uint8_t key[32];
+	size_t len = 0;
+};
+
+struct Options {
+	const char* server = "127.0.0.1";
+	uint16_t port = 12300;
+	uint32_t rate = 1000;
+	uint32_t concurrency = 4;
+	uint32_t duration = 10;
+	Key key;
+};
+
+struct Worker {
+	uint32_t id;
+	int fd;
+	uint32_t rate;
+	std::vector<uint64_t> sendTimes;	 // CLOCK_MONOTONIC ns, indexed by sequence number
+	std::vector<int64_t> processing;	 // T3 - T2 in ns
+	std::vector<int64_t> roundTrip;		 // T4 - T1 in ns
+	uint64_t sent = 0;
+	uint64_t received = 0;
+	uint64_t unsynchronized = 0;
+	uint64_t mismatched = 0;
+	uint64_t sendErrors = 0;
+	uint64_t badMac = 0;
+};
+
+static Key key;
+
+static std::atomic<bool> sending(true);
+static std::atomic<bool> receiving(true);
+
+static uint64_t monotonicNanos() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static uint32_t readUint32(const uint8_t* buf) {
+	return ((uint32_t)buf[0] << 24) | ((uint32_t)buf[1] << 16) | ((uint32_t)buf[2] << 8) | buf[3];
+}
+
+static void writeUint32(uint8_t* buf, uint32_t value) {
+	buf[0] = (value >> 24) & 0xFF;
+	buf[1] = (value >> 16) & 0xFF;
+	buf[2] = (value >> 8) & 0xFF;
+	buf[3] = value & 0xFF;
+}
+
+// Appends key ID and MAC over the 48 byte header, returns the packet length
+static size_t sign(uint8_t* packet) {
+	if (key.type == KEY_NONE) {
+		return NTP_PACKET_SIZE;
+	}
+	writeUint32(packet + NTP_PACKET_SIZE, key.id);
+	uint8_t* mac = packet + NTP_PACKET_SIZE + 4;
+	if (key.type == KEY_AES128CMAC) {
+		mbedtls_cipher_cmac(mbedtls_cipher_info_from_type(MBEDTLS_CIPHER_AES_128_ECB), key.key, 128, packet,
+							NTP_PACKET_SIZE, mac);
+		return NTP_PACKET_SIZE + 4 + 16;
+	}
+	// legacy MAC, digest of key and header
+	uint8_t data[32 + NTP_PACKET_SIZE];
+	memcpy(data, key.key, key.len);
+	memcpy(data + key.len, packet, NTP_PACKET_SIZE);
+	if (key.type == KEY_MD5) {
+		mbedtls_md5_ret(data, key.len + NTP_PACKET_SIZE, mac);
+		return NTP_PACKET_SIZE + 4 + 16;
+	}
+	mbedtls_sha1_ret(data, key.len + NTP_PACKET_SIZE, mac);
+	return NTP_PACKET_SIZE + 4 + 20;
+}
+
+static bool verify(const uint8_t* packet, size_t len) {
+	if (key.type == KEY_NONE) {
+		return len == NTP_PACKET_SIZE;
+	}
+	uint8_t expected[NTP_MAX_PACKET_SIZE];
+	memcpy(expected, packet, NTP_PACKET_SIZE);
+	return sign(expected) == len && memcmp(expected + NTP_PACKET_SIZE, packet + NTP_PACKET_SIZE, len - NTP_PACKET_SIZE) == 0;
+}
+
+// Parses id,type,hexkey
+static bool parseKey(const char* arg, Key& key) {
+	char type[16];
+	char hex[65];
+	if (sscanf(arg, "%u,%15[^,],%64s", &key.id, type, hex) != 3) {
+		return false;
+	}
+	if (strcasecmp(type, "md5") == 0) {
+		key.type = KEY_MD5;
+	} else if (strcasecmp(type, "sha1") == 0) {
+		key.type = KEY_SHA1;
+	} else if (strcasecmp(type, "aes128cmac") == 0) {
+		key.type = KEY_AES128CMAC;
+	} else {
+		return false;
+	}
+	key.len = strlen(hex) / 2;
+	for (size_t i = 0; i < key.len; i++) {
+		unsigned int byte;
+		if (sscanf(hex + 2 * i, "%2x", &byte) != 1) {
+			return false;
+		}
+		key.key[i] = byte;
+	}
+	return key.len > 0 && (key.type != KEY_AES128CMAC || key.len == 16);
+}
+
+// Difference of two 32.32 NTP timestamps in ns
+static int64_t ntpDiffNanos(const uint8_t* later, const uint8_t* earlier) {
+	uint64_t a = ((uint64_t)readUint32(later) << 32) | readUint32(later + 4);
+	uint64_t b = ((uint64_t)readUint32(earlier) << 32) | readUint32(earlier + 4);
+	int64_t diff = (int64_t)(a - b);
+	// seconds and fraction scaled separately to stay within 64 bits
+	return (diff >> 32) * 1000000000LL + (((diff & 0xFFFFFFFFLL) * 1000000000LL) >> 32);
+}
+
+static void sendLoop(Worker* worker, uint32_t duration) {
+	uint8_t request[NTP_MAX_PACKET_SIZE];
+	uint64_t interval = 1000000000ULL / worker->rate;
+	uint64_t total = (uint64_t)worker->rate * duration;
+	uint64_t start = monotonicNanos();
+	for (uint64_t seq = 0; seq < total && sending; seq++) {
+		uint64_t due = start + seq * interval;
+		struct timespec ts;
+		ts.tv_sec = due / 1000000000ULL;
+		ts.tv_nsec = due % 1000000000ULL;
+		clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+
+		memset(request, 0, sizeof(request));
+		request[0] = 0b00100011;  // LI 0, version 4, mode 3
+		// transmit timestamp carries the worker and sequence number, echoed back as the origin timestamp
+		writeUint32(request + 40, worker->id);
+		writeUint32(request + 44, (uint32_t)seq);
+		size_t len = sign(request);
+		worker->sendTimes[seq] = monotonicNanos();
+		if (send(worker->fd, request, len, 0) == (ssize_t)len) {
+			worker->sent++;
+		} else {
+			worker->sendErrors++;
+		}
+	}
+}
+
+static void receiveLoop(Worker* worker) {
+	uint8_t reply[512];
+	while (receiving) {
+		ssize_t len = recv(worker->fd, reply, sizeof(reply), 0);
+		uint64_t rxTime = monotonicNanos();
+		if (len < NTP_PACKET_SIZE) {
+			continue;
+		}
+		uint32_t seq = readUint32(reply + 28);
+		if (readUint32(reply + 24) != worker->id || seq >= worker->sendTimes.size()) {
+			worker->mismatched++;
+			continue;
+		}
+		worker->received++;
+		if (!verify(reply, len)) {
+			worker->badMac++;
+			continue;
+		}
+		if ((reply[0] >> 6) == 3 || reply[1] == 0 || reply[1] >= 16) {
+			worker->unsynchronized++;
+			continue;
+		}
+		worker->processing.push_back(ntpDiffNanos(reply + 40, reply + 32));
+		worker->roundTrip.push_back(rxTime - worker->sendTimes[seq]);
+	}
+}
+
+static double percentile(const std::vector<int64_t>& sorted, double p) {
+	if (sorted.empty()) {
+		return 0;
+	}
+	size_t index = (size_t)(p / 100.0 * (sorted.size() - 1) + 0.5);
+	return sorted[index] / 1000.0;
+}
+
+static void report(const char* name, std::vector<int64_t>& values) {
+	std::sort(values.begin(), values.end());
+	printf("%-12s p50 %9.1f us  p99 %9.1f us  p99.9 %9.1f us  max %9.1f us\n", name,
+		   percentile(values, 50), percentile(values, 99), percentile(values, 99.9), percentile(values, 100));
+}
+
+static void usage(const char* name) {
+	fprintf(stderr, "Usage: %s [-s server] [-p port] [-r requests/sec] [-c sockets] [-d seconds] [-k id,md5|sha1|aes128cmac,hexkey]\n", name);
+}
+
+int main(int argc, char** argv) {
+	Options options;
+	int opt;
+	while ((opt = getopt(argc, argv, "s:p:r:c:d:k:h")) != -1) {
+		switch (opt) {
+		case 's':
+			options.server = optarg;
+			break;
+		case 'p':
+			options.port = atoi(optarg);
+			break;
+		case 'r':
+			options.rate = atoi(optarg);
+			break;
+		case 'c':
+			options.concurrency = atoi(optarg);
+			break;
+		case 'd':
+			options.duration = atoi(optarg);
+			break;
+		case 'k':
+			if (!parseKey(optarg, options.key)) {
+				fprintf(stderr, "Invalid key %s\n", optarg);
+				return 1;
+			}
+			break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+	if (options.rate == 0 || options.concurrency == 0 || options.duration == 0 || options.rate < options.concurrency) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	key = options.key;
+
+	struct sockaddr_in server = {};
+	server.sin_family = AF_INET;
+	server.sin_port = htons(options.port);
+	if (inet_pton(AF_INET, options.server, &server.sin_addr) != 1) {
+		fprintf(stderr, "Invalid server address %s\n", options.server);
+		return 1;
+	}
+
+	std::vector<Worker> workers(options.concurrency);
+	for (uint32_t i = 0; i < options.concurrency; i++) {
+		Worker& worker = workers[i];
+		worker.id = i;
+		worker.rate = options.rate / options.concurrency;
+		size_t total = (size_t)worker.rate * options.duration;
+		worker.sendTimes.resize(total);
+		worker.processing.reserve(total);
+		worker.roundTrip.reserve(total);
+		worker.fd = socket(AF_INET, SOCK_DGRAM, 0);
+		struct timeval timeout = {0, 100000};
+		setsockopt(worker.fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+		int bufferSize = 1 << 20;
+		setsockopt(worker.fd, SOL_SOCKET, SO_RCVBUF, &bufferSize, sizeof(bufferSize));
+		if (worker.fd < 0 || connect(worker.fd, (struct sockaddr*)&server, sizeof(server)) < 0) {
+			perror("socket");
+			return 1;
+		}
+	}
+
+	printf("Sending %u requests/sec from %u sockets to %s:%u for %u s\n", options.rate, options.concurrency,
+		   options.server, options.port, options.duration);
+	std::vector<std::thread> threads;
+	uint64_t start = monotonicNanos();
+	for (Worker& worker : workers) {
+		threads.emplace_back(receiveLoop, &worker);
+	}
+	std::vector<std::thread> senders;
+	for (Worker& worker : workers) {
+		senders.emplace_back(sendLoop, &worker, options.duration);
+	}
+	for (std::thread& thread : senders) {
+		thread.join();
+	}
+	double elapsed = (monotonicNanos() - start) / 1e9;
+	usleep(DRAIN_MILLIS * 1000);
+	receiving = false;
+	for (std::thread& thread : threads) {
+		thread.join();
+	}
+
+	Worker total;
+	for (Worker& worker : workers) {
+		total.sent += worker.sent;
+		total.received += worker.received;
+		total.unsynchronized += worker.unsynchronized;
+		total.mismatched += worker.mismatched;
+		total.sendErrors += worker.sendErrors;
+		total.badMac += worker.badMac;
+		total.processing.insert(total.processing.end(), worker.processing.begin(), worker.processing.end());
+		total.roundTrip.insert(total.roundTrip.end(), worker.roundTrip.begin(), worker.roundTrip.end());
+		close(worker.fd);
+	}
+
+	uint64_t lost = total.sent > total.received ? total.sent - total.received : 0;
+	printf("Sent %llu, received %llu, lost %llu (%.3f%%), send errors %llu, unsynchronized %llu, mismatched %llu\n",
+		   (unsigned long long)total.sent, (unsigned long long)total.received, (unsigned long long)lost,
+		   total.sent ? 100.0 * lost / total.sent : 0.0, (unsigned long long)total.sendErrors,
+		   (unsigned long long)total.unsynchronized, (unsigned long long)total.mismatched);
+	if (key.type != KEY_NONE) {
+		printf("Replies with a missing or wrong MAC %llu\n", (unsigned long long)total.badMac);
+	}
+	printf("Sustained %.0f replies/sec over %.2f s\n", total.received / elapsed, elapsed);
+	report("Processing", total.processing);
+	report("Round trip", total.roundTrip);
+	return 0;
+}
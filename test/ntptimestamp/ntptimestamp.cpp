@@ -0,0 +1,157 @@
+// NtpTimestamp conversion check and benchmark on the host
+//
+// Checks every microsecond and every nanosecond of a second against the exact conversion:
+// microsToFraction() and nanosToFraction() must be floor(x * 2^32 / 10^n), fractionToMicros()
+// and fractionToNanos() must give x back, and toUnix() must undo fromUnix() across the carry
+// into the next second. Then times each conversion against the 64 bit division and double
+// precision versions they replace, over -m million inputs. The host has a divider and an FPU,
+// the ESP32 has neither for 64 bit operands, so the gap is wider on the board. Exits 1 on
+// any mismatch.
+//
+// Build: g++ -O2 -std=gnu++17 -Ilib/MicroTime test/ntptimestamp/ntptimestamp.cpp -o ntptimestamp
+// Usage: ntptimestamp [-m millions]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <vector>
+
+#include <NtpTimestamp.h>
+
+#define UNIX_SECONDS 1767225600	 // 2026-01-01, for the fromUnix() round trip
+
+struct Options {
+	uint32_t millions = 100;  // conversions timed for each function
+};
+
+static uint64_t monotonicNanos() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// The reference conversions, what the integer ones have to match
+static uint32_t exactFraction(uint32_t value, uint64_t scale) {
+	return (uint32_t)(((uint64_t)value << 32) / scale);
+}
+
+// Read at run time so the benchmark divides, instead of the multiply the compiler makes of a constant divisor
+static volatile uint64_t microsPerSecond = 1000000;
+static volatile uint64_t nanosPerSecond = 1000000000;
+
+// Returns the number of mismatches, and prints the first few
+static uint32_t checkMicros() {
+	uint32_t errors = 0;
+	for (uint32_t micros = 0; micros < 1000000; micros++) {
+		uint32_t fraction = NtpTimestamp::microsToFraction(micros);
+		uint32_t back = NtpTimestamp::fractionToMicros(fraction);
+		uint32_t unixMicros;
+		uint32_t seconds = NtpTimestamp::fromUnix(UNIX_SECONDS, micros).toUnix(unixMicros);
+		if (fraction != exactFraction(micros, 1000000) || back != micros || seconds != UNIX_SECONDS || unixMicros != micros) {
+			if (errors++ < 10) {
+				printf("micros %u: fraction %08x, exact %08x, back %u, toUnix %u.%06u\n", micros, fraction,
+					   exactFraction(micros, 1000000), back, seconds, unixMicros);
+			}
+		}
+	}
+	// the largest fractions round up to the next second and toUnix() carries
+	uint32_t unixMicros;
+	uint32_t seconds = NtpTimestamp::fromFixed(((uint64_t)(UNIX_SECONDS + NTP_UNIX_OFFSET) << 32) | 0xFFFFFFFF).toUnix(unixMicros);
+	if (seconds != UNIX_SECONDS + 1 || unixMicros != 0) {
+		printf("fraction ffffffff: toUnix %u.%06u, not carried into the next second\n", seconds, unixMicros);
+		errors++;
+	}
+	return errors;
+}
+
+static uint32_t checkNanos() {
+	uint32_t errors = 0;
+	for (uint32_t nanos = 0; nanos < 1000000000; nanos++) {
+		uint32_t fraction = NtpTimestamp::nanosToFraction(nanos);
+		uint32_t back = NtpTimestamp::fractionToNanos(fraction);
+		if (fraction != exactFraction(nanos, 1000000000) || back != nanos) {
+			if (errors++ < 10) {
+				printf("nanos %u: fraction %08x, exact %08x, back %u\n", nanos, fraction, exactFraction(nanos, 1000000000), back);
+			}
+		}
+	}
+	return errors;
+}
+
+// Runs convert over inputs until count conversions are done, returns ns per conversion
+template <typename Convert>
+static double bench(const std::vector<uint32_t>& inputs, uint64_t count, Convert convert) {
+	uint32_t sum = 0;	 // kept so the conversions are not optimized away
+	uint64_t start = monotonicNanos();
+	for (uint64_t done = 0; done < count; done += inputs.size()) {
+		for (uint32_t input : inputs) {
+			sum += convert(input);
+		}
+	}
+	double nanos = (double)(monotonicNanos() - start) / count;
+	volatile uint32_t sink = sum;
+	(void)sink;
+	return nanos;
+}
+
+// division is negative for the conversions back from a fraction, which never needed one
+static void report(const char* name, double integer, double division, double floating) {
+	if (division < 0) {
+		printf("%-18s %6.2f ns   64 bit division      -      double %6.2f ns\n", name, integer, floating);
+	} else {
+		printf("%-18s %6.2f ns   64 bit division %6.2f ns   double %6.2f ns\n", name, integer, division, floating);
+	}
+}
+
+static void usage(const char* name) {
+	fprintf(stderr, "Usage: %s [-m millions]\n", name);
+}
+
+int main(int argc, char** argv) {
+	Options options;
+	int opt;
+	while ((opt = getopt(argc, argv, "m:h")) != -1) {
+		switch (opt) {
+		case 'm':
+			options.millions = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+	if (options.millions == 0) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	uint32_t microErrors = checkMicros();
+	printf("micros: 1000000 values, %u mismatches\n", microErrors);
+	uint32_t nanoErrors = checkNanos();
+	printf("nanos: 1000000000 values, %u mismatches\n", nanoErrors);
+
+	// the same pseudo random inputs for every function, so none gets a predictable pattern
+	std::vector<uint32_t> micros(1 << 16), nanos(1 << 16), fractions(1 << 16);
+	uint32_t state = 1;
+	for (size_t i = 0; i < micros.size(); i++) {
+		state = state * 1664525 + 1013904223;
+		fractions[i] = state;
+		micros[i] = state % 1000000;
+		nanos[i] = state % 1000000000;
+	}
+	uint64_t count = (uint64_t)options.millions * 1000000;
+	uint64_t microsScale = microsPerSecond, nanosScale = nanosPerSecond;
+	report("microsToFraction", bench(micros, count, NtpTimestamp::microsToFraction),
+		   bench(micros, count, [=](uint32_t m) { return exactFraction(m, microsScale); }),
+		   bench(micros, count, [](uint32_t m) { return (uint32_t)(m * 4294.967296); }));
+	report("fractionToMicros", bench(fractions, count, NtpTimestamp::fractionToMicros), -1,
+		   bench(fractions, count, [](uint32_t f) { return (uint32_t)(f / 4294.967296 + 0.5); }));
+	report("nanosToFraction", bench(nanos, count, NtpTimestamp::nanosToFraction),
+		   bench(nanos, count, [=](uint32_t n) { return exactFraction(n, nanosScale); }),
+		   bench(nanos, count, [](uint32_t n) { return (uint32_t)(n * 4.294967296); }));
+	report("fractionToNanos", bench(fractions, count, NtpTimestamp::fractionToNanos), -1,
+		   bench(fractions, count, [](uint32_t f) { return (uint32_t)(f / 4.294967296 + 0.5); }));
+	return microErrors == 0 && nanoErrors == 0 ? 0 : 1;
+}
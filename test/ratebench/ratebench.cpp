@@ -0,0 +1,147 @@
+// RateLimiter lookup cost on the host
+//
+// Overfills the table so every probe window is occupied, then times allow() for recent
+// sources, for new sources that have to evict one, and for a single source hammering
+// away over its limit. Reports cycles per call from the TSC (nanoseconds elsewhere).
+//
+// Build: g++ -O2 -std=gnu++17 -Ilib/RateLimiter test/ratebench/ratebench.cpp lib/RateLimiter/RateLimiter.cpp -o ratebench
+// Usage: ratebench [-n lookups] [-i interval ms] [-b burst]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <random>
+#include <vector>
+
+#include <RateLimiter.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define UNIT "cycles"
+static inline uint64_t ticks() {
+	return __rdtsc();
+}
+#else
+#define UNIT "ns"
+static inline uint64_t ticks() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+#endif
+
+#define TABLE_SIZE (1 << RATE_LIMIT_BITS)
+#define BATCH 64  // calls timed together, so the clock read does not dominate
+
+struct Options {
+	uint32_t lookups = 1000000;
+	uint32_t interval = 1000;
+	uint32_t burst = 16;
+};
+
+static void report(const char* name, std::vector<uint64_t>& samples, uint32_t allowed, uint32_t total) {
+	std::sort(samples.begin(), samples.end());
+	printf("%-16s p50 %6.1f  p99 %6.1f  max %8.1f " UNIT "/call, %u of %u allowed\n", name,
+		   samples[samples.size() / 2] / (double)BATCH, samples[samples.size() * 99 / 100] / (double)BATCH,
+		   samples.back() / (double)BATCH, allowed, total);
+}
+
+static void usage(const char* name) {
+	fprintf(stderr, "Usage: %s [-n lookups] [-i interval ms] [-b burst]\n", name);
+}
+
+int main(int argc, char** argv) {
+	Options options;
+	int opt;
+	while ((opt = getopt(argc, argv, "n:i:b:h")) != -1) {
+		switch (opt) {
+		case 'n':
+			options.lookups = atoi(optarg);
+			break;
+		case 'i':
+			options.interval = atoi(optarg);
+			break;
+		case 'b':
+			options.burst = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+	if (options.lookups < BATCH || options.interval == 0) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	RateLimiter limiter;
+	limiter.configure(options.interval * 1000, options.burst);
+	std::mt19937 random(1);
+	uint32_t now = 1;
+
+	// Four sources per slot, all still limited as time does not advance, so every slot is
+	// taken and the last ones added are mostly still in the table
+	std::vector<uint32_t> known;
+	for (uint32_t i = 0; i < TABLE_SIZE * 4; i++) {
+		uint32_t ip = random() | 1;
+		limiter.allow(ip, now);
+		known.push_back(ip);
+	}
+	printf("Table of %u slots, %u probes, filled with %zu sources (%u evictions)\n", TABLE_SIZE, RATE_LIMIT_PROBES,
+		   known.size(), limiter.stats().evicted);
+	known.erase(known.begin(), known.end() - TABLE_SIZE / 2);
+
+	uint32_t batches = options.lookups / BATCH;
+	std::vector<uint32_t> ips(BATCH);
+	std::vector<uint64_t> samples;
+	samples.reserve(batches);
+
+	// Sources seen recently, one request per microsecond
+	uint32_t allowed = 0;
+	for (uint32_t b = 0; b < batches; b++) {
+		for (uint32_t& ip : ips) {
+			ip = known[random() % known.size()];
+		}
+		uint64_t start = ticks();
+		for (uint32_t ip : ips) {
+			allowed += limiter.allow(ip, now++);
+		}
+		samples.push_back(ticks() - start);
+	}
+	report("Recent sources", samples, allowed, batches * BATCH);
+
+	// Sources never seen before, each one evicts
+	samples.clear();
+	allowed = 0;
+	for (uint32_t b = 0; b < batches; b++) {
+		for (uint32_t& ip : ips) {
+			ip = random() | 1;
+		}
+		uint64_t start = ticks();
+		for (uint32_t ip : ips) {
+			allowed += limiter.allow(ip, now++);
+		}
+		samples.push_back(ticks() - start);
+	}
+	report("New sources", samples, allowed, batches * BATCH);
+
+	// One client polling far faster than its limit
+	samples.clear();
+	allowed = 0;
+	uint32_t flooder = known.back();
+	for (uint32_t b = 0; b < batches; b++) {
+		uint64_t start = ticks();
+		for (uint32_t i = 0; i < BATCH; i++) {
+			allowed += limiter.allow(flooder, now++);
+		}
+		samples.push_back(ticks() - start);
+	}
+	report("Flooding source", samples, allowed, batches * BATCH);
+
+	rate_limiter_stats_t stats = limiter.stats();
+	printf("Limited %u, evicted %u\n", stats.limited, stats.evicted);
+	return 0;
+}
@@ -0,0 +1,173 @@
+// NTP reply path allocation check on the host
+//
+// Runs NTPServer on the native shims and sends it -n mode 3 requests over loopback, -w of
+// them outstanding at a time, while nativeHeapStats() counts every new and pbuf_alloc in the
+// process. After a warm up the blocks allocated and not freed must not grow, so a reply path
+// leaking a block per request, as the AsyncUDPMessage one did, is a million blocks short by
+// the end. Allocations per reply are reported too: none with AsyncUDP, the receive pbuf with
+// -DNTP_SERVER_RAW_LWIP. With -k requests are signed, so verifying and signing are covered.
+// Exits 1 if blocks were left over or more than 1% of the replies were lost.
+//
+// Build: g++ -O2 -std=gnu++17 -pthread -DNATIVE $(printf -- '-I%s ' lib/*/) test/replyalloc/replyalloc.cpp
+//            lib/*/*.cpp -o replyalloc -lmbedcrypto
+// Usage: replyalloc [-n requests] [-w window] [-p port] [-k id,md5|sha1|aes128cmac,hexkey]
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <Arduino.h>
+#include <GPSManager.h>
+#include <LoopbackStream.h>
+#include <NTPServer.h>
+
+#define NTP_PACKET_SIZE 48
+#define GPS_PPS_PIN 12
+#define WARM_UP 10000		 // requests before the first count, the first ones fill lazily created state
+#define RECEIVE_TIMEOUT 200	 // ms to wait for a reply before taking it as lost
+
+struct Options {
+	uint32_t requests = 1000000;
+	uint32_t window = 8;
+	uint16_t port = 12310;
+	uint32_t keyId = 0;
+	ntp_key_type_t keyType = NTP_KEY_MD5;
+	char keyHex[2 * NTP_AUTH_KEY_SIZE + 1] = "";
+};
+
+struct Result {
+	uint64_t sent = 0;
+	uint64_t replies = 0;
+};
+
+// Parses id,md5|sha1|aes128cmac,hexkey
+static bool parseKey(const char* arg, Options& options) {
+	char type[16];
+	if (sscanf(arg, "%u,%15[^,],%64s", &options.keyId, type, options.keyHex) != 3) {
+		return false;
+	}
+	if (strcasecmp(type, "md5") == 0) {
+		options.keyType = NTP_KEY_MD5;
+	} else if (strcasecmp(type, "sha1") == 0) {
+		options.keyType = NTP_KEY_SHA1;
+	} else if (strcasecmp(type, "aes128cmac") == 0) {
+		options.keyType = NTP_KEY_AES128CMAC;
+	} else {
+		return false;
+	}
+	return true;
+}
+
+// Sends requests in rounds of window and collects the replies to each round
+static void run(int fd, const Options& options, NTPAuth* auth, uint32_t requests, Result& result) {
+	uint8_t request[NTP_PACKET_SIZE + 4 + NTP_AUTH_MAC_SIZE] = {};
+	request[0] = 0x23;	// version 4, client
+	uint8_t reply[sizeof(request)];
+	while (requests > 0) {
+		uint32_t round = min(requests, options.window);
+		for (uint32_t i = 0; i < round; i++) {
+			size_t length = auth ? auth->sign(request, 0) : NTP_PACKET_SIZE;
+			if (send(fd, request, length, 0) == (ssize_t)length) {
+				result.sent++;
+			}
+		}
+		for (uint32_t i = 0; i < round; i++) {
+			if (recv(fd, reply, sizeof(reply), 0) < NTP_PACKET_SIZE) {
+				break;	// timed out, the rest of the round is lost too
+			}
+			result.replies++;
+		}
+		requests -= round;
+	}
+}
+
+static void usage(const char* name) {
+	fprintf(stderr, "Usage: %s [-n requests] [-w window] [-p port] [-k id,md5|sha1|aes128cmac,hexkey]\n", name);
+}
+
+int main(int argc, char** argv) {
+	Options options;
+	int opt;
+	while ((opt = getopt(argc, argv, "n:w:p:k:h")) != -1) {
+		switch (opt) {
+		case 'n':
+			options.requests = atoi(optarg);
+			break;
+		case 'w':
+			options.window = atoi(optarg);
+			break;
+		case 'p':
+			options.port = atoi(optarg);
+			break;
+		case 'k':
+			if (!parseKey(optarg, options)) {
+				fprintf(stderr, "Invalid key %s\n", optarg);
+				return 1;
+			}
+			break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+	if (options.requests == 0 || options.window == 0 || options.window > NTP_QUEUE_SIZE) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	LoopbackStream gpsSerial;
+	GPSManager gpsManager(gpsSerial, GPS_PPS_PIN);
+	NTPServer server(Serial, gpsManager, options.port);
+	server.rateLimit(0, NTP_RATE_BURST, NTP_RATE_KISS_OF_DEATH);  // every request comes from one address
+	NTPAuth* auth = NULL;
+	if (options.keyHex[0]) {
+		auth = new NTPAuth();
+		if (!server.addKey(options.keyId, options.keyType, options.keyHex) ||
+			!auth->addKey(options.keyId, options.keyType, options.keyHex)) {
+			fprintf(stderr, "Key %u does not fit its type\n", options.keyId);
+			return 1;
+		}
+	}
+
+	int fd = socket(AF_INET, SOCK_DGRAM, 0);
+	struct timeval timeout = {0, RECEIVE_TIMEOUT * 1000};
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+	struct sockaddr_in sa = {};
+	sa.sin_family = AF_INET;
+	sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	sa.sin_port = htons(options.port);
+	if (fd < 0 || connect(fd, (struct sockaddr*)&sa, sizeof(sa)) < 0) {
+		fprintf(stderr, "Cannot open a socket to port %u\n", options.port);
+		return 1;
+	}
+
+	Result warmUp;
+	run(fd, options, auth, WARM_UP, warmUp);
+	if (warmUp.replies == 0) {
+		fprintf(stderr, "No replies on port %u\n", options.port);
+		return 1;
+	}
+	delay(RECEIVE_TIMEOUT);	 // anything still in flight is freed before counting
+	native_heap_stats_t before = nativeHeapStats();
+	Result result;
+	uint64_t start = esp_timer_get_time();
+	run(fd, options, auth, options.requests, result);
+	uint64_t elapsed = esp_timer_get_time() - start;
+	delay(RECEIVE_TIMEOUT);
+	native_heap_stats_t after = nativeHeapStats();
+	close(fd);
+
+	ntp_server_stats_t stats = server.stats();
+	int64_t leaked = after.blocks - before.blocks;
+	printf("%llu requests, %llu replies, %.0f replies/s, %u dropped by the server, %u failed authentication\n",
+		   (unsigned long long)result.sent, (unsigned long long)result.replies, result.replies * 1e6 / elapsed, stats.dropped,
+		   stats.authFailed);
+	printf("%llu allocations, %.3f per reply, %lld blocks left over\n", (unsigned long long)(after.allocations - before.allocations),
+		   result.replies ? (double)(after.allocations - before.allocations) / result.replies : 0.0, (long long)leaked);
+	delete auth;
+	return leaked <= 0 && result.replies * 100 >= result.sent * 99 ? 0 : 1;
+}
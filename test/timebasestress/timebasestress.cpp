@@ -0,0 +1,240 @@
+// MicroTime timebase stress test on the host
+//
+// One writer disciplines the clock the way the GPS task does, queueing a PPS edge with
+// syncToPPS() every second, then running processPPS() and calling setTime() -e ms after it,
+// while reader threads call nowNtp() as fast as they can and check that it never goes
+// backwards. Every 10 s the writer lets -b edges queue up before processPPS(), as when the
+// GPS task is held up. The local clock runs -s times faster than real time, so every
+// simulated second is a timebase update and a reader sees thousands of them. Edges come
+// from an oscillator -f ppm off with -j ns of jitter and a step of -o ns every 10 s, so the
+// servo is always slewing.
+//
+// Slewing only changes the rate from when it is published, so no update should move the
+// time at an instant before it. Around each processPPS() and setTime() the writer converts
+// the same local instant with localToNtp() and counts a jump if the answers differ by more
+// than -m ns. Exits 1 if any reader saw time go backwards, the servo stepped (offsets over
+// 1 ms, which a -o that large or a writer far behind its edges causes) or an update jumped.
+//
+// Build: g++ -O2 -std=gnu++17 -pthread -DNATIVE -Ilib/NativeShims -Ilib/MicroTime
+//            test/timebasestress/timebasestress.cpp lib/MicroTime/MicroTime.cpp -o timebasestress
+// Usage: timebasestress [-r readers] [-d seconds] [-s speedup] [-f ppm] [-j jitter ns] [-o step ns]
+//                       [-e delay ms] [-b backlog edges] [-m jump ns]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include <Arduino.h>
+#include <MicroTime.h>
+
+#define START_TIME 1767225600  // 2026-01-01, Unix time the clock is set to
+#define STEP_INTERVAL 10	   // simulated seconds between phase steps
+#define BACKLOG_INTERVAL 10	   // simulated seconds between edge backlogs, which start halfway between steps
+#define BACKLOG_MAX 8		   // PPS_RING_SIZE, more edges would overflow the ring
+#define SET_TIME_LIMIT 900000000  // nanos after an edge the sentences naming its second can still come in
+
+struct Options {
+	uint32_t readers = 4;
+	uint32_t seconds = 10;
+	uint32_t speedup = 100;
+	double ppm = 20;
+	uint32_t jitter = 500;
+	uint32_t step = 20000;
+	uint32_t delay = 300;	// ms from an edge to processPPS() and setTime()
+	uint32_t backlog = 3;	// edges queued before processPPS() every BACKLOG_INTERVAL
+	uint32_t jump = 100;	// ns an update may move the time at an earlier instant
+};
+
+struct ReaderResult {
+	uint64_t reads = 0;
+	uint64_t backwards = 0;
+	uint64_t worst = 0;	 // largest step back, in 2^-32 seconds
+};
+
+static Options options;
+static std::atomic<bool> running(true);
+static std::atomic<uint32_t> updates(0);
+static uint64_t maxLate = 0;	// nanos of simulated time the writer got to an edge after it
+static uint32_t steps = 0;		// edges the servo stepped for instead of slewing
+static uint32_t jumps = 0;		// updates that moved the time by more than options.jump
+static uint64_t maxJump = 0;	// nanos
+static uint32_t skipped = 0;	// setTime() calls left out as the writer was too late for the second
+static uint64_t startNanos;
+
+static uint64_t monotonicNanos() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// Stands in for the NativeShims one, MicroTime's only outside clock, sped up
+int64_t esp_timer_get_time() {
+	return (int64_t)((monotonicNanos() - startNanos) * options.speedup / 1000);
+}
+
+// Waits for local nanos target, returns how late the writer got there
+static uint64_t waitUntil(uint64_t target) {
+	while (running && (uint64_t)esp_timer_get_time() * 1000 < target) {
+		std::this_thread::yield();
+	}
+	return (uint64_t)esp_timer_get_time() * 1000 - target;
+}
+
+// Runs update and checks that the time at a local instant just before it did not move
+template <typename Update>
+static void checked(Update update) {
+	uint64_t local = esp_timer_get_time();
+	uint64_t before = localToNtp(local).toFixed();
+	update();
+	int64_t moved = (int64_t)(localToNtp(local).toFixed() - before);
+	uint64_t nanos = (uint64_t)(moved < 0 ? -moved : moved) * 1000000000 >> 32;
+	if (nanos > options.jump) {
+		jumps++;
+	}
+	maxJump = nanos > maxJump ? nanos : maxJump;
+}
+
+static void writer() {
+	std::mt19937 random(1);
+	std::uniform_int_distribution<int32_t> noise(-(int32_t)options.jitter, options.jitter);
+	setTime(START_TIME);
+	// the first edge is a second after the clock was set, like the first PPS after a fix
+	uint64_t first = (uint64_t)esp_timer_get_time() * 1000 + 1000000000;
+	int64_t phase = 0;
+	for (uint32_t second = 0; running; second++) {
+		if (second > 0 && second % STEP_INTERVAL == 0) {
+			phase += second / STEP_INTERVAL % 2 ? options.step : -(int64_t)options.step;
+		}
+		uint64_t edge = first + (uint64_t)(second * 1e9 * (1 + options.ppm / 1e6)) + phase + noise(random);
+		waitUntil(edge);
+		if (!running) {
+			break;
+		}
+		syncToPPS(edge);
+		// the first backlog - 1 edges of a backlog are left queued
+		uint32_t phaseInBacklog = (second + BACKLOG_INTERVAL / 2) % BACKLOG_INTERVAL;
+		if (second > 0 && phaseInBacklog < options.backlog - 1) {
+			continue;
+		}
+		uint64_t late = waitUntil(edge + (uint64_t)options.delay * 1000000);
+		if (!running) {
+			break;
+		}
+		maxLate = late > maxLate ? late : maxLate;
+		checked(processPPS);
+		int32_t offset = clockOffset();
+		if (offset > 1000000 || offset < -1000000) {
+			steps++;
+		}
+		// the GPS task sets the second the sentences after the edge name, which only steps on a mismatch.
+		// One run a second late, as readers can hold the only core for that long, has the next ones.
+		if ((uint64_t)esp_timer_get_time() * 1000 - edge < SET_TIME_LIMIT) {
+			checked([second] { setTime(START_TIME + 1 + second); });
+		} else {
+			skipped++;
+		}
+		updates++;
+	}
+}
+
+static void reader(ReaderResult* result) {
+	uint64_t last = nowNtp().toFixed();
+	while (running) {
+		uint64_t now = nowNtp().toFixed();
+		if (now < last) {
+			result->backwards++;
+			if (last - now > result->worst) {
+				result->worst = last - now;
+			}
+		}
+		last = now;
+		result->reads++;
+	}
+}
+
+static void usage(const char* name) {
+	fprintf(stderr, "Usage: %s [-r readers] [-d seconds] [-s speedup] [-f ppm] [-j jitter ns] [-o step ns] [-e delay ms] [-b backlog edges] [-m jump ns]\n", name);
+}
+
+int main(int argc, char** argv) {
+	int opt;
+	while ((opt = getopt(argc, argv, "r:d:s:f:j:o:e:b:m:h")) != -1) {
+		switch (opt) {
+		case 'r':
+			options.readers = atoi(optarg);
+			break;
+		case 'd':
+			options.seconds = atoi(optarg);
+			break;
+		case 's':
+			options.speedup = atoi(optarg);
+			break;
+		case 'f':
+			options.ppm = atof(optarg);
+			break;
+		case 'j':
+			options.jitter = atoi(optarg);
+			break;
+		case 'o':
+			options.step = atoi(optarg);
+			break;
+		case 'e':
+			options.delay = atoi(optarg);
+			break;
+		case 'b':
+			options.backlog = atoi(optarg);
+			break;
+		case 'm':
+			options.jump = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+	if (options.readers == 0 || options.seconds == 0 || options.speedup == 0 || options.delay >= 900 || options.backlog == 0 ||
+		options.backlog > BACKLOG_MAX) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	startNanos = monotonicNanos();
+	std::vector<ReaderResult> results(options.readers);
+	std::thread writerThread(writer);
+	while (timeStatus() == timeNotSet) {
+		std::this_thread::yield();
+	}
+	std::vector<std::thread> readers;
+	for (uint32_t i = 0; i < options.readers; i++) {
+		readers.emplace_back(reader, &results[i]);
+	}
+	sleep(options.seconds);
+	running = false;
+	writerThread.join();
+	for (std::thread& thread : readers) {
+		thread.join();
+	}
+
+	uint64_t reads = 0, backwards = 0, worst = 0;
+	for (const ReaderResult& result : results) {
+		reads += result.reads;
+		backwards += result.backwards;
+		worst = result.worst > worst ? result.worst : worst;
+	}
+	pps_stats_t pps = ppsStats();
+	printf("%u readers, %u timebase updates, %llu reads, %.1f M reads/s\n", options.readers, updates.load(),
+		   (unsigned long long)reads, reads / 1e6 / options.seconds);
+	printf("PPS: %u edges, %u accepted, %u outliers, offset %d ns, frequency %.3f ppm, jitter %u ns\n", pps.edges,
+		   pps.accepted, pps.outliers, clockOffset(), clockFrequency(), clockJitter());
+	printf("writer up to %.3f ms late, %u setTime() calls skipped as too late\n", maxLate / 1e6, skipped);
+	printf("%u steps, %u updates moved the time by over %u ns, largest %llu ns\n", steps, jumps, options.jump,
+		   (unsigned long long)maxJump);
+	printf("%llu times backwards, worst %.3f ns\n", (unsigned long long)backwards, worst * 1e9 / 4294967296.0);
+	return backwards == 0 && steps == 0 && jumps == 0 ? 0 : 1;
+}